@@ -70,6 +70,13 @@ size_t iconv_ucs2(iconv_ucs2_t cd,
     const char bom[] = { 0xFF, 0xFE };
 #endif
 
+    /* flushing or resetting the conversion state brings back the BOM */
+    if (!inbuf || !*inbuf)
+    {
+        cd->pos = 0;
+        return iconv(cd->cd, inbuf, inbytesleft, outbuf, outbytesleft);
+    }
+
     if (cd->pos < sizeof(bom) && cd->add_bom)
     {
         for (; *outbytesleft > 0 && cd->pos < sizeof(bom); cd->pos++)
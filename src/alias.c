@@ -3,12 +3,12 @@
 #include "alias.h"
 #include "id3v1.h"   /* struct id3v1_tag {...} */
 #include "common.h"  /* for_each() */
-#include "params.h"  /* g_config */
+#include "params.h"  /* struct id321_config */
 
 #define OFF1(field) offsetof(struct id3v1_tag, field)
 #define SIZ1(field) sizeof(((struct id3v1_tag *)NULL)->field)
 #define OFF1SIZ1(field) OFF1(field), SIZ1(field)
-#define CONF(field) &g_config.field
+#define CONF(field) offsetof(struct id321_config, field)
 #define OFF1SIZ1CONF(field) OFF1SIZ1(field), CONF(field)
 
 struct alias
@@ -19,7 +19,7 @@ struct alias
     const char  *v24;
     size_t       v1offset;
     size_t       v1size;
-    const char **conf;
+    size_t       confoffset;  /* 0 if there is no such option */
 };
 
 static const struct alias *find_alias(char alias)
@@ -29,7 +29,7 @@ static const struct alias *find_alias(char alias)
     {
         { 'a', "TP1", "TPE1", "TPE1", OFF1SIZ1CONF(artist)     },
         { 'c', "COM", "COMM", "COMM", OFF1SIZ1CONF(comment)    },
-        { 'g', "TCO", "TCON", "TCON", OFF1SIZ1(genre_id), NULL },
+        { 'g', "TCO", "TCON", "TCON", OFF1SIZ1(genre_id), 0    },
         { 'G', "TCO", "TCON", "TCON", OFF1SIZ1CONF(genre_str)  },
         { 'l', "TAL", "TALB", "TALB", OFF1SIZ1CONF(album)      },
         { 'n', "TRK", "TRCK", "TRCK", OFF1SIZ1CONF(track)      },
@@ -82,9 +82,10 @@ void *get_v1_data_by_alias(char alias, const struct id3v1_tag *tag,
     return (char *)tag + al->v1offset;
 }
 
-const char *get_config_data_by_alias(char alias)
+const char *get_config_data_by_alias(const struct id321_config *conf,
+                                     char alias)
 {
     const struct alias *al = get_alias(alias);
-    assert(al->conf != NULL);
-    return *al->conf;
+    assert(al->confoffset != 0);
+    return *(const char **)((const char *)conf + al->confoffset);
 }
@@ -0,0 +1,241 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "common.h"   /* fatal() */
+#include "xalloc.h"   /* heap_alloc(), heap_free() */
+
+/*
+ * An arena hands out memory from large chunks by bumping a pointer, and
+ * frees all of it at once. Chunks are kept across resets and reused, so
+ * a reset costs nothing but freeing blocks too big for chunks, which are
+ * allocated from the heap one by one.
+ *
+ * Each block is preceded by a header holding its size, so that blocks can
+ * be reallocated. The last block of the current chunk is grown and freed
+ * in place, which makes growing buffers and short-lived temporaries
+ * cheap.
+ */
+
+#define ARENA_ALIGN     16
+#define ALIGN_UP(sz)    (((sz) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define HDR_SIZE        ARENA_ALIGN
+#define CHUNK_SIZE      (64 * 1024)
+#define CHUNK_CAPACITY  (CHUNK_SIZE - HDR_SIZE)
+#define BIG_BLOCK_SIZE  (CHUNK_SIZE / 4)
+#define NO_BLOCK        SIZE_MAX
+
+/* both chunks and big blocks start with a link to the next one */
+struct link
+{
+    struct link *next;
+};
+
+struct arena
+{
+    struct link *chunks;  /* all the chunks allocated */
+    struct link *cur;     /* chunk blocks are taken from */
+    size_t       pos;     /* offset of free space in the current chunk */
+    size_t       last;    /* offset of the last block in the current chunk */
+    struct link *big;     /* big blocks, the most recent first */
+};
+
+#define CHUNK_DATA(chunk) ((char *)(chunk) + HDR_SIZE)
+#define BLOCK_SIZE_OF(ptr) (*(size_t *)((char *)(ptr) - HDR_SIZE))
+#define IS_BIG_BLOCK(size) (HDR_SIZE + ALIGN_UP(size) > BIG_BLOCK_SIZE)
+
+static void *xmalloc_raw(size_t sz)
+{
+    void *buf = heap_alloc(sz);
+
+    if (!buf)
+        fatal("can't allocate %lu bytes of memory", (unsigned long)sz);
+
+    return buf;
+}
+
+struct arena *new_arena(void)
+{
+    struct arena *arena = xmalloc_raw(sizeof(struct arena));
+
+    arena->chunks = NULL;
+    arena->cur = NULL;
+    arena->pos = 0;
+    arena->last = NO_BLOCK;
+    arena->big = NULL;
+
+    return arena;
+}
+
+/***
+ * reset_arena
+ *
+ * Frees all the blocks allocated from @arena at once. Chunks are kept to
+ * be reused.
+ */
+
+void reset_arena(struct arena *arena)
+{
+    while (arena->big)
+    {
+        struct link *next = arena->big->next;
+
+        heap_free(arena->big);
+        arena->big = next;
+    }
+
+    arena->cur = arena->chunks;
+    arena->pos = 0;
+    arena->last = NO_BLOCK;
+}
+
+void free_arena(struct arena *arena)
+{
+    if (!arena)
+        return;
+
+    reset_arena(arena);
+
+    while (arena->chunks)
+    {
+        struct link *next = arena->chunks->next;
+
+        heap_free(arena->chunks);
+        arena->chunks = next;
+    }
+
+    heap_free(arena);
+}
+
+void *arena_alloc(struct arena *arena, size_t sz)
+{
+    size_t need = HDR_SIZE + ALIGN_UP(sz);
+    char *hdr;
+
+    if (need < sz)
+    {
+        errno = ENOMEM;
+        fatal("can't allocate %lu bytes of memory", (unsigned long)sz);
+    }
+
+    if (IS_BIG_BLOCK(sz))
+    {
+        struct link *big = xmalloc_raw(HDR_SIZE + need);
+
+        big->next = arena->big;
+        arena->big = big;
+        hdr = (char *)big + HDR_SIZE;
+        *(size_t *)hdr = sz;
+
+        return hdr + HDR_SIZE;
+    }
+
+    if (!arena->cur || arena->pos + need > CHUNK_CAPACITY)
+    {
+        struct link *next = arena->cur ? arena->cur->next : arena->chunks;
+
+        if (!next)
+        {
+            next = xmalloc_raw(CHUNK_SIZE);
+            next->next = NULL;
+
+            if (arena->cur)
+                arena->cur->next = next;
+            else
+                arena->chunks = next;
+        }
+
+        arena->cur = next;
+        arena->pos = 0;
+    }
+
+    hdr = CHUNK_DATA(arena->cur) + arena->pos;
+    *(size_t *)hdr = sz;
+    arena->last = arena->pos;
+    arena->pos += need;
+
+    return hdr + HDR_SIZE;
+}
+
+static int is_last_block(const struct arena *arena, const void *ptr)
+{
+    return arena->last != NO_BLOCK
+           && (const char *)ptr == CHUNK_DATA(arena->cur) + arena->last
+                                   + HDR_SIZE;
+}
+
+static int is_last_big_block(const struct arena *arena, const void *ptr)
+{
+    return arena->big
+           && (const char *)ptr == (char *)arena->big + 2 * HDR_SIZE;
+}
+
+void *arena_realloc(struct arena *arena, void *ptr, size_t sz)
+{
+    size_t oldsize;
+    void *newptr;
+
+    if (!ptr)
+        return arena_alloc(arena, sz);
+
+    oldsize = BLOCK_SIZE_OF(ptr);
+
+    if (sz <= oldsize)
+        return ptr;
+
+    if (is_last_big_block(arena, ptr) && IS_BIG_BLOCK(sz))
+    {
+        struct link *big = heap_realloc(arena->big,
+                                        2 * HDR_SIZE + ALIGN_UP(sz));
+
+        if (!big)
+            fatal("can't allocate %lu bytes of memory", (unsigned long)sz);
+
+        arena->big = big;
+        newptr = (char *)big + 2 * HDR_SIZE;
+        BLOCK_SIZE_OF(newptr) = sz;
+
+        return newptr;
+    }
+
+    if (is_last_block(arena, ptr) && !IS_BIG_BLOCK(sz)
+        && arena->last + HDR_SIZE + ALIGN_UP(sz) <= CHUNK_CAPACITY)
+    {
+        BLOCK_SIZE_OF(ptr) = sz;
+        arena->pos = arena->last + HDR_SIZE + ALIGN_UP(sz);
+
+        return ptr;
+    }
+
+    newptr = arena_alloc(arena, sz);
+    memcpy(newptr, ptr, oldsize);
+
+    return newptr;
+}
+
+/***
+ * arena_free
+ *
+ * Only the last block of the current chunk and the most recent big block
+ * are actually freed, the rest are left until the arena is reset.
+ */
+
+void arena_free(struct arena *arena, void *ptr)
+{
+    if (!ptr)
+        return;
+
+    if (is_last_block(arena, ptr))
+    {
+        arena->pos = arena->last;
+        arena->last = NO_BLOCK;
+    }
+    else if (is_last_big_block(arena, ptr))
+    {
+        struct link *next = arena->big->next;
+
+        heap_free(arena->big);
+        arena->big = next;
+    }
+}
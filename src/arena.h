@@ -0,0 +1,16 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct arena;
+
+struct arena *new_arena(void);
+void reset_arena(struct arena *arena);
+void free_arena(struct arena *arena);
+
+void *arena_alloc(struct arena *arena, size_t sz);
+void *arena_realloc(struct arena *arena, void *ptr, size_t sz);
+void arena_free(struct arena *arena, void *ptr);
+
+#endif /* ARENA_H */
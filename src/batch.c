@@ -0,0 +1,341 @@
+#include <config.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>     /* free() */
+#include <string.h>
+#include <sys/types.h>  /* ssize_t */
+#include "arena.h"
+#include "batch.h"
+#include "common.h"     /* fatal() */
+#include "output.h"
+#include "params.h"
+#include "xalloc.h"
+
+/*
+ * In batch mode id321 reads commands from stdin, and replies to each of
+ * them on stdout, so that a caller may keep one process running and have
+ * the locale and iconv descriptors set up once rather than for each file.
+ * A command is what id321 would be run with, e.g.
+ *
+ *     modify -2 -t 'A title' "some file.mp3"
+ *
+ * and is either a line split into words as a shell does, or, with -0, a
+ * sequence of null-terminated words ended by an empty word. The reply is
+ *
+ *     <status> <out_size> <err_size>\n<out><err>
+ *
+ * where status is 0 if the command has succeeded and 1 otherwise, and
+ * <out> and <err> are what it has written to stdout and stderr, which are
+ * <out_size> and <err_size> bytes long. Empty commands are ignored.
+ */
+
+extern int init_config(struct id321_config *conf, int *argc, char ***argv);
+extern void reserve_stdin(void);
+
+struct command
+{
+    char   *line;       /* the last line read */
+    size_t  line_size;
+    char   *word;       /* the last word read in null-delimited mode */
+    size_t  word_size;
+    char   *buf;        /* the words read in null-delimited mode */
+    size_t  buf_size;
+    char  **argv;       /* the program name followed by the words */
+    size_t  argc;
+    size_t  max_argc;
+};
+
+static void add_word(struct command *cmd, char *word)
+{
+    /* there is always room for the terminating NULL */
+    if (cmd->argc + 2 > cmd->max_argc)
+    {
+        cmd->max_argc = cmd->max_argc ? cmd->max_argc * 2 : 16;
+        cmd->argv = xrealloc(cmd->argv, cmd->max_argc * sizeof(char *));
+    }
+
+    cmd->argv[cmd->argc++] = word;
+    cmd->argv[cmd->argc] = NULL;
+}
+
+static inline int is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/***
+ * split_line
+ *
+ * Splits @line into words in place the way a shell does. Words are
+ * separated by blanks, and may be quoted with single quotes, within which
+ * every character is literal, or with double quotes, within which only '"'
+ * and '\' may be escaped with '\'. Outside of quotes '\' escapes any
+ * character.
+ *
+ * Returns 0 on success, or -EILSEQ if a quote is not closed.
+ */
+
+static int split_line(struct command *cmd, char *line)
+{
+    char *read = line;
+    char *write = line;
+
+    for (;;)
+    {
+        char quote = '\0';
+        int is_last;
+
+        while (is_blank(*read))
+            read++;
+
+        if (*read == '\0')
+            return 0;
+
+        add_word(cmd, write);
+
+        for (; *read; read++)
+        {
+            if (quote == '\'' && *read != '\'')
+                *write++ = *read;
+            else if (quote == '"' && *read != '"')
+            {
+                if (*read == '\\' && (read[1] == '"' || read[1] == '\\'))
+                    read++;
+                *write++ = *read;
+            }
+            else if (quote)
+                quote = '\0';
+            else if (*read == '\'' || *read == '"')
+                quote = *read;
+            else if (is_blank(*read))
+                break;
+            else
+            {
+                if (*read == '\\' && read[1] != '\0')
+                    read++;
+                *write++ = *read;
+            }
+        }
+
+        if (quote)
+            return -EILSEQ;
+
+        /* the word may be terminated right over the blank after it */
+        is_last = (*read == '\0');
+        *write++ = '\0';
+
+        if (is_last)
+            return 0;
+
+        read++;
+    }
+}
+
+/***
+ * read_command
+ *
+ * Reads the next command from @in into @cmd, whose words are null-delimited
+ * if @is_nul is non-zero.
+ *
+ * Returns 1 if a command has been read, 0 at the end of @in, or -EILSEQ if
+ * a command has been read but it cannot be split into words.
+ */
+
+static int read_command(struct command *cmd, FILE *in, int is_nul)
+{
+    ssize_t len;
+
+    cmd->argc = 0;
+    add_word(cmd, program_name);
+
+    if (!is_nul)
+    {
+        len = getline(&cmd->line, &cmd->line_size, in);
+
+        if (len < 0)
+            return 0;
+
+        if (len > 0 && cmd->line[len - 1] == '\n')
+            cmd->line[len - 1] = '\0';
+
+        return split_line(cmd, cmd->line) == 0 ? 1 : -EILSEQ;
+    }
+    else
+    {
+        size_t used = 0;
+        size_t offset = 0;
+
+        while ((len = getdelim(&cmd->word, &cmd->word_size, '\0', in)) > 0)
+        {
+            /* the last word may be not terminated at the end of @in */
+            size_t size = strlen(cmd->word) + 1;
+
+            if (size == 1)
+                break;
+
+            if (used + size > cmd->buf_size)
+            {
+                cmd->buf_size = (used + size) * 2;
+                cmd->buf = xrealloc(cmd->buf, cmd->buf_size);
+            }
+
+            memcpy(cmd->buf + used, cmd->word, size);
+            used += size;
+        }
+
+        if (len < 0 && used == 0)
+            return 0;
+
+        /* the buffer may have moved, so the words are added once read */
+        while (offset < used)
+        {
+            add_word(cmd, cmd->buf + offset);
+            offset += strlen(cmd->buf + offset) + 1;
+        }
+
+        return 1;
+    }
+}
+
+/* what a command writes to stdout and stderr, kept for its reply */
+struct reply
+{
+    FILE   *out_stream;
+    FILE   *err_stream;
+    char   *out;
+    size_t  out_size;
+    char   *err;
+    size_t  err_size;
+};
+
+static void start_reply(struct reply *reply)
+{
+    memset(reply, 0, sizeof(struct reply));
+    reply->out_stream = open_memstream(&reply->out, &reply->out_size);
+    reply->err_stream = open_memstream(&reply->err, &reply->err_size);
+
+    /* what the command outputs makes part of the reply, so it cannot be
+     * run if the output cannot be kept */
+    if (!reply->out_stream || !reply->err_stream)
+        fatal("can't keep the output of a command");
+
+    set_output_streams(reply->out_stream, reply->err_stream);
+}
+
+/* replies on @out to the command which has returned @ret */
+
+static void send_reply(struct reply *reply, int ret, FILE *out)
+{
+    set_output_streams(NULL, NULL);
+    fclose(reply->out_stream);
+    fclose(reply->err_stream);
+
+    fprintf(out, "%d %zu %zu\n", ret == 0 ? 0 : 1,
+            reply->out_size, reply->err_size);
+
+    fwrite(reply->out, 1, reply->out_size, out);
+    fwrite(reply->err, 1, reply->err_size, out);
+
+    /* the caller waits for the reply before sending the next command */
+    fflush(out);
+
+    free(reply->out);
+    free(reply->err);
+}
+
+/***
+ * run_command
+ *
+ * Runs the command made of @argc words @argv, the first of which is the
+ * program name, by @run, with the memory allocated while running it coming
+ * from @arena, and replies to it on @out.
+ */
+
+void run_command(int argc, char **argv, run_action_t run,
+                 struct arena *arena, FILE *out)
+{
+    struct id321_config conf;
+    struct reply reply;
+    int ret;
+
+    start_reply(&reply);
+
+    if ((ret = init_config(&conf, &argc, &argv)) > 0)
+        ret = 0;
+    else if (ret == 0 && (conf.action & (ID3_BATCH | ID3_SERVE)))
+    {
+        print(OS_ERROR, "a command cannot run other commands");
+        ret = -1;
+    }
+    else if (ret == 0)
+        ret = run(&conf, argc, argv, arena);
+
+    reset_arena(arena);
+    send_reply(&reply, ret, out);
+}
+
+/***
+ * run_commands
+ *
+ * Runs the commands read from @in one by one by @run, with the memory
+ * allocated while running them coming from @arena, and replies to each of
+ * them on @out. The words of the commands are null-delimited if @is_nul is
+ * non-zero. reserve_stdin() must have been called, so that the commands
+ * do not read frame data from stdin.
+ *
+ * Returns 0 once @in is over, or -EIO if it cannot be read.
+ */
+
+int run_commands(FILE *in, FILE *out, int is_nul, run_action_t run,
+                 struct arena *arena)
+{
+    struct command cmd = { 0 };
+    int ret;
+
+    while ((ret = read_command(&cmd, in, is_nul)) != 0)
+    {
+        if (ret < 0)
+        {
+            struct reply reply;
+
+            start_reply(&reply);
+            print(OS_ERROR, "unterminated quote in the command");
+            send_reply(&reply, ret, out);
+        }
+        else if (cmd.argc > 1)
+            run_command(cmd.argc, cmd.argv, run, arena, out);
+    }
+
+    free(cmd.line);
+    free(cmd.word);
+    xfree(cmd.buf);
+    xfree(cmd.argv);
+
+    return ferror(in) ? -EIO : 0;
+}
+
+/***
+ * run_batch
+ *
+ * Runs the commands read from stdin one by one, and replies to each of them
+ * on stdout. The words of the commands are null-delimited if @conf has
+ * ID321_OPT_NUL_DELIMITED.
+ *
+ * Returns 0 once stdin is over, or -EIO if it cannot be read.
+ */
+
+int run_batch(const struct id321_config *conf)
+{
+    struct arena *arena = new_arena();
+    int ret;
+
+    /* frame data cannot be read from stdin, which is where commands are */
+    reserve_stdin();
+
+    ret = run_commands(stdin, stdout,
+                       (conf->options & ID321_OPT_NUL_DELIMITED) != 0,
+                       run_action, arena);
+    free_arena(arena);
+
+    return ret;
+}
@@ -0,0 +1,21 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include "arena.h"
+#include "params.h"
+
+/* how the files of a command are processed, e.g. run_action() */
+typedef int (*run_action_t)(const struct id321_config *conf,
+                            int argc, char **argv, struct arena *arena);
+
+int run_action(const struct id321_config *conf, int argc, char **argv,
+               struct arena *arena);
+
+void run_command(int argc, char **argv, run_action_t run,
+                 struct arena *arena, FILE *out);
+int run_commands(FILE *in, FILE *out, int is_nul, run_action_t run,
+                 struct arena *arena);
+int run_batch(const struct id321_config *conf);
+
+#endif /* BATCH_H */
@@ -0,0 +1,145 @@
+#include <config.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * A client of id321 serve, to exercise it on the same machine:
+ *
+ *     id321-client [-n COUNT] SOCKET ARG...
+ *
+ * sends the command made of ARGs, e.g. "print -2 best.mp3", COUNT times
+ * over one connection, writes out what it outputs, and exits with its
+ * status.
+ */
+
+static int connect_to(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+
+    return fd;
+}
+
+static int send_command(FILE *out, int argc, char **argv)
+{
+    int i;
+
+    for (i = 0; i < argc; i++)
+        fwrite(argv[i], 1, strlen(argv[i]) + 1, out);
+
+    fputc('\0', out);
+
+    return fflush(out) == 0 ? 0 : -1;
+}
+
+static int copy_bytes(FILE *from, FILE *to, size_t size)
+{
+    char buf[4096];
+
+    while (size > 0)
+    {
+        size_t len = fread(buf, 1, size < sizeof(buf) ? size : sizeof(buf),
+                           from);
+
+        if (len == 0)
+            return -1;
+
+        fwrite(buf, 1, len, to);
+        size -= len;
+    }
+
+    return 0;
+}
+
+/* returns the status of the command, or -1 if there is no proper reply */
+
+static int receive_reply(FILE *in)
+{
+    int status;
+    size_t out_size;
+    size_t err_size;
+
+    if (fscanf(in, "%d %zu %zu", &status, &out_size, &err_size) != 3
+        || fgetc(in) != '\n'
+        || copy_bytes(in, stdout, out_size) != 0
+        || copy_bytes(in, stderr, err_size) != 0)
+        return -1;
+
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    long count = 1;
+    int status = 0;
+    FILE *in = NULL;
+    FILE *out = NULL;
+    int fd;
+
+    if (argc > 2 && !strcmp(argv[1], "-n"))
+    {
+        count = atol(argv[2]);
+        argc -= 2;
+        argv += 2;
+    }
+
+    /* the server does not reply to empty commands */
+    if (argc < 3 || count < 1)
+    {
+        fprintf(stderr, "usage: id321-client [-n COUNT] SOCKET ARG...\n");
+        return EXIT_FAILURE;
+    }
+
+    fd = connect_to(argv[1]);
+
+    if (fd >= 0)
+    {
+        in = fdopen(fd, "r");
+        out = fdopen(dup(fd), "w");
+    }
+
+    if (!in || !out)
+    {
+        fprintf(stderr, "id321-client: %s: %s\n", argv[1], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    for (; count > 0; count--)
+    {
+        status = send_command(out, argc - 2, argv + 2);
+
+        if (status != 0 || (status = receive_reply(in)) < 0)
+        {
+            fprintf(stderr, "id321-client: no reply from the server\n");
+            break;
+        }
+    }
+
+    fclose(out);
+    fclose(in);
+
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
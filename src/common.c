@@ -1,12 +1,15 @@
 #include <errno.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h> /* strcasecmp() */
 #include <unistd.h>
 #include "common.h"
 #include "iconv_wrap.h"
 #include "output.h"
+#include "transcode.h"
 #include "u32_char.h"
 #include "xalloc.h"
 
@@ -34,7 +37,7 @@ int readordie(int fd, void *buf, size_t len)
         {
             if (errno == EINTR)
                 continue;
-            perror("read");
+            print_errno("read");
             return -errno;
         }
         else if (ret == 0)
@@ -81,19 +84,16 @@ int writeordie(int fd, const void *buf, size_t len)
     return 0;
 }
 
+/* the result is not cached, as the function may be called by several
+ * threads at once, and it is cheap anyway */
 const char *locale_encoding(void)
 {
-    static const char *enc = NULL;
+    const char *enc = getenv("LANG");
 
-    if (!enc)
-    {
-        enc = getenv("LANG");
-
-        if (enc && (enc = strchr(enc, '.')) != NULL)
-            enc++;
-        else
-            enc = ISO_8859_1_CODESET;
-    }
+    if (enc && (enc = strchr(enc, '.')) != NULL)
+        enc++;
+    else
+        enc = ISO_8859_1_CODESET;
 
     return enc;
 }
@@ -110,9 +110,139 @@ int str_to_long(const char *nptr, long *ret)
     return (*nptr != '\0' && *endptr == '\0') ? 0 : -1;
 }
 
+/***
+ * find_nonzero_byte
+ *
+ * Scans @size bytes of @buf 64 bytes at a time, OR-ing them together as
+ * 64-bit words, which compilers turn into vector instructions.
+ *
+ * Returns position of the first non-zero byte, or @size if all the bytes
+ * are zero.
+ */
+
+size_t find_nonzero_byte(const void *buf, size_t size)
+{
+    const unsigned char *ptr = buf;
+    size_t pos = 0;
+
+    while (size - pos >= 8 * sizeof(uint64_t))
+    {
+        uint64_t word[8];
+        uint64_t acc = 0;
+        size_t i;
+
+        memcpy(word, ptr + pos, sizeof(word));
+
+        for (i = 0; i < 8; i++)
+            acc |= word[i];
+
+        if (acc != 0)
+            break;
+
+        pos += sizeof(word);
+    }
+
+    while (pos < size && ptr[pos] == 0)
+        pos++;
+
+    return pos;
+}
+
+/*
+ * iconv descriptors are expensive to open, so the ones opened are kept in
+ * a cache keyed by the pair of encodings, and are reset to the initial
+ * state before each conversion. As descriptors keep the conversion state,
+ * each thread has its own cache, which it closes when it is done. The
+ * cache outlives any arena, so it is allocated from the heap directly.
+ */
+
+struct iconv_cache_entry
+{
+    char *tocode;
+    char *fromcode;
+    id321_iconv_t cd;
+};
+
+static __thread struct iconv_cache_entry *iconv_cache;
+static __thread size_t iconv_cache_size;
+
+static char *heap_strdup(const char *str)
+{
+    size_t size = strlen(str) + 1;
+    char *dup = heap_alloc(size);
+
+    if (!dup)
+        fatal("can't allocate %lu bytes of memory", (unsigned long)size);
+
+    return memcpy(dup, str, size);
+}
+
+/***
+ * open_iconv
+ *
+ * Returns a descriptor converting from @fromcode to @tocode in the initial
+ * conversion state, or (id321_iconv_t)-1 if the conversion is not
+ * supported. The descriptor belongs to the cache and must not be closed.
+ */
+
+id321_iconv_t open_iconv(const char *tocode, const char *fromcode)
+{
+    struct iconv_cache_entry *entry;
+    id321_iconv_t cd;
+    size_t i;
+
+    for (i = 0; i < iconv_cache_size; i++)
+    {
+        entry = &iconv_cache[i];
+
+        if (!strcmp(entry->tocode, tocode)
+            && !strcmp(entry->fromcode, fromcode))
+        {
+            id321_iconv(entry->cd, NULL, NULL, NULL, NULL);
+            return entry->cd;
+        }
+    }
+
+    cd = id321_iconv_open(tocode, fromcode);
+
+    if (cd == (id321_iconv_t)-1)
+        return cd;
+
+    entry = heap_realloc(iconv_cache,
+                         (iconv_cache_size + 1) * sizeof(*entry));
+
+    if (!entry)
+        fatal("can't allocate %lu bytes of memory",
+              (unsigned long)((iconv_cache_size + 1) * sizeof(*entry)));
+
+    iconv_cache = entry;
+    entry = &iconv_cache[iconv_cache_size++];
+    entry->tocode = heap_strdup(tocode);
+    entry->fromcode = heap_strdup(fromcode);
+    entry->cd = cd;
+
+    return cd;
+}
+
+void close_iconv_cache(void)
+{
+    size_t i;
+
+    for (i = 0; i < iconv_cache_size; i++)
+    {
+        id321_iconv_close(iconv_cache[i].cd);
+        heap_free(iconv_cache[i].tocode);
+        heap_free(iconv_cache[i].fromcode);
+    }
+
+    heap_free(iconv_cache);
+    iconv_cache = NULL;
+    iconv_cache_size = 0;
+}
+
 static id321_iconv_t xiconv_open(const char *tocode, const char *fromcode)
 {
-    id321_iconv_t cd = id321_iconv_open(tocode, fromcode);
+    id321_iconv_t cd = open_iconv(tocode, fromcode);
 
     if (cd == (id321_iconv_t)-1)
         fatal("unable to convert string from '%s' to '%s'", fromcode, tocode);
@@ -120,6 +250,88 @@ static id321_iconv_t xiconv_open(const char *tocode, const char *fromcode)
     return cd;
 }
 
+/*
+ * Conversions between the codesets of ID3 tags are done by the native
+ * transcoders, and the rest by the iconv descriptors from the cache.
+ */
+
+struct converter
+{
+    struct transcoder tc;
+    id321_iconv_t cd;
+    int is_native;
+};
+
+static void open_converter(struct converter *conv,
+                           const char *tocode, const char *fromcode)
+{
+    conv->is_native = (open_transcoder(&conv->tc, tocode, fromcode) == 0);
+
+    if (!conv->is_native)
+        conv->cd = xiconv_open(tocode, fromcode);
+}
+
+static size_t convert(struct converter *conv,
+                      const char **inbuf, size_t *inbytesleft,
+                      char **outbuf, size_t *outbytesleft)
+{
+    if (conv->is_native)
+        return transcode(&conv->tc, inbuf, inbytesleft, outbuf, outbytesleft);
+
+    return id321_iconv(conv->cd, (char **)inbuf, inbytesleft,
+                       outbuf, outbytesleft);
+}
+
+/***
+ * can_convert
+ *
+ * Returns non-zero if strings can be converted from @fromcode to @tocode.
+ */
+
+int can_convert(const char *tocode, const char *fromcode)
+{
+    struct transcoder tc;
+
+    return open_transcoder(&tc, tocode, fromcode) == 0
+           || open_iconv(tocode, fromcode) != (id321_iconv_t)-1;
+}
+
+/***
+ * resolve_byte_order
+ *
+ * iconv decoders of UTF-16 detect the byte order by BOM once, and keep it
+ * even after the descriptor is reset, which makes their descriptors unfit
+ * for reuse. So the BOM of UTF-16 and UCS-2 strings is consumed here, and
+ * the encoding with explicit byte order is returned instead of @fromcode.
+ * Strings without BOM are left to @fromcode, whose descriptor never sees
+ * BOM this way and so keeps the default byte order of iconv.
+ */
+
+static const char *resolve_byte_order(const char *fromcode,
+                                      const char **src, size_t *srcsize)
+{
+    const unsigned char *ptr = (const unsigned char *)*src;
+
+    if (strcasecmp(fromcode, "UTF-16") && strcasecmp(fromcode, "UTF16")
+        && strcasecmp(fromcode, "UCS-2") && strcasecmp(fromcode, "UCS2"))
+        return fromcode;
+
+    if (*srcsize >= 2 && ptr[0] == 0xFF && ptr[1] == 0xFE)
+    {
+        *src += 2;
+        *srcsize -= 2;
+        return "UTF-16LE";
+    }
+    else if (*srcsize >= 2 && ptr[0] == 0xFE && ptr[1] == 0xFF)
+    {
+        *src += 2;
+        *srcsize -= 2;
+        return "UTF-16BE";
+    }
+
+    return fromcode;
+}
+
 /***
  * iconvordie
  *
@@ -142,13 +354,13 @@ ssize_t iconvordie(const char *tocode, const char *fromcode,
                    const char *src, size_t srcsize,
                    char *dst, size_t dstsize)
 {
-    id321_iconv_t cd;
+    struct converter conv;
     size_t reqsize; /* required size of @dst */
     size_t ret;
     char dummy[BUFSIZ];
-    int is_from_u32 = (!strcmp(fromcode, U32_CHAR_CODESET)) ? 1 : 0;
 
-    cd = xiconv_open(tocode, fromcode);
+    fromcode = resolve_byte_order(fromcode, &src, &srcsize);
+    open_converter(&conv, tocode, fromcode);
 
     if (!dst && dstsize == 0)
     {
@@ -163,7 +375,7 @@ ssize_t iconvordie(const char *tocode, const char *fromcode,
     while (srcsize > 0)
     {
         errno = 0;
-        ret = id321_iconv(cd, (char **)&src, &srcsize, &dst, &dstsize);
+        ret = convert(&conv, &src, &srcsize, &dst, &dstsize);
 
         if (ret == (size_t)(-1))
         {
@@ -178,16 +390,10 @@ ssize_t iconvordie(const char *tocode, const char *fromcode,
                     if (chsize <= dstsize)
                     {
                         /* skip invalid character */
-                        if (is_from_u32 && srcsize >= sizeof(u32_char))
-                        {
-                            src += sizeof(u32_char);
-                            srcsize -= sizeof(u32_char);
-                        }
-                        else
-                        {
-                            src++;
-                            srcsize--;
-                        }
+                        size_t skip = get_char_size(fromcode, src, srcsize);
+
+                        src += skip;
+                        srcsize -= skip;
                         dst += chsize;
                         dstsize -= chsize;
 
@@ -210,50 +416,34 @@ ssize_t iconvordie(const char *tocode, const char *fromcode,
         }
     }
 
-    id321_iconv_close(cd);
-
     return reqsize - dstsize;
 }
 
-/***
- * iconv_alloc
- *
- * Converts the buffer of size @srcsize pointed to by @src from @fromcode
- * to @tocode and places result into an internally allocated memory area.
- * The pointer *@dst will be pointing to the result, and *@dstsize will
- * contain its size.
- *
- * If @tocode is U32_CHAR_CODESET, resulting u32 string will be null-terminated
- * even if @src is not.
- *
- * *@dst must be freed with free() after use.
- *
- * Returns the number of conversion errors.
- */
-
-int iconv_alloc(const char *tocode, const char *fromcode,
-                 const char *src, size_t srcsize,
-                 char **dst, size_t *dstsize)
+/* converts into a buffer of @outsize bytes at least, growing it as needed,
+ * and leaves @reserve bytes spare past the result */
+static int convert_alloc(const char *tocode, const char *fromcode,
+                         const char *src, size_t srcsize,
+                         size_t outsize, size_t reserve,
+                         char **dst, size_t *dstsize)
 {
-    id321_iconv_t cd;
+    struct converter conv;
     char *buf;
     char *out;
     size_t tmppos;
-    size_t outsize = srcsize;
     size_t outbytesleft;
     size_t ret;
-    int is_from_u32 = (!strcmp(fromcode, U32_CHAR_CODESET)) ? 1 : 0;
     int nr_errors = 0;
 
-    cd = xiconv_open(tocode, fromcode);
-    buf = xmalloc(outsize);
+    fromcode = resolve_byte_order(fromcode, &src, &srcsize);
+    open_converter(&conv, tocode, fromcode);
+    buf = xmalloc(outsize + reserve);
     out = buf;
     outbytesleft = outsize;
 
     while (srcsize > 0)
     {
         errno = 0;
-        ret = id321_iconv(cd, (char **)&src, &srcsize, &out, &outbytesleft);
+        ret = convert(&conv, &src, &srcsize, &out, &outbytesleft);
 
         if (ret == (size_t)(-1))
         {
@@ -269,16 +459,10 @@ int iconv_alloc(const char *tocode, const char *fromcode,
                     if (chsize <= outbytesleft)
                     {
                         /* skip invalid character */
-                        if (is_from_u32 && srcsize >= sizeof(u32_char))
-                        {
-                            src += sizeof(u32_char);
-                            srcsize -= sizeof(u32_char);
-                        }
-                        else
-                        {
-                            src++;
-                            srcsize--;
-                        }
+                        size_t skip = get_char_size(fromcode, src, srcsize);
+
+                        src += skip;
+                        srcsize -= skip;
                         out += chsize;
                         outbytesleft -= chsize;
 
@@ -289,8 +473,10 @@ int iconv_alloc(const char *tocode, const char *fromcode,
                 }
 
                 case E2BIG:
+                    if (outsize == 0)
+                        outsize = 1;
                     tmppos = out - buf;
-                    buf = xrealloc(buf, outsize*2);
+                    buf = xrealloc(buf, outsize*2 + reserve);
                     out = buf + tmppos;
                     outbytesleft += outsize;
                     outsize *= 2;
@@ -299,32 +485,85 @@ int iconv_alloc(const char *tocode, const char *fromcode,
         }
     }
 
-    id321_iconv_close(cd);
+    *dst = buf;
+    *dstsize = out - buf;
 
-    if (!strcmp(tocode, U32_CHAR_CODESET) &&
-        !(out - buf > (ptrdiff_t)sizeof(u32_char) &&
-          ((u32_char *)out)[-1] == U32_CHAR('\0')))
-    {
-        /* make sure that resulting U32 string will be null-terminated */
+    return nr_errors;
+}
 
-        if (outbytesleft < sizeof(u32_char))
-        {
-            tmppos = out - buf;
-            buf = realloc(buf, outsize + sizeof(u32_char) - outbytesleft);
-            out = buf + tmppos;
-        }
+/***
+ * iconv_alloc
+ *
+ * Converts the buffer of size @srcsize pointed to by @src from @fromcode
+ * to @tocode and places result into an internally allocated memory area.
+ * The pointer *@dst will be pointing to the result, and *@dstsize will
+ * contain its size.
+ *
+ * If @tocode is U32_CHAR_CODESET, resulting u32 string will be null-terminated
+ * even if @src is not.
+ *
+ * *@dst must be freed with xfree() after use.
+ *
+ * Returns the number of conversion errors.
+ */
 
-        *(u32_char *)out = U32_CHAR('\0');
-        out += sizeof(u32_char);
+int iconv_alloc(const char *tocode, const char *fromcode,
+                const char *src, size_t srcsize,
+                char **dst, size_t *dstsize)
+{
+    int is_to_u32 = !strcmp(tocode, U32_CHAR_CODESET);
+    char *buf;
+    size_t size;
+    int nr_errors;
+
+    nr_errors = convert_alloc(tocode, fromcode, src, srcsize, srcsize,
+                              is_to_u32 ? sizeof(u32_char) : 0, &buf, &size);
+
+    if (is_to_u32 &&
+        !(size > sizeof(u32_char) &&
+          ((u32_char *)(buf + size))[-1] == U32_CHAR('\0')))
+    {
+        /* make sure that resulting U32 string will be null-terminated */
+        *(u32_char *)(buf + size) = U32_CHAR('\0');
+        size += sizeof(u32_char);
     }
 
     *dst = buf;
     if (dstsize)
-        *dstsize = out - buf;
+        *dstsize = size;
 
     return nr_errors;
 }
 
+/***
+ * iconv_u32_alloc
+ *
+ * Converts the buffer of size @srcsize pointed to by @src from @fromcode
+ * to a null-terminated u32 string in an internally allocated memory area
+ * pointed to by *@ustr, in a single pass. The area is sized for the worst
+ * case up front (no character takes less than a byte in any encoding), so
+ * it never has to grow.
+ *
+ * *@ustr must be freed with xfree() after use.
+ *
+ * Returns the number of u32_chars converted, not counting the terminator
+ * appended.
+ */
+
+size_t iconv_u32_alloc(const char *fromcode, const char *src, size_t srcsize,
+                       u32_char **ustr)
+{
+    char *buf;
+    size_t size;
+
+    convert_alloc(U32_CHAR_CODESET, fromcode, src, srcsize,
+                  srcsize * sizeof(u32_char), sizeof(u32_char), &buf, &size);
+    *(u32_char *)(buf + size) = U32_CHAR('\0');
+    *ustr = (u32_char *)buf;
+
+    return size / sizeof(u32_char);
+}
+
 u32_char *locale_to_u32_alloc(const char *str)
 {
     u32_char *ustr = NULL;
@@ -355,7 +594,7 @@ int u32_snprintf_alloc(u32_char **ustr, const char *fmt, ...)
 
         if (ret == -1)
         {
-            free(udata);
+            xfree(udata);
             return -EFAULT;
         }
         else if ((size_t)ret == usize)
@@ -370,11 +609,32 @@ int u32_snprintf_alloc(u32_char **ustr, const char *fmt, ...)
     return ret;
 }
 
+/* where fatal() jumps to instead of exiting, if anywhere */
+static __thread jmp_buf *fatal_env;
+
+/***
+ * set_fatal_jump
+ *
+ * Makes fatal() in the calling thread jump to @env, with errno describing
+ * the error, instead of exiting, or restores exiting if @env is NULL.
+ * Whatever the interrupted call has allocated from an arena or opened is
+ * left as it is.
+ */
+
+void set_fatal_jump(jmp_buf *env)
+{
+    fatal_env = env;
+}
+
 void fatal(const char *fmt, ...)
 {
     va_list args;
+
+    if (fatal_env)
+        longjmp(*fatal_env, 1);
+
     va_start(args, fmt);
-    printf(fmt, args);
+    vprint(OS_ERROR, fmt, args);
     va_end(args);
     exit(EXIT_FAILURE);
 }
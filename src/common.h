@@ -1,6 +1,7 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <setjmp.h>     /* jmp_buf */
 #include <sys/types.h>  /* size_t, ssize_t */
 #include "iconv_wrap.h"
 #include "id3v1.h"
@@ -21,18 +22,26 @@
 
 #define SUCC_OR_FAULT(ret) (ret == 0 ? ret : -EFAULT)
 
+void set_fatal_jump(jmp_buf *env);
 void fatal(const char *fmt, ...);
 
-int get_tags(const char *filename, struct version ver,
+int get_tags(const struct id321_config *conf,
+             const char *filename, struct version ver, mode_t mode,
              struct id3v1_tag **tag1, struct id3v2_tag **tag2);
 
-int write_tags(const char *filename, const struct id3v1_tag *tag1,
+int write_tags(const struct id321_config *conf,
+               const char *filename, const struct id3v1_tag *tag1,
                const struct id3v2_tag *tag2);
 
 int readordie(int fd, void *buf, size_t len);
 int writeordie(int fd, const void *buf, size_t len);
 const char *locale_encoding(void);
 int str_to_long(const char *nptr, long *ret);
+size_t find_nonzero_byte(const void *buf, size_t size);
+
+id321_iconv_t open_iconv(const char *tocode, const char *fromcode);
+void close_iconv_cache(void);
+int can_convert(const char *tocode, const char *fromcode);
 
 ssize_t iconvordie(const char *tocode, const char *fromcode,
                    const char *src, size_t srcsize,
@@ -42,6 +51,9 @@ int iconv_alloc(const char *tocode, const char *fromcode,
                 const char *src, size_t srcsize,
                 char **dst, size_t *dstsize);
 
+size_t iconv_u32_alloc(const char *fromcode, const char *src, size_t srcsize,
+                       u32_char **ustr);
+
 u32_char *locale_to_u32_alloc(const char *str);
 int u32_snprintf_alloc(u32_char **ustr, const char *fmt, ...);
 
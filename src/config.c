@@ -0,0 +1,36 @@
+#include <string.h>
+#include "common.h"     /* ISO_8859_1_CODESET */
+#include "params.h"
+
+/* headroom reserved when a tag grows, unless --padding is specified */
+#define DEFAULT_PADDING     10 /* percents */
+#define DEFAULT_PADDING_MAX (64 * 1024)
+
+/***
+ * init_default_config
+ *
+ * Fills @conf with the settings files are processed with when nothing
+ * else is specified.
+ */
+
+void init_default_config(struct id321_config *conf)
+{
+    memset(conf, 0, sizeof(*conf));
+    conf->action = ID3_PRINT;
+    conf->ver.major = NOT_SET;
+    conf->ver.minor = NOT_SET;
+
+    conf->enc_v1 = conf->enc_iso8859_1 = ISO_8859_1_CODESET;
+    conf->enc_ucs2 = "UCS-2";
+    conf->enc_utf16 = "UTF-16";
+    conf->enc_utf16be = "UTF-16BE";
+    conf->enc_utf8 = "UTF-8";
+
+    conf->default_v2_enc = NULL;
+
+    conf->jobs = 1;
+
+    conf->padding = DEFAULT_PADDING;
+    conf->padding_max = DEFAULT_PADDING_MAX;
+    conf->options |= ID321_OPT_PADDING_PERCENT;
+}
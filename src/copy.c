@@ -5,8 +5,10 @@
 #include "params.h"
 #include "output.h"
 #include "common.h" /* get_tags(), write_tags() */
+#include "file.h"   /* O_TAGS_RDONLY */
+#include "xalloc.h" /* xfree() */
 
-int copy_tags(int argc, char **argv)
+int copy_tags(const struct id321_config *conf, int argc, char **argv)
 {
     struct id3v1_tag *tag1 = NULL;
     struct id3v2_tag *tag2 = NULL;
@@ -18,7 +20,7 @@ int copy_tags(int argc, char **argv)
         return -EFAULT;
     }
 
-    ret = get_tags(argv[0], g_config.ver, &tag1, &tag2);
+    ret = get_tags(conf, argv[0], conf->ver, O_TAGS_RDONLY, &tag1, &tag2);
 
     if (ret != 0)
         return -EFAULT;
@@ -29,9 +31,9 @@ int copy_tags(int argc, char **argv)
         return -EFAULT;
     }
 
-    ret = write_tags(argv[1], tag1, tag2);
+    ret = write_tags(conf, argv[1], tag1, tag2);
 
-    free(tag1);
+    xfree(tag1);
     free_id3v2_tag(tag2);
     return SUCC_OR_FAULT(ret);
 }
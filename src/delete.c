@@ -5,9 +5,9 @@
 #include "trim.h"
 #include "file.h"
 #include "output.h"
-#include "params.h" /* NOT_SET */
+#include "params.h" /* NOT_SET, struct id321_config */
 
-int delete_tags(const char *filename)
+int delete_tags(const struct id321_config *conf, const char *filename)
 {
     struct file *file;
     int ret;
@@ -18,9 +18,9 @@ int delete_tags(const char *filename)
         return -EFAULT;
 
     /* the order makes sense */
-    if (g_config.ver.major == 1 || g_config.ver.major == NOT_SET)
+    if (conf->ver.major == 1 || conf->ver.major == NOT_SET)
     {
-        ret = trim_id3v1_tag(file, g_config.ver.minor);
+        ret = trim_id3v1_tag(file, conf->ver.minor);
 
         if (ret < 0 && ret != -ENOENT)
         {
@@ -29,9 +29,9 @@ int delete_tags(const char *filename)
         }
     }
 
-    if (g_config.ver.major == 2 || g_config.ver.major == NOT_SET)
+    if (conf->ver.major == 2 || conf->ver.major == NOT_SET)
     {
-        ret = trim_id3v2_tag(file, g_config.ver.minor);
+        ret = trim_id3v2_tag(file, conf->ver.minor);
 
         if (ret < 0 && ret != -ENOENT)
         {
@@ -47,7 +47,15 @@ int delete_tags(const char *filename)
         print(OS_DEBUG, "%s: start: %d, end: %d, size: %d",
                         filename, file->crop.start, file->crop.end, file->size);
 
-        shift_file_payload(file, -file->crop.start);
+        /* the payload can only be moved by whole blocks if the tag takes
+         * whole blocks, otherwise it is copied */
+        if (move_file_blocks(file, -file->crop.start) != 0
+            && shift_file_payload(file, -file->crop.start) != 0)
+        {
+            print(OS_ERROR, "%s: unable to move payload", filename);
+            close_file(file);
+            return -EFAULT;
+        }
 
         if (file->crop.end < file->size)
             ftruncate(file->fd, file->crop.end);
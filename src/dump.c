@@ -9,6 +9,15 @@ void dump_id3_header(const struct id3v2_header *hdr)
 
 void dump_frame(const struct id3v2_frame *frame)
 {
+    if (!frame->data)
+    {
+        print(OS_DEBUG, "   frame %.*s: len=%u, not loaded, status=0x%.2X,"
+                        " format=0x%.2X",
+                        ID3V2_FRAME_ID_MAX_SIZE, frame->id, frame->size,
+                        frame->status_flags, frame->format_flags);
+        return;
+    }
+
     print(OS_DEBUG, "   frame %.*s: len=%u, first_byte=0x%.2X, status=0x%.2X,"
                     " format=0x%.2X",
                     ID3V2_FRAME_ID_MAX_SIZE, frame->id,
@@ -1,14 +1,49 @@
+#include <config.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>    /* rename() */
 #include <stdlib.h>
-#include <string.h>   /* strerror() */
+#include <string.h>   /* memcpy(), strerror() */
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#ifdef HAVE_LINUX_FS_H
+# include <linux/fs.h> /* FICLONERANGE */
+# undef BLOCK_SIZE     /* ours is in common.h */
+#endif
 #include "common.h"   /* BLOCK_SIZE */
 #include "output.h"
 #include "file.h"
 #include "xalloc.h"
 
+/* windows read in advance by advise_file(): typical ID3v2 tags fit the
+ * head one, and ID3v1 tags with their extensions fit the tail one */
+#define HEAD_WINDOW (16 * BLOCK_SIZE)
+#define TAIL_WINDOW BLOCK_SIZE
+
+/* bounds of the chunks the payload is copied in by shift_file_payload() */
+#define SHIFT_MIN_CHUNK (256 * BLOCK_SIZE)
+#define SHIFT_MAX_CHUNK (2048 * BLOCK_SIZE)
+
+/* where open_file() lists the files it opens, if anywhere */
+static __thread struct file **open_files;
+
+/***
+ * set_file_list
+ *
+ * Makes open_file() in the calling thread add the files it opens to @list,
+ * and close_file() remove them from it, or stops listing the files opened
+ * if @list is NULL. The files left in the list once fatal() has jumped out
+ * of a call are those the call has not closed.
+ */
+
+void set_file_list(struct file **list)
+{
+    open_files = list;
+}
+
 struct file *open_file(const char *filename, mode_t mode)
 {
     struct stat st;
@@ -20,89 +55,630 @@ struct file *open_file(const char *filename, mode_t mode)
     if (ret != 0)
     {
         print(OS_ERROR, "%s: %s", filename, strerror(errno));
-        free(file);
+        xfree(file);
         return NULL;
     }
     else if (!S_ISREG(st.st_mode))
     {
         print(OS_ERROR, "%s: not a regular file", filename);
-        free(file);
+        xfree(file);
         return NULL;
     }
 
     file->fd = open(filename, mode);
 
+#ifdef O_NOATIME
+    /* only the owner of the file is allowed to use O_NOATIME */
+    if (file->fd == -1 && errno == EPERM && (mode & O_NOATIME))
+        file->fd = open(filename, mode & ~O_NOATIME);
+#endif
+
     if (file->fd == -1)
     {
         print(OS_ERROR, "%s: %s", filename, strerror(errno));
-        free(file);
+        xfree(file);
         return NULL;
     }
 
     file->size = st.st_size;
+    file->id.dev = st.st_dev;
+    file->id.ino = st.st_ino;
+    /* some filesystems do not tell, and the size is divided by */
+    file->blksize = (st.st_blksize > 0) ? st.st_blksize : BLOCK_SIZE;
+    file->map = NULL;
+    file->name = filename;
+    file->tmpname = NULL;
 
     /* initialize crop params */
     file->crop.start = 0;
     file->crop.end = file->size;
 
+    file->list = open_files;
+    file->next = NULL;
+
+    if (file->list)
+    {
+        file->next = *file->list;
+        *file->list = file;
+    }
+
     return file;
 }
 
+/***
+ * map_file
+ *
+ * Maps the whole @file read-only, so that subsequent peek_file_chunk() and
+ * read_file_chunk() calls are served from memory without any syscalls.
+ * Only the pages actually touched (i.e. the head and the tail of the file
+ * where tags live) are read in, the audio payload in between is not.
+ *
+ * Returns 0 on success, or -errno if the file cannot be mapped, in which
+ * case the file is still usable through read_file_chunk().
+ */
+
+int map_file(struct file *file)
+{
+    void *map;
+
+    if (file->size == 0 || (off_t)(size_t)file->size != file->size)
+        return -EINVAL;
+
+    map = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, file->fd, 0);
+
+    if (map == MAP_FAILED)
+        return -errno;
+
+    file->map = map;
+
+    return 0;
+}
+
+/***
+ * advise_file
+ *
+ * Tells the kernel that only the head and the tail windows of @file (where
+ * tags live) are going to be read, so that neither the page cache is
+ * flooded with the audio payload by readahead, nor the tag reading is
+ * slowed down by page faults one by one. Call it after map_file(), if any.
+ */
+
+void advise_file(const struct file *file)
+{
+    off_t tail = file->size > TAIL_WINDOW ? file->size - TAIL_WINDOW : 0;
+
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise(file->fd, 0, 0, POSIX_FADV_RANDOM);
+    posix_fadvise(file->fd, 0, HEAD_WINDOW, POSIX_FADV_WILLNEED);
+    posix_fadvise(file->fd, tail, 0, POSIX_FADV_WILLNEED);
+#endif
+
+    if (file->map)
+    {
+        madvise(file->map, file->size, MADV_RANDOM);
+        madvise(file->map, file->size < HEAD_WINDOW ? file->size : HEAD_WINDOW,
+                MADV_WILLNEED);
+        madvise(file->map + (tail & ~(off_t)(BLOCK_SIZE - 1)),
+                file->size - (tail & ~(off_t)(BLOCK_SIZE - 1)), MADV_WILLNEED);
+    }
+}
+
+/***
+ * detach_file_map
+ *
+ * Passes the ownership of the @file mapping to the caller, who is then
+ * responsible for munmap()ing it (its size is @file->size). The mapping
+ * stays valid after close_file().
+ *
+ * Returns the mapping, or NULL if @file is not mapped.
+ */
+
+char *detach_file_map(struct file *file)
+{
+    char *map = file->map;
+
+    file->map = NULL;
+
+    return map;
+}
+
+/***
+ * peek_file_chunk
+ *
+ * Returns pointer to the chunk of @size bytes at @pos within the @file
+ * mapping, or NULL if @file is not mapped or the chunk is beyond its end.
+ */
+
+const char *peek_file_chunk(const struct file *file, off_t pos, size_t size)
+{
+    if (!file->map || pos < 0 || pos > file->size
+        || (off_t)size > file->size - pos)
+        return NULL;
+
+    return file->map + pos;
+}
+
+/***
+ * read_file_chunk
+ *
+ * Reads @size bytes at @pos from @file into @buf. If the file is mapped,
+ * the chunk is copied from the mapping, otherwise it is read with pread().
+ * The file offset is not changed.
+ *
+ * Returns 0 on success, -ENOENT if the chunk is beyond the end of file, or
+ *         -errno on any read error.
+ */
+
+/* reads @size bytes at @pos of @fd, returns 0 on success or -errno */
+static int read_chunk(int fd, void *buf, size_t size, off_t pos)
+{
+    char *ptr = buf;
+    ssize_t ret;
+
+    while (size > 0)
+    {
+        ret = pread(fd, ptr, size, pos);
+
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            print_errno("read");
+            return -errno;
+        }
+        else if (ret == 0)
+            return -ENOENT;
+
+        size -= ret;
+        ptr += ret;
+        pos += ret;
+    }
+
+    return 0;
+}
+
+/* writes @size bytes at @pos of @fd, returns 0 on success or -errno */
+static int write_chunk(int fd, const void *buf, size_t size, off_t pos)
+{
+    const char *ptr = buf;
+    ssize_t ret;
+
+    while (size > 0)
+    {
+        ret = pwrite(fd, ptr, size, pos);
+
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            print_errno("write");
+            return -errno;
+        }
+
+        size -= ret;
+        ptr += ret;
+        pos += ret;
+    }
+
+    return 0;
+}
+
+int read_file_chunk(const struct file *file, off_t pos, void *buf, size_t size)
+{
+    if (file->map)
+    {
+        const char *chunk = peek_file_chunk(file, pos, size);
+
+        if (!chunk)
+            return -ENOENT;
+
+        memcpy(buf, chunk, size);
+        return 0;
+    }
+
+    return read_chunk(file->fd, buf, size, pos);
+}
+
+/***
+ * commit_file
+ *
+ * Replaces @file with the sibling file it has been rewritten into by
+ * clone_file_payload(), if any. Until then the file itself is not changed,
+ * and if it is closed without being committed, the sibling is removed.
+ *
+ * Returns 0 on success, or -EFAULT if the file cannot be replaced.
+ */
+
+int commit_file(struct file *file)
+{
+    if (!file->tmpname)
+        return 0;
+
+    if (fsync(file->fd) != 0 || rename(file->tmpname, file->name) != 0)
+    {
+        print(OS_ERROR, "%s: %s", file->name, strerror(errno));
+        return -EFAULT;
+    }
+
+    xfree(file->tmpname);
+    file->tmpname = NULL;
+
+    return 0;
+}
+
 int close_file(struct file *file)
 {
     int ret;
 
+    if (file->list)
+    {
+        struct file **link = file->list;
+
+        while (*link != file)
+            link = &(*link)->next;
+
+        *link = file->next;
+    }
+
+    if (file->map)
+        munmap(file->map, file->size);
+
     ret = close(file->fd);
-    free(file);
+
+    if (file->tmpname)
+    {
+        unlink(file->tmpname);
+        xfree(file->tmpname);
+    }
+
+    xfree(file);
 
     return ret;
 }
 
+/***
+ * move_file_blocks
+ *
+ * Shifts the crop area of @file by @delta bytes by inserting a range of
+ * blocks in front of the block the crop area starts in (if @delta is
+ * positive), or by collapsing a range of blocks in front of it (if @delta
+ * is negative). Only block mappings are changed, no data is copied, but
+ * the bytes between the start of that block and the crop area are moved
+ * along with the crop area.
+ *
+ * @delta must be a multiple of the filesystem block size, and there must
+ * be enough room in front of the crop area to collapse.
+ *
+ * Returns 0 on success, or -errno if the filesystem does not support it,
+ * in which case @file is not changed and shift_file_payload() shall be
+ * used instead.
+ */
+
+int move_file_blocks(struct file *file, off_t delta)
+{
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_INSERT_RANGE) \
+    && defined(FALLOC_FL_COLLAPSE_RANGE)
+    off_t from = file->crop.start - file->crop.start % file->blksize;
+    int ret;
+
+    if (delta == 0 || delta % file->blksize != 0 || from + delta < 0)
+        return -EINVAL;
+
+    if (delta > 0)
+        ret = fallocate(file->fd, FALLOC_FL_INSERT_RANGE, from, delta);
+    else
+        ret = fallocate(file->fd, FALLOC_FL_COLLAPSE_RANGE,
+                        from + delta, -delta);
+
+    if (ret != 0)
+    {
+        print(OS_DEBUG, "unable to move file blocks: %s", strerror(errno));
+        return -errno;
+    }
+
+    file->crop.start += delta;
+    file->crop.end += delta;
+    file->size += delta;
+
+    return 0;
+#else
+    return -ENOSYS;
+#endif
+}
+
+struct shift_write
+{
+    int fd;
+    const char *buf;
+    size_t size;
+    off_t pos;
+    int ret;
+    FILE *out;  /* output streams of the thread the file is processed by */
+    FILE *err;
+};
+
+static void *write_shift_chunk(void *arg)
+{
+    struct shift_write *w = arg;
+
+    set_output_streams(w->out, w->err);
+    w->ret = write_chunk(w->fd, w->buf, w->size, w->pos);
+
+    return NULL;
+}
+
+/* returns the position of the chunk of @size bytes which is @done bytes
+ * away from the edge of the crop area of @file the shift by @delta starts
+ * from: the payload is copied from its end if it moves towards the end of
+ * the file, and from its start otherwise, so that no chunk is overwritten
+ * before it is read */
+static off_t get_shift_chunk_pos(const struct file *file, off_t delta,
+                                 off_t done, size_t size)
+{
+    return (delta < 0) ? file->crop.start + done
+                       : file->crop.end - done - (off_t)size;
+}
+
+/***
+ * shift_file_payload
+ *
+ * Moves the crop area of @file by @delta bytes by copying it. The payload
+ * is copied in chunks of SHIFT_MIN_CHUNK to SHIFT_MAX_CHUNK bytes through
+ * two buffers: while one chunk is written by a helper thread, the next one
+ * is read into the other buffer. As the chunks are taken in the direction
+ * opposite to @delta, the chunk being read never overlaps the chunks
+ * written so far.
+ *
+ * Returns 0 on success, or -EFAULT on read or write error, in which case
+ * the payload is partially moved.
+ */
+
 int shift_file_payload(struct file *file, off_t delta)
 {
-    size_t  blksize = BLOCK_SIZE;
-    size_t  zero = 0;
-    char    buf[BLOCK_SIZE];
-    size_t  size;
-    off_t   pos;
-    int     direction;
-    size_t *corr;
+    off_t   size = file->crop.end - file->crop.start;
+    off_t   done;
+    size_t  chunk = size / 8;
+    size_t  len;
+    char   *buf;
+    int     cur = 0;
+    int     ret = 0;
 
     if (!delta)
         /* nothing to do */
         return 0;
 
-    if (delta < 0)
+    if (chunk < SHIFT_MIN_CHUNK)
+        chunk = SHIFT_MIN_CHUNK;
+    else if (chunk > SHIFT_MAX_CHUNK)
+        chunk = SHIFT_MAX_CHUNK;
+
+    if ((off_t)chunk > size)
+        chunk = size;
+
+    buf = (chunk > 0) ? xmalloc(2 * chunk) : NULL;
+
+    len = chunk;
+    if (len > 0)
+        ret = read_chunk(file->fd, buf, len,
+                         get_shift_chunk_pos(file, delta, 0, len));
+
+    for (done = 0; ret == 0 && len > 0; cur = !cur)
     {
-        pos = file->crop.start;
-        direction = 1;
-        corr = &zero;
+        struct shift_write w;
+        pthread_t thread;
+        int threaded;
+        size_t next_len = (size - done - (off_t)len > (off_t)chunk)
+                          ? chunk : (size_t)(size - done - len);
+
+        w.fd = file->fd;
+        w.buf = buf + cur * chunk;
+        w.size = len;
+        w.pos = get_shift_chunk_pos(file, delta, done, len) + delta;
+        w.out = get_out_stream();
+        w.err = get_err_stream();
+
+        /* the chunk is written in place if no thread can be started */
+        threaded = (next_len > 0
+                    && pthread_create(&thread, NULL, write_shift_chunk, &w) == 0);
+
+        if (!threaded)
+            write_shift_chunk(&w);
+
+        if (next_len > 0)
+            ret = read_chunk(file->fd, buf + !cur * chunk, next_len,
+                             get_shift_chunk_pos(file, delta,
+                                                 done + len, next_len));
+
+        if (threaded)
+            pthread_join(thread, NULL);
+
+        if (w.ret != 0)
+            ret = w.ret;
+
+        done += len;
+        len = next_len;
     }
-    else
+
+    xfree(buf);
+
+    if (ret != 0)
+        return -EFAULT;
+
+    file->crop.start += delta;
+    file->crop.end += delta;
+
+    if (file->crop.end > file->size)
+        file->size = file->crop.end;
+
+    return 0;
+}
+
+/* clones the crop area of @file and what follows it to @pos of @fd, returns
+ * 0 on success or -errno if the blocks cannot be shared */
+static int clone_range(const struct file *file, int fd, off_t pos)
+{
+#ifdef FICLONERANGE
+    off_t from = file->crop.start - file->crop.start % file->blksize;
+    off_t to = from + pos - file->crop.start;
+    struct file_clone_range range;
+
+    if ((pos - file->crop.start) % file->blksize != 0 || to < 0)
+        return -EINVAL;
+
+    /* only whole blocks can be cloned, so the tail of the old tag is
+     * cloned too, it is to be overwritten by the new one */
+    range.src_fd = file->fd;
+    range.src_offset = from;
+    range.src_length = 0; /* up to the end of the file */
+    range.dest_offset = to;
+
+    if (ioctl(fd, FICLONERANGE, &range) != 0)
+        return -errno;
+
+    return 0;
+#else
+    return -ENOSYS;
+#endif
+}
+
+/* copies the crop area of @file and what follows it to @pos of @fd, returns
+ * 0 on success or -EFAULT on read or write error */
+static int copy_range(const struct file *file, int fd, off_t pos)
+{
+    off_t  src_pos = file->crop.start;
+    size_t size = file->size - file->crop.start;
+    char  *buf;
+    int    ret = 0;
+
+#ifdef HAVE_COPY_FILE_RANGE
+    /* the kernel copies the data itself, and may share it if it can */
+    while (size > 0)
     {
-        pos = file->crop.end;
-        direction = -1;
-        corr = &blksize;
+        ssize_t len = copy_file_range(file->fd, &src_pos, fd, &pos,
+                                      size, 0);
+
+        if (len == -1 && errno == EINTR)
+            continue;
+        else if (len <= 0)
+            break;
+
+        size -= len;
     }
 
-    for (size = file->crop.end - file->crop.start;
-         size != 0;
-         size -= blksize, pos += direction*blksize)
+    if (size == 0)
+        return 0;
+#endif
+
+    buf = xmalloc(SHIFT_MAX_CHUNK);
+
+    while (ret == 0 && size > 0)
     {
-        if (size < blksize)
-            blksize = size;
+        size_t len = (size > SHIFT_MAX_CHUNK) ? SHIFT_MAX_CHUNK : size;
+
+        ret = read_chunk(file->fd, buf, len, src_pos);
 
-        lseek(file->fd, pos - *corr, SEEK_SET);
-        read(file->fd, buf, blksize);
-        lseek(file->fd, pos - *corr + delta, SEEK_SET);
-        write(file->fd, buf, blksize);
+        if (ret == 0)
+            ret = write_chunk(fd, buf, len, pos);
+
+        src_pos += len;
+        pos += len;
+        size -= len;
+    }
+
+    xfree(buf);
+
+    return SUCC_OR_FAULT(ret);
+}
+
+/***
+ * clone_file_payload
+ *
+ * Moves the crop area of @file by @delta bytes by rewriting the file into
+ * a sibling file, which replaces the file when it is committed with
+ * commit_file(). The payload is cloned into the sibling on filesystems
+ * which can share blocks between files (and @delta is a multiple of the
+ * block size), so only the tag is actually written. If @force is set, the
+ * payload is copied if it cannot be cloned. From then on @file refers to
+ * the sibling, and its start up to the new crop area is to be written.
+ *
+ * Files which are symbolic links or have other hard links are not
+ * rewritten, as they would not be replaced as a whole.
+ *
+ * Returns 0 on success, -EOPNOTSUPP if the file is not to be rewritten,
+ * in which case it is not changed, or -EFAULT on error.
+ */
+
+int clone_file_payload(struct file *file, off_t delta, int force)
+{
+    struct stat st;
+    size_t len = strlen(file->name);
+    char *tmpname;
+    int fd;
+    int ret;
+
+    if (lstat(file->name, &st) != 0 || !S_ISREG(st.st_mode)
+        || st.st_nlink > 1)
+    {
+        if (force)
+            print(OS_WARN, "%s: not a single link to a regular file, "
+                           "rewriting it in place", file->name);
+        return -EOPNOTSUPP;
+    }
+
+    if (!force && delta % file->blksize != 0)
+        return -EOPNOTSUPP;
+
+    tmpname = xmalloc(len + sizeof(".XXXXXX"));
+    memcpy(tmpname, file->name, len);
+    memcpy(tmpname + len, ".XXXXXX", sizeof(".XXXXXX"));
+
+    fd = mkstemp(tmpname);
+
+    if (fd == -1)
+    {
+        print(force ? OS_ERROR : OS_DEBUG, "%s: %s", tmpname, strerror(errno));
+        xfree(tmpname);
+        return force ? -EFAULT : -EOPNOTSUPP;
+    }
+
+    /* the sibling is to take the place of the file, so it looks alike */
+    if (fchown(fd, st.st_uid, st.st_gid) != 0)
+        print(OS_DEBUG, "%s: unable to keep owner: %s",
+                        file->name, strerror(errno));
+    fchmod(fd, st.st_mode & 07777);
+
+    ret = clone_range(file, fd, file->crop.start + delta);
+
+    if (ret != 0)
+    {
+        print(OS_DEBUG, "%s: unable to clone payload: %s",
+                        file->name, strerror(-ret));
+
+        ret = force ? copy_range(file, fd, file->crop.start + delta)
+                    : -EOPNOTSUPP;
+    }
+
+    if (ret != 0)
+    {
+        close(fd);
+        unlink(tmpname);
+        xfree(tmpname);
+        return ret;
+    }
+
+    close(file->fd);
+    file->fd = fd;
+    file->tmpname = tmpname;
+
+    if (fstat(fd, &st) == 0)
+    {
+        file->id.dev = st.st_dev;
+        file->id.ino = st.st_ino;
     }
 
     file->crop.start += delta;
     file->crop.end += delta;
-
-    if (file->crop.end > file->size)
-        file->size = file->crop.end;
+    file->size += delta;
 
     return 0;
 }
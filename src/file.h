@@ -1,23 +1,57 @@
 #ifndef FILE_H
 #define FILE_H
 
+#include <fcntl.h>
 #include <sys/types.h>
 
+/* open_file() mode for files which tags are only read from, O_NOATIME is
+ * silently dropped for files not owned by the caller */
+#ifdef O_NOATIME
+# define O_TAGS_RDONLY (O_RDONLY | O_NOATIME)
+#else
+# define O_TAGS_RDONLY O_RDONLY
+#endif
+
 struct crop_area
 {
     off_t start;
     off_t end;
 };
 
+/* identity of a file, which does not depend on the path it is opened by */
+struct file_id
+{
+    dev_t dev;
+    ino_t ino;
+};
+
+#define is_same_file(a, b) ((a).dev == (b).dev && (a).ino == (b).ino)
+
 struct file
 {
     int fd;
+    struct file_id id;
     struct crop_area crop;
     off_t size;
+    off_t blksize;  /* filesystem block size, never 0 */
+    char *map;      /* read-only mapping of the whole file, if any */
+    const char *name;   /* the name the file has been opened by */
+    char *tmpname;  /* sibling file to replace the file, if any */
+    struct file **list; /* list the file is in (see set_file_list()) */
+    struct file *next;
 };
 
+void set_file_list(struct file **list);
 struct file *open_file(const char *filename, mode_t mode);
+int map_file(struct file *file);
+void advise_file(const struct file *file);
+char *detach_file_map(struct file *file);
+const char *peek_file_chunk(const struct file *file, off_t pos, size_t size);
+int read_file_chunk(const struct file *file, off_t pos, void *buf, size_t size);
+int commit_file(struct file *file);
 int close_file(struct file *file);
+int move_file_blocks(struct file *file, off_t delta);
 int shift_file_payload(struct file *file, off_t delta);
+int clone_file_payload(struct file *file, off_t delta, int force);
 
 #endif /* FILE_H */
@@ -1,57 +1,342 @@
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #define _FRAME_LIST
+#include "file.h"
+#include "framelist.h"
 #include "id3v2.h"
+#include "xalloc.h"
 
-void init_frame_list(struct id3v2_frame *head)
+/*
+ * Frames of a tag are kept in a contiguous array in the tag order, so that
+ * walking them is a linear scan. Note that any insertion may move the
+ * array, and any removal shifts the frames which follow the removed one,
+ * so pointers to frames of a tag are only valid until the tag is changed
+ * (except for pointers to the frames preceding a removed one).
+ *
+ * Besides the array, each tag has an index of its frames sorted by frame
+ * id packed into uint32_t, and then by their position in the tag, so that
+ * all instances of a multi-instance frame (e.g. COMM or TXXX) are adjacent
+ * and kept in the tag order. Any change of the tag just marks the index
+ * stale, and it is rebuilt by the next lookup. As frames are looked up far
+ * more often than the tag is changed, lookups are O(log n) in practice.
+ */
+
+#define FRAME_ARRAY_MIN_SIZE 16
+
+struct frame_index_entry
+{
+    uint32_t id;
+    uint32_t pos;
+};
+
+/***
+ * pack_frame_id - pack frame id into uint32_t
+ *
+ * Packs at most ID3V2_FRAME_ID_MAX_SIZE characters of @id up to the first
+ * null character, so that ids which strncmp() would consider equal get
+ * equal keys.
+ */
+
+static uint32_t pack_frame_id(const char *id)
 {
-    head->next = head;
-    head->prev = head;
+    uint32_t key = 0;
+
+    memcpy(&key, id, strnlen(id, ID3V2_FRAME_ID_MAX_SIZE));
+
+    return key;
 }
 
-void append_frame(struct id3v2_frame *head, struct id3v2_frame *frame)
+static int compare_index_entries(const void *a, const void *b)
 {
-    frame->prev = head->prev;
-    head->prev->next = frame;
-    frame->next = head;
-    head->prev = frame;
+    const struct frame_index_entry *x = a;
+    const struct frame_index_entry *y = b;
+
+    if (x->id != y->id)
+        return x->id < y->id ? -1 : 1;
+
+    return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+static void index_frames(struct id3v2_tag *tag)
+{
+    size_t i;
+
+    if (tag->frame_count > tag->index_size)
+        tag->index = xrealloc(tag->index,
+                              tag->frame_count * sizeof(*tag->index));
+
+    tag->index_size = tag->frame_count;
+
+    for (i = 0; i < tag->frame_count; i++)
+    {
+        tag->index[i].id = pack_frame_id(tag->frames[i].id);
+        tag->index[i].pos = i;
+    }
+
+    if (tag->frame_count > 1)
+        qsort(tag->index, tag->frame_count, sizeof(*tag->index),
+              compare_index_entries);
+
+    tag->index_stale = 0;
+}
+
+void init_frame_list(struct id3v2_tag *tag)
+{
+    tag->frames = NULL;
+    tag->frame_count = 0;
+    tag->frame_alloc = 0;
+    tag->index = NULL;
+    tag->index_size = 0;
+    tag->index_stale = 1;
+}
+
+/***
+ * insert_frame_before - insert a frame into the tag
+ *
+ * Copies the frame descriptor @frame into @tag in front of @before, which
+ * may be NULL to append the frame to the end of the tag. The tag takes
+ * ownership of the frame payload, the descriptor itself is left to the
+ * caller.
+ *
+ * Returns pointer to the frame within the tag.
+ */
+
+struct id3v2_frame *insert_frame_before(struct id3v2_tag *tag,
+                                        struct id3v2_frame *before,
+                                        const struct id3v2_frame *frame)
+{
+    size_t pos = before ? (size_t)(before - tag->frames) : tag->frame_count;
+
+    if (tag->frame_count == tag->frame_alloc)
+    {
+        tag->frame_alloc = tag->frame_alloc
+                           ? tag->frame_alloc * 2 : FRAME_ARRAY_MIN_SIZE;
+        tag->frames = xrealloc(tag->frames,
+                               tag->frame_alloc * sizeof(*tag->frames));
+    }
+
+    memmove(tag->frames + pos + 1, tag->frames + pos,
+            (tag->frame_count - pos) * sizeof(*tag->frames));
+    memcpy(tag->frames + pos, frame, sizeof(*frame));
+    tag->frame_count++;
+    tag->index_stale = 1;
+
+    return tag->frames + pos;
+}
+
+/***
+ * replace_frame - replace a frame of the tag
+ *
+ * Frees the payload of @old, which belongs to @tag, and copies the frame
+ * descriptor @frame in its place. The tag takes ownership of the frame
+ * payload, the descriptor itself is left to the caller.
+ */
+
+void replace_frame(struct id3v2_tag *tag, struct id3v2_frame *old,
+                   const struct id3v2_frame *frame)
+{
+    if (!old->borrowed)
+        xfree(old->data);
+
+    memcpy(old, frame, sizeof(*frame));
+    tag->index_stale = 1;
+}
+
+/***
+ * delete_frame - remove a frame from the tag and free its payload
+ */
+
+void delete_frame(struct id3v2_tag *tag, struct id3v2_frame *frame)
+{
+    size_t pos = frame - tag->frames;
+
+    if (!frame->borrowed)
+        xfree(frame->data);
+
+    memmove(tag->frames + pos, tag->frames + pos + 1,
+            (tag->frame_count - pos - 1) * sizeof(*tag->frames));
+    tag->frame_count--;
+    tag->index_stale = 1;
 }
 
-void unlink_frame(struct id3v2_frame *frame)
+/***
+ * prev_frame
+ *
+ * Returns the frame preceding @frame in @tag, or NULL if @frame is the
+ * first one.
+ */
+
+struct id3v2_frame *prev_frame(const struct id3v2_tag *tag,
+                               const struct id3v2_frame *frame)
 {
-    frame->prev->next = frame->next;
-    frame->next->prev = frame->prev;
-    frame->next = frame->prev = NULL;
+    return (frame == tag->frames) ? NULL : (struct id3v2_frame *)frame - 1;
 }
 
-struct id3v2_frame *peek_next_frame(const struct id3v2_frame *head,
+/***
+ * peek_next_frame
+ *
+ * Looks up the index of @tag for the first frame with id @name which
+ * follows @pos in the tag, or for the very first one if @pos is NULL.
+ * Indexing does not change the tag logically, so it is allowed for const
+ * tags.
+ *
+ * Returns the frame found, or NULL.
+ */
+
+struct id3v2_frame *peek_next_frame(const struct id3v2_tag *tag,
                                     const char *name,
                                     const struct id3v2_frame *pos)
 {
-    struct id3v2_frame *frame;
+    struct frame_index_entry key;
+    size_t lo = 0;
+    size_t hi;
+
+    if (tag->index_stale)
+        index_frames((struct id3v2_tag *)tag);
 
-    for (frame = pos->next; frame != head; frame = frame->next)
-        if (!strncmp(frame->id, name, ID3V2_FRAME_ID_MAX_SIZE))
-            return frame;
+    key.id = pack_frame_id(name);
+    key.pos = pos ? (uint32_t)(pos - tag->frames) + 1 : 0;
+
+    /* find the first entry which is not less than the key */
+    for (hi = tag->frame_count; lo < hi;)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (compare_index_entries(&tag->index[mid], &key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < tag->frame_count && tag->index[lo].id == key.id)
+        return tag->frames + tag->index[lo].pos;
 
     return NULL;
 }
 
-void free_frame(struct id3v2_frame *frame)
+/***
+ * attach_frame_data - replace frame payload with a heap buffer
+ *
+ * The frame takes ownership of @data, which must have been allocated with
+ * xmalloc() and will be freed along with the frame.
+ */
+
+void attach_frame_data(struct id3v2_frame *frame, char *data, uint32_t size)
 {
-    free(frame->data);
-    free(frame);
+    if (!frame->borrowed)
+        xfree(frame->data);
+
+    frame->data = data;
+    frame->size = size;
+    frame->borrowed = 0;
+}
+
+/***
+ * borrow_frame_data - make frame payload a view into foreign memory
+ *
+ * The memory pointed to by @data is not freed along with the frame, so it
+ * must outlive the frame (e.g. be the raw buffer of the tag the frame
+ * belongs to).
+ */
+
+void borrow_frame_data(struct id3v2_frame *frame, char *data, uint32_t size)
+{
+    if (!frame->borrowed)
+        xfree(frame->data);
+
+    frame->data = data;
+    frame->size = size;
+    frame->borrowed = 1;
 }
 
-void free_frame_list(struct id3v2_frame *head)
+/***
+ * defer_frame_data - make frame payload to be loaded on demand
+ *
+ * The payload of @size bytes is left in the source file of the tag at
+ * @offset and is only read by load_frame_data() or read_frame_data().
+ */
+
+void defer_frame_data(struct id3v2_frame *frame, off_t offset, uint32_t size)
 {
-    struct id3v2_frame *next = head->next;
-    struct id3v2_frame *tmp;
+    if (!frame->borrowed)
+        xfree(frame->data);
+
+    frame->data = NULL;
+    frame->size = size;
+    frame->borrowed = 0;
+    frame->offset = offset;
+}
+
+/***
+ * load_frame_data - materialise the frame payload
+ *
+ * Reads the payload of @frame from the source file of @tag unless it has
+ * already been loaded. Loading does not change the frame logically, so it
+ * is allowed for const frames.
+ *
+ * Returns 0 on success, or -EFAULT if the payload cannot be read.
+ */
 
-    while (next != head)
+int load_frame_data(const struct id3v2_tag *tag,
+                    const struct id3v2_frame *frame)
+{
+    struct id3v2_frame *fr = (struct id3v2_frame *)frame;
+    char *data;
+
+    if (is_frame_loaded(frame))
+        return 0;
+
+    data = xmalloc(frame->size);
+
+    if (read_frame_data(tag, frame, data) != 0)
+    {
+        xfree(data);
+        return -EFAULT;
+    }
+
+    fr->data = data;
+    fr->borrowed = 0;
+
+    return 0;
+}
+
+/***
+ * read_frame_data - copy the frame payload to @buf
+ *
+ * Copies the payload of @frame to the buffer @buf which must be large
+ * enough. The payload of a frame which has not been loaded is read
+ * straight from the source file of @tag into @buf, the frame itself is
+ * left not loaded.
+ *
+ * Returns 0 on success, or -EFAULT if the payload cannot be read.
+ */
+
+int read_frame_data(const struct id3v2_tag *tag,
+                    const struct id3v2_frame *frame, char *buf)
+{
+    if (is_frame_loaded(frame))
     {
-        tmp = next;
-        next = next->next;
-        free_frame(tmp);
+        memcpy(buf, frame->data, frame->size);
+        return 0;
     }
+
+    if (!tag->src ||
+        read_file_chunk(tag->src, frame->offset, buf, frame->size) != 0)
+        return -EFAULT;
+
+    return 0;
+}
+
+void free_frame_list(struct id3v2_tag *tag)
+{
+    struct id3v2_frame *frame;
+
+    for_each_frame(tag, frame)
+        if (!frame->borrowed)
+            xfree(frame->data);
+
+    xfree(tag->frames);
+    xfree(tag->index);
+    init_frame_list(tag);
 }
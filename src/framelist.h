@@ -3,18 +3,38 @@
 
 #include "id3v2.h"
 
-void init_frame_list(struct id3v2_frame *head);
-void append_frame(struct id3v2_frame *head, struct id3v2_frame *frame);
-#define insert_frame_before(before, frame) append_frame(before, frame)
-void unlink_frame(struct id3v2_frame *frame);
+void init_frame_list(struct id3v2_tag *tag);
+struct id3v2_frame *insert_frame_before(struct id3v2_tag *tag,
+                                        struct id3v2_frame *before,
+                                        const struct id3v2_frame *frame);
+#define append_frame(tag, frame) insert_frame_before(tag, NULL, frame)
+void replace_frame(struct id3v2_tag *tag, struct id3v2_frame *old,
+                   const struct id3v2_frame *frame);
+void delete_frame(struct id3v2_tag *tag, struct id3v2_frame *frame);
 
-struct id3v2_frame *peek_next_frame(const struct id3v2_frame *head,
+#define for_each_frame(tag, frame) \
+    for ((frame) = (tag)->frames; \
+         (frame) < (tag)->frames + (tag)->frame_count; \
+         (frame)++)
+
+struct id3v2_frame *prev_frame(const struct id3v2_tag *tag,
+                               const struct id3v2_frame *frame);
+struct id3v2_frame *peek_next_frame(const struct id3v2_tag *tag,
                                     const char *name,
                                     const struct id3v2_frame *pos);
 
-#define peek_frame(head, name) peek_next_frame(head, name, head)
+#define peek_frame(tag, name) peek_next_frame(tag, name, NULL)
+
+void attach_frame_data(struct id3v2_frame *frame, char *data, uint32_t size);
+void borrow_frame_data(struct id3v2_frame *frame, char *data, uint32_t size);
+void defer_frame_data(struct id3v2_frame *frame, off_t offset, uint32_t size);
+
+#define is_frame_loaded(frame) ((frame)->data || (frame)->size == 0)
+int load_frame_data(const struct id3v2_tag *tag,
+                    const struct id3v2_frame *frame);
+int read_frame_data(const struct id3v2_tag *tag,
+                    const struct id3v2_frame *frame, char *buf);
 
-void free_frame(struct id3v2_frame *frame);
-void free_frame_list(struct id3v2_frame *head);
+void free_frame_list(struct id3v2_tag *tag);
 
 #endif /* FRAMELIST_H */
@@ -5,109 +5,126 @@
 #include "common.h"
 #include "compat.h"
 #include "framelist.h"
+#include "frames.h"
 #include "frm_comm.h"
 #include "id3v2.h"
 #include "output.h"
 #include "params.h"
 #include "textframe.h"  /* get_id3v2_tag_encoding_name() */
+#include "transcode.h"  /* measure_text() */
 #include "u32_char.h"
+#include "xalloc.h"
 
-static int get_comm_frame(unsigned minor, const struct id3v2_frame *frame,
-                          u32_char *ubuf, size_t usize)
+static int get_comm_frame(const struct id321_config *conf,
+                          unsigned minor, const struct id3v2_frame *frame,
+                          u32_char **ustr)
 {
-    size_t ureqsize;
+    size_t usize;
     struct id3v2_frm_comm *comm;
+    u32_char ulang[ID3V2_LANG_HDR_SIZE] = { };
+    u32_char uspace[] = { U32_CHAR(' '), U32_CHAR('\0') };
     int ret;
 
-    ret = unpack_id3v2_frm_comm(frame, minor, &comm);
+    ret = unpack_id3v2_frm_comm(conf, frame, minor, &comm);
 
     if (ret != 0)
         return ret;
 
     /* Reserve six extra u32_chars for " []: " and nul-terminator. */
-    ureqsize = (comm->udesc ? u32_strlen(comm->udesc) : 0)
-               + (comm->utext ? u32_strlen(comm->utext) : 0)
-               + ID3V2_LANG_HDR_SIZE + 6;
+    usize = (comm->udesc ? u32_strlen(comm->udesc) : 0)
+            + (comm->utext ? u32_strlen(comm->utext) : 0)
+            + ID3V2_LANG_HDR_SIZE + 6;
 
-    if (ureqsize <= usize)
-    {
-        u32_char ulang[ID3V2_LANG_HDR_SIZE] = { };
-        u32_char uspace[] = { U32_CHAR(' '), U32_CHAR('\0') };
-
-        iconvordie(U32_CHAR_CODESET, ISO_8859_1_CODESET,
-                   comm->lang, ID3V2_LANG_HDR_SIZE,
-                   (char *)ulang, sizeof(ulang));
-
-        u32_snprintf(ubuf, usize, "%ls%ls[%.*ls]: %ls",
-                     comm->udesc ? comm->udesc : U32_EMPTY_STR,
-                     comm->udesc && comm->udesc[0] ? uspace : U32_EMPTY_STR,
-                     ID3V2_LANG_HDR_SIZE, ulang,
-                     comm->utext ? comm->utext : U32_EMPTY_STR);
-    }
+    iconvordie(U32_CHAR_CODESET, ISO_8859_1_CODESET,
+               comm->lang, ID3V2_LANG_HDR_SIZE,
+               (char *)ulang, sizeof(ulang));
+
+    *ustr = xmalloc(usize * sizeof(u32_char));
+    ret = u32_snprintf(*ustr, usize, "%ls%ls[%.*ls]: %ls",
+                       comm->udesc ? comm->udesc : U32_EMPTY_STR,
+                       comm->udesc && comm->udesc[0] ? uspace : U32_EMPTY_STR,
+                       ID3V2_LANG_HDR_SIZE, ulang,
+                       comm->utext ? comm->utext : U32_EMPTY_STR);
 
     free_id3v2_frm_comm(comm);
-    return ureqsize;
+    return ret;
 }
 
-static int get_v22_comm_frame(const struct id3v2_frame *frame,
-                              u32_char *ubuf, size_t usize)
+static int get_v22_comm_frame(const struct id321_config *conf,
+                              const struct id3v2_frame *frame,
+                              u32_char **ustr)
 {
-    return get_comm_frame(2, frame, ubuf, usize);
+    return get_comm_frame(conf, 2, frame, ustr);
 }
 
-static int get_v23_comm_frame(const struct id3v2_frame *frame,
-                              u32_char *ubuf, size_t usize)
+static int get_v23_comm_frame(const struct id321_config *conf,
+                              const struct id3v2_frame *frame,
+                              u32_char **ustr)
 {
-    return get_comm_frame(3, frame, ubuf, usize);
+    return get_comm_frame(conf, 3, frame, ustr);
 }
 
-static int get_v24_comm_frame(const struct id3v2_frame *frame,
-                              u32_char *ubuf, size_t usize)
+static int get_v24_comm_frame(const struct id321_config *conf,
+                              const struct id3v2_frame *frame,
+                              u32_char **ustr)
 {
-    return get_comm_frame(4, frame, ubuf, usize);
+    return get_comm_frame(conf, 4, frame, ustr);
 }
 
-static int get_str_frame(unsigned minor, const struct id3v2_frame *frame,
-                         u32_char *ubuf, size_t usize)
+/* returns the encoding of text frame @frame, or NULL if it is invalid */
+static const char *get_str_frame_encoding(const struct id321_config *conf,
+                                          unsigned minor,
+                                          const struct id3v2_frame *frame)
 {
-    const char *from_enc;
+    const char *enc;
 
     if (frame->size < 1)
-        return -EILSEQ;
+        return NULL;
 
-    from_enc = get_id3v2_tag_encoding_name(minor, frame->data[0]);
+    enc = get_id3v2_tag_encoding_name(conf, minor, frame->data[0]);
 
-    if (!from_enc)
-    {
+    if (!enc)
         print(OS_WARN, "invalid string encoding 0x%.2X in frame '%.4s'",
                        (unsigned char)frame->data[0], frame->id);
+
+    return enc;
+}
+
+static int get_str_frame(const struct id321_config *conf,
+                         unsigned minor, const struct id3v2_frame *frame,
+                         u32_char **ustr)
+{
+    const char *from_enc = get_str_frame_encoding(conf, minor, frame);
+
+    if (!from_enc)
         return -EILSEQ;
-    }
 
-    return iconvordie(U32_CHAR_CODESET, from_enc,
-                      frame->data + ID3V2_ENC_HDR_SIZE,
-                      frame->size - ID3V2_ENC_HDR_SIZE,
-                      (char *)ubuf, usize * sizeof(u32_char))
-           / sizeof(u32_char);
+    return iconv_u32_alloc(from_enc,
+                           frame->data + ID3V2_ENC_HDR_SIZE,
+                           frame->size - ID3V2_ENC_HDR_SIZE,
+                           ustr);
 }
 
-static int get_v22_str_frame(const struct id3v2_frame *frame,
-                             u32_char *ubuf, size_t usize)
+static int get_v22_str_frame(const struct id321_config *conf,
+                             const struct id3v2_frame *frame,
+                             u32_char **ustr)
 {
-    return get_str_frame(2, frame, ubuf, usize);
+    return get_str_frame(conf, 2, frame, ustr);
 }
 
-static int get_v23_str_frame(const struct id3v2_frame *frame,
-                             u32_char *ubuf, size_t usize)
+static int get_v23_str_frame(const struct id321_config *conf,
+                             const struct id3v2_frame *frame,
+                             u32_char **ustr)
 {
-    return get_str_frame(3, frame, ubuf, usize);
+    return get_str_frame(conf, 3, frame, ustr);
 }
 
-static int get_v24_str_frame(const struct id3v2_frame *frame,
-                             u32_char *ubuf, size_t usize)
+static int get_v24_str_frame(const struct id321_config *conf,
+                             const struct id3v2_frame *frame,
+                             u32_char **ustr)
 {
-    int utotalsize = get_str_frame(4, frame, ubuf, usize);
-    size_t i;
+    int ulen = get_str_frame(conf, 4, frame, ustr);
+    int i;
 
     /* The ID3v2.4 informal standard says:
      *
@@ -118,30 +135,25 @@ static int get_v24_str_frame(const struct id3v2_frame *frame,
      * To print such lists as plain text we will just replace all termination
      * codes with '/', so they will look just like ID3v2.3 values. */
 
-    if (utotalsize < usize)
-        usize = utotalsize;
-
-    for (i = 0; i < usize; i++)
-        if (ubuf[i] == U32_CHAR('\0'))
-            ubuf[i] = U32_CHAR('/');
+    for (i = 0; i < ulen; i++)
+        if ((*ustr)[i] == U32_CHAR('\0'))
+            (*ustr)[i] = U32_CHAR('/');
 
-    return utotalsize;
+    return ulen;
 }
 
-static int get_url_frame(const struct id3v2_frame *frame,
-                         u32_char *ubuf, size_t usize)
+static int get_url_frame(const struct id321_config *conf,
+                         const struct id3v2_frame *frame, u32_char **ustr)
 {
     size_t slen = strnlen(frame->data, frame->size);
 
-    return iconvordie(U32_CHAR_CODESET, g_config.enc_iso8859_1,
-                      frame->data, slen,
-                      (char *)ubuf, usize * sizeof(u32_char))
-           / sizeof(u32_char);
+    return iconv_u32_alloc(conf->enc_iso8859_1, frame->data, slen, ustr);
 }
 
-static int get_hex_frame(const struct id3v2_frame *frame,
-                         u32_char *ubuf, size_t usize)
+static int get_hex_frame(const struct id321_config *conf,
+                         const struct id3v2_frame *frame, u32_char **ustr)
 {
+    *ustr = NULL;
     return 0;
 }
 
@@ -379,46 +391,121 @@ id3_frame_handler_table_t v24_frames[] = {
     { NULL,   NULL,            NULL }
 };
 
+static const id3_frame_handler_table_t *
+find_frame_handler(const struct id3v2_tag *tag,
+                   const struct id3v2_frame *frame)
+{
+    id3_frame_handler_table_t *table = NULL;
+    size_t idlen = tag->header.version == 2 ? 3 : 4;
+
+    switch (tag->header.version)
+    {
+        case 2: table = v22_frames; break;
+        case 3: table = v23_frames; break;
+        case 4: table = v24_frames; break;
+        default: return NULL;
+    }
+
+    for (; table->id != NULL; table++)
+        if (!memcmp(table->id, frame->id, idlen))
+            return table;
+
+    return NULL;
+}
+
 /***
  * get_frame_data - get frame payload as u32_str
  *
+ * @conf - configuration the frame is decoded with
  * @tag - tag which frame belongs to
  * @frame - frame
- * @ubuf - output buffer
- * @usize - output buffer size in u32_chars
+ * @ustr - where to store the pointer to the resulting string
+ *
+ * Decodes the frame payload in a single pass into a null-terminated u32
+ * string allocated with xmalloc(), which the caller must free with xfree().
+ * *@ustr may be NULL if the frame has no printable data.
  *
  * Returns -EINVAL if the tag has unsupported version,
  *         -ENOSYS if parser for the frame is not implemented,
  *         -EILSEQ on parser error,
- *         or non-negative number of u32_chars which would be written
- *         if @buf was large enough.
+ *         -EFAULT if the frame payload cannot be loaded,
+ *         or non-negative number of u32_chars in *@ustr.
  */
 
-int get_frame_data(const struct id3v2_tag *tag,
+int get_frame_data(const struct id321_config *conf,
+                   const struct id3v2_tag *tag,
                    const struct id3v2_frame *frame,
-                   u32_char *ubuf, size_t usize)
+                   u32_char **ustr)
 {
-    id3_frame_handler_table_t *table = NULL;
-    size_t idlen = tag->header.version == 2 ? 3 : 4;
+    const id3_frame_handler_table_t *entry = find_frame_handler(tag, frame);
 
-    switch (tag->header.version)
-    {
-        case 2: table = v22_frames; break;
-        case 3: table = v23_frames; break;
-        case 4: table = v24_frames; break;
-        default: return -EINVAL; /* no need to report error here */
-    }
+    if (!entry)
+        return -EINVAL; /* no need to report error here */
+    else if (!entry->get_data)
+        return -ENOSYS;
+    else if (load_frame_data(tag, frame) != 0)
+        return -EFAULT;
 
-    for (; table->id != NULL; table++)
+    return entry->get_data(conf, frame, ustr);
+}
+
+/***
+ * get_frame_text - get text of a text information or URL link frame
+ *
+ * Fills @text with the payload of @frame as it is, so that it can be
+ * printed without conversion to u32_char string. Text of ID3v2.4 text
+ * information frames is a list of null separated strings.
+ *
+ * Returns 0 on success, -ENOSYS if @frame is of another kind (though
+ * get_frame_data() may handle it), or the same errors as get_frame_data().
+ */
+
+int get_frame_text(const struct id321_config *conf,
+                   const struct id3v2_tag *tag,
+                   const struct id3v2_frame *frame,
+                   struct frame_text *text)
+{
+    const id3_frame_handler_table_t *entry = find_frame_handler(tag, frame);
+    unsigned minor = tag->header.version;
+    struct text_span span;
+    int is_url;
+
+    if (!entry)
+        return -EINVAL;
+
+    is_url = (entry->get_data == get_url_frame);
+
+    if (!is_url
+        && entry->get_data != get_v22_str_frame
+        && entry->get_data != get_v23_str_frame
+        && entry->get_data != get_v24_str_frame)
+        return -ENOSYS;
+
+    if (load_frame_data(tag, frame) != 0)
+        return -EFAULT;
+
+    if (is_url)
     {
-        if (!memcmp(table->id, frame->id, idlen))
-        {
-            if (table->get_data)
-                return table->get_data(frame, ubuf, usize);
-            else
-                return -ENOSYS;
-        }
+        text->codeset = conf->enc_iso8859_1;
+        text->data = frame->data;
+        text->size = strnlen(frame->data, frame->size);
+        text->is_list = 0;
+        return 0;
     }
 
-    return -EINVAL;
+    text->codeset = get_str_frame_encoding(conf, minor, frame);
+
+    if (!text->codeset)
+        return -EILSEQ;
+
+    text->data = frame->data + ID3V2_ENC_HDR_SIZE;
+    text->size = frame->size - ID3V2_ENC_HDR_SIZE;
+    text->is_list = (minor == 4);
+
+    /* text of a lone BOM has no characters */
+    if (measure_text(text->codeset, text->data, text->size, 1, 0, &span) == 0
+        && span.chars == 0)
+        text->size = 0;
+
+    return 0;
 }
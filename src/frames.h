@@ -3,10 +3,25 @@
 
 #include <stddef.h>
 #include "id3v2.h"
+#include "params.h"
 #include "u32_char.h"
 
-int get_frame_data(const struct id3v2_tag *tag,
+struct frame_text
+{
+    const char *codeset;
+    const char *data;
+    size_t      size;
+    int         is_list;  /* null separated list of strings */
+};
+
+int get_frame_data(const struct id321_config *conf,
+                   const struct id3v2_tag *tag,
+                   const struct id3v2_frame *frame,
+                   u32_char **ustr);
+
+int get_frame_text(const struct id321_config *conf,
+                   const struct id3v2_tag *tag,
                    const struct id3v2_frame *frame,
-                   u32_char *ubuf, size_t usize);
+                   struct frame_text *text);
 
 #endif /* FRAMES_H */
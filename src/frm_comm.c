@@ -6,7 +6,7 @@
 #include "alias.h"
 #include "id3v2.h"
 #include "output.h"
-#include "params.h"       /* g_config */
+#include "params.h"       /* struct id321_config */
 #include "common.h"
 #include "frm_comm.h"
 #include "framelist.h"
@@ -33,13 +33,14 @@ void free_id3v2_frm_comm(struct id3v2_frm_comm *comm)
 {
     if (comm)
     {
-        free(comm->udesc);
-        free(comm->utext);
-        free(comm);
+        xfree(comm->udesc);
+        xfree(comm->utext);
+        xfree(comm);
     }
 }
 
-int unpack_id3v2_frm_comm(const struct id3v2_frame *frame, unsigned minor,
+int unpack_id3v2_frm_comm(const struct id321_config *conf,
+                          const struct id3v2_frame *frame, unsigned minor,
                           struct id3v2_frm_comm **comm)
 {
     const char *from_enc;
@@ -52,7 +53,7 @@ int unpack_id3v2_frm_comm(const struct id3v2_frame *frame, unsigned minor,
     if (frame->size < ID3V2_FRM_COMM_HDR_SIZE + 1)
         return -EILSEQ;
 
-    from_enc = get_id3v2_tag_encoding_name(minor, frame->data[0]);
+    from_enc = get_id3v2_tag_encoding_name(conf, minor, frame->data[0]);
 
     if (!from_enc)
     {
@@ -115,6 +116,7 @@ int unpack_id3v2_frm_comm(const struct id3v2_frame *frame, unsigned minor,
 }
 
 static struct id3v2_frm_comm *query_next_frm_comm(
+                                    const struct id321_config *conf,
                                     const struct id3v2_tag *tag,
                                     struct id3v2_frame **frame,
                                     const char *lang,
@@ -122,10 +124,15 @@ static struct id3v2_frm_comm *query_next_frm_comm(
 {
     const char *frame_id = get_frame_id_by_alias('c', tag->header.version);
 
-    while ((*frame = peek_next_frame(&tag->frame_head, frame_id, *frame)))
+    while ((*frame = peek_next_frame(tag, frame_id, *frame)))
     {
         struct id3v2_frm_comm *comm;
-        int ret = unpack_id3v2_frm_comm(*frame, tag->header.version, &comm);
+        int ret;
+
+        if (load_frame_data(tag, *frame) != 0)
+            return NULL;
+
+        ret = unpack_id3v2_frm_comm(conf, *frame, tag->header.version, &comm);
 
         if (ret == -EILSEQ)
             continue; /* just skip malformed frame */
@@ -176,8 +183,16 @@ static int convert_id3v2_frm_comm(const struct id3v2_frm_comm *comm,
     return nr_errors;
 }
 
-static int pack_id3v2_frm_comm(const struct id3v2_frm_comm *comm,
-                               struct id3v2_frame **frame,
+/***
+ * pack_id3v2_frm_comm
+ *
+ * Fills the zero-initialised frame descriptor @frame with COMM frame
+ * packed from @comm.
+ */
+
+static int pack_id3v2_frm_comm(const struct id321_config *conf,
+                               const struct id3v2_frm_comm *comm,
+                               struct id3v2_frame *frame,
                                unsigned minor)
 {
     const char *frame_id = get_frame_id_by_alias('c', minor);
@@ -185,7 +200,6 @@ static int pack_id3v2_frm_comm(const struct id3v2_frm_comm *comm,
     char *text = NULL;
     size_t desc_size;
     size_t text_size = 0;
-    struct id3v2_frame *new_frame;
     char frame_enc_byte = 0; /* all minor versions use 0 for ISO-8859-1 */
 
     int nr_errors = convert_id3v2_frm_comm(comm, ASCII_CODESET,
@@ -195,11 +209,11 @@ static int pack_id3v2_frm_comm(const struct id3v2_frm_comm *comm,
     if (nr_errors != 0)
     {
         /* Frame data contains characters outside ASCII range. */
-        free(desc);
-        free(text);
+        xfree(desc);
+        xfree(text);
         const char *tgt_encoding;
-        frame_enc_byte = get_id3v2_frame_encoding(minor,
-                                                  g_config.default_v2_enc,
+        frame_enc_byte = get_id3v2_frame_encoding(conf, minor,
+                                                  conf->default_v2_enc,
                                                   &tgt_encoding);
 
         if (frame_enc_byte == ID3V2_UNSUPPORTED_ENCODING)
@@ -209,56 +223,57 @@ static int pack_id3v2_frm_comm(const struct id3v2_frm_comm *comm,
                                &text, &text_size);
     }
 
-    new_frame = xcalloc(1, sizeof(struct id3v2_frame));
-    new_frame->size =
+    frame->size =
         ID3V2_ENC_HDR_SIZE + ID3V2_LANG_HDR_SIZE + desc_size + text_size;
-    new_frame->data = xmalloc(new_frame->size);
+    frame->data = xmalloc(frame->size);
 
-    strncpy(new_frame->id, frame_id, ID3V2_FRAME_ID_MAX_SIZE);
-    new_frame->data[0] = frame_enc_byte;
-    memcpy(new_frame->data + ID3V2_ENC_HDR_SIZE,
+    strncpy(frame->id, frame_id, ID3V2_FRAME_ID_MAX_SIZE);
+    frame->data[0] = frame_enc_byte;
+    memcpy(frame->data + ID3V2_ENC_HDR_SIZE,
            comm->lang, ID3V2_LANG_HDR_SIZE);
-    memcpy(new_frame->data + ID3V2_ENC_HDR_SIZE + ID3V2_LANG_HDR_SIZE,
+    memcpy(frame->data + ID3V2_ENC_HDR_SIZE + ID3V2_LANG_HDR_SIZE,
            desc, desc_size);
-    memcpy(new_frame->data + ID3V2_ENC_HDR_SIZE +
+    memcpy(frame->data + ID3V2_ENC_HDR_SIZE +
            ID3V2_LANG_HDR_SIZE + desc_size,
            text, text_size);
 
-    free(desc);
-    free(text);
-
-    *frame = new_frame;
+    xfree(desc);
+    xfree(text);
 
     return 0;
 }
 
-int update_id3v2_frm_comm(struct id3v2_tag *tag, const char *lang,
+int update_id3v2_frm_comm(const struct id321_config *conf,
+                          struct id3v2_tag *tag, const char *lang,
                           const u32_char *udesc, const u32_char *utext)
 {
-    struct id3v2_frame *next_frame = &tag->frame_head;
-    struct id3v2_frame *tmp_frame;
+    struct id3v2_frame *next_frame = NULL;
     struct id3v2_frm_comm *comm;
     int ret = 0;
 
     /* If utext is empty string delete all matching frames. */
     if (IS_EMPTY_STR(utext))
     {
-        while (comm = query_next_frm_comm(tag, &next_frame, lang, udesc))
+        while (comm = query_next_frm_comm(conf, tag, &next_frame,
+                                          lang, udesc))
         {
-            tmp_frame = next_frame->prev;
-            unlink_frame(next_frame);
-            free_frame(next_frame);
+            struct id3v2_frame *prev = prev_frame(tag, next_frame);
+
+            delete_frame(tag, next_frame);
             free_id3v2_frm_comm(comm);
-            next_frame = tmp_frame;
+            next_frame = prev;
         }
     }
     /* If there are matching frames update contents of all of them. */
-    else if (comm = query_next_frm_comm(tag, &next_frame, lang, udesc))
+    else if (comm = query_next_frm_comm(conf, tag, &next_frame,
+                                        lang, udesc))
     {
         do
         {
+            struct id3v2_frame tmp_frame = { 0 };
+
             u32_xstrupd(&comm->utext, utext);
-            ret = pack_id3v2_frm_comm(comm, &tmp_frame,
+            ret = pack_id3v2_frm_comm(conf, comm, &tmp_frame,
                                       tag->header.version);
 
             if (ret != 0)
@@ -267,29 +282,29 @@ int update_id3v2_frm_comm(struct id3v2_tag *tag, const char *lang,
                 return ret;
             }
 
-            insert_frame_before(next_frame, tmp_frame);
-            unlink_frame(next_frame);
-            free_frame(next_frame);
+            replace_frame(tag, next_frame, &tmp_frame);
             free_id3v2_frm_comm(comm);
-            next_frame = tmp_frame;
-        } while (comm = query_next_frm_comm(tag, &next_frame, lang, udesc));
+        } while (comm = query_next_frm_comm(conf, tag, &next_frame,
+                                            lang, udesc));
     }
     /* If no matching frame found and all parameters have been specified
      * create new frame and append it to the tag. */
     else if (lang != NULL && udesc != NULL)
     {
         struct id3v2_frm_comm new_comm;
+        struct id3v2_frame tmp_frame = { 0 };
 
         memcpy(new_comm.lang, lang, ID3V2_LANG_HDR_SIZE);
         new_comm.udesc = (u32_char *)udesc;
         new_comm.utext = (u32_char *)utext;
 
-        ret = pack_id3v2_frm_comm(&new_comm, &tmp_frame, tag->header.version);
+        ret = pack_id3v2_frm_comm(conf, &new_comm, &tmp_frame,
+                                  tag->header.version);
 
         if (ret != 0)
             return ret;
 
-        append_frame(&tag->frame_head, tmp_frame);
+        append_frame(tag, &tmp_frame);
     }
     else
     {
@@ -3,6 +3,7 @@
 
 #include <inttypes.h>
 #include "id3v2.h"
+#include "params.h"
 #include "u32_char.h"
 
 struct id3v2_frm_comm
@@ -16,11 +17,13 @@ struct id3v2_frm_comm *new_id3v2_frm_comm(void);
 
 void free_id3v2_frm_comm(struct id3v2_frm_comm *comm);
 
-int unpack_id3v2_frm_comm(const struct id3v2_frame *frame,
+int unpack_id3v2_frm_comm(const struct id321_config *conf,
+                          const struct id3v2_frame *frame,
                           unsigned minor,
                           struct id3v2_frm_comm **comm);
 
-int update_id3v2_frm_comm(struct id3v2_tag *tag, const char *lang,
+int update_id3v2_frm_comm(const struct id321_config *conf,
+                          struct id3v2_tag *tag, const char *lang,
                           const u32_char *udesc, const u32_char *utext);
 
 #endif /* FRM_COMM_H */
@@ -9,8 +9,10 @@
 #include "params.h"
 #include "textframe.h"
 #include "u32_char.h"
+#include "xalloc.h"
 
-int get_id3v2_tag_genre(const struct id3v2_tag *tag, u32_char **genre_ustr)
+int get_id3v2_tag_genre(const struct id321_config *conf,
+                        const struct id3v2_tag *tag, u32_char **genre_ustr)
 {
     u32_char *uptr;
     u32_char *udata;
@@ -19,7 +21,7 @@ int get_id3v2_tag_genre(const struct id3v2_tag *tag, u32_char **genre_ustr)
     long long_genre_id = -1;
     int ret;
 
-    ret = get_text_frame_data_by_alias(tag, 'g', &udata, &usize);
+    ret = get_text_frame_data_by_alias(conf, tag, 'g', &udata, &usize);
 
     if (ret != 0)
         return ret;
@@ -63,21 +65,23 @@ int get_id3v2_tag_genre(const struct id3v2_tag *tag, u32_char **genre_ustr)
     else
         *genre_ustr = NULL;
 
-    free(udata);
+    xfree(udata);
 
     return genre_id;
 }
 
-static int set_id3v2_tag_genre_raw(struct id3v2_tag *tag, const u32_char *ustr,
+static int set_id3v2_tag_genre_raw(const struct id321_config *conf,
+                                   struct id3v2_tag *tag, const u32_char *ustr,
                                    size_t usize)
 {
     const char *frame_id = get_frame_id_by_alias('g', tag->header.version);
-    return update_id3v2_tag_text_frame(tag, frame_id, U32_CHAR_CODESET,
+    return update_id3v2_tag_text_frame(conf, tag, frame_id, U32_CHAR_CODESET,
                                        (const char *)ustr,
                                        usize * sizeof(u32_char));
 }
 
-int set_id3v2_tag_genre(struct id3v2_tag *tag, uint8_t genre_id,
+int set_id3v2_tag_genre(const struct id321_config *conf,
+                        struct id3v2_tag *tag, uint8_t genre_id,
                         const u32_char *genre_ustr)
 {
     int ret = 0;
@@ -108,12 +112,13 @@ int set_id3v2_tag_genre(struct id3v2_tag *tag, uint8_t genre_id,
                                            genre_id, genre_ustr);
         }
 
-        ret = set_id3v2_tag_genre_raw(tag, udata, usize);
-        free(udata);
+        ret = set_id3v2_tag_genre_raw(conf, tag, udata, usize);
+        xfree(udata);
     }
     else if (!IS_EMPTY_STR(genre_ustr))
     {
-        ret = set_id3v2_tag_genre_raw(tag, genre_ustr, u32_strlen(genre_ustr));
+        ret = set_id3v2_tag_genre_raw(conf, tag, genre_ustr,
+                                      u32_strlen(genre_ustr));
     }
 
     return ret;
@@ -3,11 +3,14 @@
 
 #include <inttypes.h>
 #include "id3v2.h"
+#include "params.h"
 #include "u32_char.h"
 
-int get_id3v2_tag_genre(const struct id3v2_tag *tag, u32_char **genre_ustr);
+int get_id3v2_tag_genre(const struct id321_config *conf,
+                        const struct id3v2_tag *tag, u32_char **genre_ustr);
 
-int set_id3v2_tag_genre(struct id3v2_tag *tag,
+int set_id3v2_tag_genre(const struct id321_config *conf,
+                        struct id3v2_tag *tag,
                         uint8_t genre_id,
                         u32_char *genre_ustr);
 
@@ -1,23 +1,25 @@
 #include <errno.h>     /* EILSEQ */
-#include <stdlib.h>    /* free() */
+#include <stdlib.h>
 #include "id3v2.h"     /* struct id3v2_tag */
 #include "textframe.h" /* get_text_frame_data_by_alias() */
 #include "u32_char.h"  /* u32_char, u32_strtol() */
+#include "xalloc.h"    /* xfree() */
 
-int get_id3v2_tag_trackno(const struct id3v2_tag *tag)
+int get_id3v2_tag_trackno(const struct id321_config *conf,
+                          const struct id3v2_tag *tag)
 {
     u32_char *udata;
     long trackno;
     int ret;
 
-    ret = get_text_frame_data_by_alias(tag, 'n', &udata, NULL);
+    ret = get_text_frame_data_by_alias(conf, tag, 'n', &udata, NULL);
 
     if (ret != 0)
         return ret;
 
     errno = 0;
     trackno = u32_strtol(udata, NULL, 10);
-    free(udata);
+    xfree(udata);
 
     if (errno != 0 || trackno < 0)
         return -EILSEQ;
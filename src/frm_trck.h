@@ -2,7 +2,9 @@
 #define FRM_TRCK_H
 
 #include "id3v2.h"
+#include "params.h"
 
-int get_id3v2_tag_trackno(const struct id3v2_tag *tag);
+int get_id3v2_tag_trackno(const struct id321_config *conf,
+                          const struct id3v2_tag *tag);
 
 #endif /* FRM_TRCK_H */
@@ -1,10 +1,9 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdlib.h>
-#include <unistd.h> /* lseek, SEEK_* */
 #include <fcntl.h>  /* O_RDWR */
 #include "common.h"
-#include "params.h" /* NOT_SET */
+#include "params.h" /* NOT_SET, struct id321_config */
 #include "id3v1.h"
 #include "id3v2.h"
 #include "output.h"
@@ -45,8 +44,7 @@ static int get_id3v1_tag(struct file *file, unsigned minor,
     size = ret;
     assert(size <= sizeof(buf));
 
-    lseek(file->fd, file->crop.end, SEEK_SET);
-    if (readordie(file->fd, buf, size) != 0)
+    if (read_file_chunk(file, file->crop.end, buf, size) != 0)
         return -EFAULT;
 
     *tag = xmalloc(sizeof(struct id3v1_tag));
@@ -72,24 +70,23 @@ static int get_id3v1_tag(struct file *file, unsigned minor,
     if (ret != 0)
     {
         assert(ret != -E2BIG);
-        free(*tag);
+        xfree(*tag);
         *tag = NULL;
     }
 
     return (ret == -ENOENT || ret == 0) ? ret : -EFAULT;
 }
 
-static int get_id3v2_tag_prealloc(struct file *file, unsigned minor,
+static int get_id3v2_tag_prealloc(const struct id321_config *conf,
+                                  struct file *file, unsigned minor,
                                   struct id3v2_tag *tag)
 {
     int ret;
 
     assert(tag);
 
-    lseek(file->fd, 0, SEEK_SET);
-
     /* read ID3v2 tag if available */
-    ret = read_id3v2_header(file->fd, &tag->header);
+    ret = read_id3v2_header(file, 0, &tag->header);
 
     if (ret != 0)
         return ret;
@@ -99,9 +96,9 @@ static int get_id3v2_tag_prealloc(struct file *file, unsigned minor,
         dump_id3_header(&tag->header);
 
         if (tag->header.flags & ID3V2_FLAG_EXT_HEADER)
-            ret = read_id3v2_ext_header(file->fd, tag);
+            ret = read_id3v2_ext_header(file, tag);
 
-        ret = read_id3v2_frames(file->fd, tag);
+        ret = read_id3v2_frames(conf, file, tag);
 
         if (ret != 0)
             return ret;
@@ -116,13 +113,14 @@ static int get_id3v2_tag_prealloc(struct file *file, unsigned minor,
     return 0;
 }
 
-static int get_id3v2_tag(struct file *file, unsigned minor,
+static int get_id3v2_tag(const struct id321_config *conf,
+                         struct file *file, unsigned minor,
                          struct id3v2_tag **tag)
 {
     int ret;
 
     *tag = new_id3v2_tag();
-    ret = get_id3v2_tag_prealloc(file, minor, *tag);
+    ret = get_id3v2_tag_prealloc(conf, file, minor, *tag);
 
     if (ret != 0)
     {
@@ -136,17 +134,23 @@ static int get_id3v2_tag(struct file *file, unsigned minor,
     return 0;
 }
 
-int get_tags(const char *filename, struct version ver,
+int get_tags(const struct id321_config *conf,
+             const char *filename, struct version ver, mode_t mode,
              struct id3v1_tag **tag1, struct id3v2_tag **tag2)
 {
     int ret = 0;
     struct file *file;
 
-    file = open_file(filename, O_RDWR);
+    file = open_file(filename, mode);
 
     if (!file)
         return -EFAULT;
 
+    /* tags are parsed right in the mapped memory if possible, otherwise
+     * they are read with pread() */
+    map_file(file);
+    advise_file(file);
+
     /* the order makes sense */
     if (ver.major == 1 || ver.major == NOT_SET)
     {
@@ -165,7 +169,7 @@ int get_tags(const char *filename, struct version ver,
 
     if (ret == 0 && (ver.major == 2 || ver.major == NOT_SET))
     {
-        ret = get_id3v2_tag(file, ver.minor, tag2);
+        ret = get_id3v2_tag(conf, file, ver.minor, tag2);
 
         if (ret == -ENOENT)
         {
@@ -180,11 +184,13 @@ int get_tags(const char *filename, struct version ver,
 
     if (ret != 0 && *tag1)
     {
-        free(*tag1);
+        xfree(*tag1);
         *tag1 = NULL;
     }
 
-    close_file(file);
+    /* a lazily read tag keeps the file as the source of its frames */
+    if (!*tag2 || (*tag2)->src != file)
+        close_file(file);
 
     return SUCC_OR_FAULT(ret);
 }
@@ -1,16 +1,20 @@
 #include <config.h>
 #include <stdio.h>
+#include "output.h"
 
 void help(void)
 {
-    puts(
+    fputs(
 "id321 " VERSION " Copyright (c) 2010, 2021 Vitaly Sinilin\n"
 "\n"
-"usage: id321 [pr[int]] [VEROPT] [-eENC] [-f FMT|-F FRAME] FILE...\n"
+"usage: id321 [pr[int]] [VEROPT] [-eENC] [-f FMT|-F FRAME] [--verify-padding]\n"
+"              FILE...\n"
 "       id321 mo[dify] [VEROPT] [-eENC] [-EENC] [-x] [-s SIZE] MODOPT... FILE...\n"
 "       id321 {rm|delete} [VEROPT] [-x] FILE...\n"
 "       id321 sy[nc] VEROPT [-eENC] [-EENC] [-s SIZE] FILE...\n"
 "       id321 {cp|copy} [VEROPT] FILE1 FILE2\n"
+"       id321 batch [-0]\n"
+"       id321 serve --socket PATH [-j N]\n"
 "\n"
 "VEROPT is one of the following:\n"
 "       -1[0|1|2|3|e]                 use ID3v1[.x] tag only\n"
@@ -28,8 +32,12 @@ void help(void)
 "\n"
 "General options:\n"
 "       -u, --unsync                  unsynchronise ID3v2 tags\n"
+"       --padding HEADROOM[%][:MAX]   padding reserved when a tag grows\n"
+"       --rewrite                     rewrite files into a copy when resized\n"
+"       -j, --jobs N                  process N files at once (0 for all CPUs)\n"
+"       -0, --null                    read null-delimited commands in batch\n"
 "       -v, --verbose                 be verbose\n"
 "       -V, --version                 print the version number\n"
-"       -h, --help                    print this message"
-    );
+"       -h, --help                    print this message\n",
+          get_out_stream());
 }
@@ -0,0 +1,61 @@
+#ifndef ID321_H
+#define ID321_H
+
+/*
+ * libid321 - reading and writing ID3v2 tags of files in process
+ *
+ * A file is opened with id321_open(), which reads its ID3v2 tag, or
+ * starts an empty ID3v2.3 tag if the file has none. The frames of the tag
+ * are queried and changed in memory, and the tag is written back to the
+ * file by id321_write().
+ *
+ * All the functions returning int return 0 or a non-negative value on
+ * success, and a negated errno value on error. If a call on a file fails
+ * with -ENOMEM, the file is broken: it may only be closed, and the other
+ * calls on it fail with -EIO.
+ *
+ * A file may only be used by one thread at a time, but different files
+ * may be used by different threads at once.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* id321_open() flags */
+#define ID321_RDONLY 0x0
+#define ID321_RDWR   0x1
+
+struct id321_file;
+
+int id321_set_allocator(void *(*alloc_fn)(size_t),
+                        void *(*realloc_fn)(void *, size_t),
+                        void (*free_fn)(void *));
+
+int id321_open(const char *filename, int flags, struct id321_file **file);
+void id321_close(struct id321_file *file);
+
+int id321_get_version(const struct id321_file *file);
+
+int id321_get_frame(struct id321_file *file, const char *frame_id,
+                    unsigned index, const void **data, size_t *size);
+int id321_get_frame_text(struct id321_file *file, const char *frame_id,
+                         unsigned index, char **text);
+
+int id321_set_frame(struct id321_file *file, const char *frame_id,
+                    unsigned index, const void *data, size_t size);
+int id321_set_frame_text(struct id321_file *file, const char *frame_id,
+                         const char *text);
+
+int id321_write(struct id321_file *file);
+
+void id321_free(void *ptr);
+void id321_release_thread(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ID321_H */
@@ -5,18 +5,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>  /* munmap() */
 #include <unistd.h>
 #include "common.h"
 #include "dump.h"
+#include "file.h"
 #include "framelist.h"
 #include "id3v2.h"
 #include "output.h"
 #include "synchsafe.h"
 #include "xalloc.h"
 
-#define READORDIE(fd, buf, size, ret) \
-    if (readordie(fd, buf, size) != 0) \
-        return ret;
+/* block size padding is read in by verify_id3v2_padding() */
+#define PADDING_BLOCK_SIZE (16 * BLOCK_SIZE)
+
+/* tags bigger than this are read lazily unless the file is mapped */
+#define LAZY_TAG_SIZE (64 * BLOCK_SIZE)
 
 #define IS_WHOLE_TAG_UNSYNC(hdr) \
     ((hdr.version == 2 || hdr.version == 3) && hdr.flags & ID3V2_FLAG_UNSYNC)
@@ -24,7 +28,7 @@
 struct id3v2_tag *new_id3v2_tag(void)
 {
     struct id3v2_tag *tag = xcalloc(1, sizeof(struct id3v2_tag));
-    init_frame_list(&tag->frame_head);
+    init_frame_list(tag);
     tag->header.version = 3;
     return tag;
 }
@@ -34,8 +38,13 @@ void free_id3v2_tag(struct id3v2_tag *tag)
     if (!tag)
         return;
 
-    free_frame_list(&tag->frame_head);
-    free(tag);
+    free_frame_list(tag);
+    xfree(tag->raw);
+    if (tag->map)
+        munmap(tag->map, tag->mapsize);
+    if (tag->src)
+        close_file(tag->src);
+    xfree(tag);
 }
 
 int is_valid_frame_id_str(const char *str, size_t len)
@@ -84,143 +93,300 @@ static void unpack_id3v2_frame_header(const unsigned char *buf,
     }
 }
 
-static ssize_t read_unsync(int fd, void *buf, size_t size, char *pre)
+/***
+ * check_id3v2_padding
+ *
+ * Records the padding of @size bytes at @buf in @tag. The padding is only
+ * scanned for non-zero bytes in the verify mode, as for tags with large
+ * reserved padding it would otherwise cost more than the frames.
+ */
+
+static void check_id3v2_padding(const struct id321_config *conf,
+                                struct id3v2_tag *tag,
+                                const char *buf, size_t size)
 {
-    size_t realsize;
-    ssize_t bytes_read = 0;
-    char *ptr = buf;
+    print(OS_DEBUG, "padding length is %u bytes", size);
+    tag->padding = size;
 
-    while (readordie(fd, ptr, size) == 0)
+    if ((conf->options & ID321_OPT_VERIFY_PADDING)
+        && find_nonzero_byte(buf, size) != size)
     {
-        bytes_read += size;
-        realsize = deunsync_buf(ptr, size, *pre);
-        *pre = *(ptr + size - 1);
-
-        if (realsize < size)
-        {
-            size -= realsize;
-            ptr += realsize;
-        }
-        else
-            return bytes_read;
+        print(OS_DEBUG, "padding contains non-zero byte");
+        tag->padding_dirty = 1;
     }
-
-    return -1;
 }
 
-int read_id3v2_frames(int fd, struct id3v2_tag *tag)
+/***
+ * verify_id3v2_padding
+ *
+ * The same as check_id3v2_padding(), but for the padding of @size bytes
+ * at @pos within @file, which is read in large blocks in the verify mode
+ * only.
+ *
+ * Returns 0 on success, or -EFAULT on read error.
+ */
+
+static int verify_id3v2_padding(const struct id321_config *conf,
+                                struct id3v2_tag *tag,
+                                const struct file *file,
+                                off_t pos, size_t size)
 {
-    uint8_t buf[ID3V2_FRAME_HEADER_SIZE];
-    size_t  bytes_left = tag->header.size;
-    size_t  frame_header_size = (tag->header.version == 2)
-                                ? ID3V22_FRAME_HEADER_SIZE
-                                : ID3V2_FRAME_HEADER_SIZE;
-    char    pre = '\0';
-    ssize_t bytes_read = 0;
+    size_t blksize = PADDING_BLOCK_SIZE;
+    char  *block;
+
+    print(OS_DEBUG, "padding length is %u bytes", size);
+    tag->padding = size;
+
+    if (!(conf->options & ID321_OPT_VERIFY_PADDING))
+        return 0;
 
+    block = xmalloc(blksize);
 
-    while (bytes_left > frame_header_size)
+    while (size > 0)
     {
-        struct id3v2_frame *frame = NULL;
+        size_t bytes_to_read = (size > blksize) ? blksize : size;
 
-        if (IS_WHOLE_TAG_UNSYNC(tag->header))
+        if (read_file_chunk(file, pos, block, bytes_to_read) != 0)
         {
-            bytes_read = read_unsync(fd, buf, frame_header_size, &pre);
-            if (bytes_read == -1)
-                return -EFAULT;
+            xfree(block);
+            return -EFAULT;
         }
-        else
+
+        if (find_nonzero_byte(block, bytes_to_read) != bytes_to_read)
         {
-            READORDIE(fd, buf, frame_header_size, -EFAULT);
-            bytes_read = frame_header_size;
+            print(OS_DEBUG, "padding contains non-zero byte");
+            tag->padding_dirty = 1;
+            break;
         }
 
+        pos += bytes_to_read;
+        size -= bytes_to_read;
+    }
+
+    xfree(block);
+
+    return 0;
+}
+
+/***
+ * unpack_id3v2_frames
+ *
+ * Splits the tag payload @buf of size @size into frames and appends them
+ * to @tag. Frame payloads are not copied, the frames refer to @buf, so it
+ * must live as long as the tag. If @buf is read-only (i.e. it is not
+ * @tag->raw), the frames which have to be deunsynchronised get their own
+ * copies.
+ *
+ * Returns 0 on success, or -EFAULT if the payload is malformed.
+ */
+
+static int unpack_id3v2_frames(const struct id321_config *conf,
+                               struct id3v2_tag *tag, char *buf, size_t size)
+{
+    size_t frame_header_size = (tag->header.version == 2)
+                               ? ID3V22_FRAME_HEADER_SIZE
+                               : ID3V2_FRAME_HEADER_SIZE;
+
+    while (size > frame_header_size)
+    {
+        struct id3v2_frame frame = { 0 };
+
         /* check if there is a padding */
         if (buf[0] == '\0')
-        {
-            lseek(fd, -bytes_read, SEEK_CUR);
             break;
-        }
-
-        bytes_left -= bytes_read;
 
-        frame = xcalloc(1, sizeof(struct id3v2_frame));
-        unpack_id3v2_frame_header(buf, tag->header.version, frame);
+        unpack_id3v2_frame_header((unsigned char *)buf, tag->header.version,
+                                  &frame);
+        buf += frame_header_size;
+        size -= frame_header_size;
 
-        if (frame->size > bytes_left)
+        if (frame.size > size)
         {
             print(OS_ERROR, "frame '%.4s' size is %d, but space left is %d",
-                  frame->id, frame->size, bytes_left);
-            free(frame);
+                  frame.id, frame.size, size);
             return -EFAULT;
         }
 
-        frame->data = xmalloc(frame->size);
+        borrow_frame_data(&frame, buf, frame.size);
+        buf += frame.size;
+        size -= frame.size;
+        dump_frame(&frame);
 
-        if (IS_WHOLE_TAG_UNSYNC(tag->header))
-        {
-            bytes_read = read_unsync(fd, frame->data, frame->size, &pre);
-            if (bytes_read == -1)
-            {
-                free_frame(frame);
-                return -EFAULT;
-            }
-        }
-        else
+        if (tag->header.version == 4
+                && frame.format_flags & ID3V24_FRM_FMT_FLAG_UNSYNC)
         {
-            if (readordie(fd, frame->data, frame->size) != 0)
+            if (!tag->raw)
             {
-                free_frame(frame);
-                return -EFAULT;
-            }
-            bytes_read = frame->size;
-        }
+                char *copy = xmalloc(frame.size);
 
-        bytes_left -= bytes_read;
-        dump_frame(frame);
+                memcpy(copy, frame.data, frame.size);
+                attach_frame_data(&frame, copy, frame.size);
+            }
 
-        if (tag->header.version == 4
-                && frame->format_flags & ID3V24_FRM_FMT_FLAG_UNSYNC)
-        {
-            frame->size = deunsync_buf(frame->data, frame->size, '\0');
+            frame.size = deunsync_buf(frame.data, frame.size, '\0');
         }
 
-        append_frame(&tag->frame_head, frame);
+        append_frame(tag, &frame);
     }
 
-    /* check that padding contains zero bytes only */
-    if (bytes_left > 0)
+    if (size > 0)
+        check_id3v2_padding(conf, tag, buf, size);
+
+    return 0;
+}
+
+/***
+ * read_id3v2_unsync_frames
+ *
+ * Reads the payload of an ID3v2.2 or ID3v2.3 tag unsynchronised as a
+ * whole from @file into a buffer owned by @tag with a single read,
+ * deunsynchronises it in place in one pass, and then splits it into frames
+ * which refer to the buffer.
+ */
+
+static int read_id3v2_unsync_frames(const struct id321_config *conf,
+                                    struct file *file, struct id3v2_tag *tag)
+{
+    size_t size;
+
+    tag->raw = xmalloc(tag->header.size);
+
+    if (read_file_chunk(file, ID3V2_HEADER_LEN,
+                        tag->raw, tag->header.size) != 0)
+        return -EFAULT;
+
+    size = deunsync_buf(tag->raw, tag->header.size, '\0');
+
+    return unpack_id3v2_frames(conf, tag, tag->raw, size);
+}
+
+/***
+ * read_id3v2_frames_lazily
+ *
+ * Reads frame headers only, recording payload positions within @file.
+ * Payloads are loaded on demand by load_frame_data(), and those not
+ * touched at all are copied straight from @file when the tag is packed.
+ * The only exception is v2.4 frames which have to be deunsynchronised, as
+ * their actual size cannot be known without reading them.
+ *
+ * On success the tag keeps @file open as the source of its frames.
+ */
+
+static int read_id3v2_frames_lazily(const struct id321_config *conf,
+                                    struct file *file, struct id3v2_tag *tag)
+{
+    uint8_t buf[ID3V2_FRAME_HEADER_SIZE];
+    off_t   pos = ID3V2_HEADER_LEN;
+    off_t   end = ID3V2_HEADER_LEN + tag->header.size;
+    size_t  frame_header_size = (tag->header.version == 2)
+                                ? ID3V22_FRAME_HEADER_SIZE
+                                : ID3V2_FRAME_HEADER_SIZE;
+
+    while (end - pos > frame_header_size)
     {
-        char   block[BLOCK_SIZE];
-        size_t bytes_to_read;
-        size_t pos;
+        struct id3v2_frame frame = { 0 };
+        uint32_t raw_size;
+
+        if (read_file_chunk(file, pos, buf, frame_header_size) != 0)
+            return -EFAULT;
+
+        /* check if there is a padding */
+        if (buf[0] == '\0')
+            break;
 
-        print(OS_DEBUG, "padding length is %u bytes", bytes_left);
+        unpack_id3v2_frame_header(buf, tag->header.version, &frame);
+        pos += frame_header_size;
+        raw_size = frame.size;
 
-        while (bytes_left > 0)
+        if (raw_size > end - pos)
         {
-            bytes_to_read = (bytes_left > sizeof(block))
-                ? sizeof(block) : bytes_left;
+            print(OS_ERROR, "frame '%.4s' size is %d, but space left is %d",
+                  frame.id, raw_size, (int)(end - pos));
+            return -EFAULT;
+        }
 
-            READORDIE(fd, block, bytes_to_read, -EFAULT);
-            bytes_left -= bytes_to_read;
+        if (tag->header.version == 4
+                && frame.format_flags & ID3V24_FRM_FMT_FLAG_UNSYNC)
+        {
+            char *data = xmalloc(raw_size);
 
-            for (pos = 0; pos < bytes_to_read; pos++)
+            if (read_file_chunk(file, pos, data, raw_size) != 0)
             {
-                if (block[pos] != '\0')
-                {
-                    print(OS_DEBUG, "padding contains non-zero byte");
-                    lseek(fd, bytes_left, SEEK_CUR);
-                    break;
-                }
+                xfree(data);
+                return -EFAULT;
             }
+
+            attach_frame_data(&frame, data,
+                              deunsync_buf(data, raw_size, '\0'));
         }
+        else
+            defer_frame_data(&frame, pos, raw_size);
+
+        pos += raw_size;
+        dump_frame(&frame);
+        append_frame(tag, &frame);
     }
 
+    if (end > pos
+        && verify_id3v2_padding(conf, tag, file, pos, end - pos) != 0)
+        return -EFAULT;
+
+    tag->src = file;
+
     return 0;
 }
 
-int read_id3v2_ext_header(int fd, struct id3v2_tag *tag)
+/***
+ * read_id3v2_frames
+ *
+ * Reads frames of the tag which header has already been read from @file.
+ *
+ * Tags unsynchronised as a whole are always read into a buffer owned by
+ * @tag (see read_id3v2_unsync_frames()). Otherwise, if @file is mapped,
+ * frames refer directly to the mapping, so the tag takes the ownership of
+ * it. If it is not, tags bigger than LAZY_TAG_SIZE are read lazily (see
+ * read_id3v2_frames_lazily()), and smaller ones are read with a single
+ * read into a buffer owned by @tag, frames refer to it instead of having
+ * their own copies. Frames are only copied when their payloads are
+ * replaced by modifiers.
+ *
+ * If the tag has been read lazily, @tag->src is set to @file, and the file
+ * must not be closed until the tag is freed.
+ */
+
+int read_id3v2_frames(const struct id321_config *conf,
+                      struct file *file, struct id3v2_tag *tag)
+{
+    const char *payload;
+
+    tag->origin = file->id;
+
+    if (IS_WHOLE_TAG_UNSYNC(tag->header))
+        return read_id3v2_unsync_frames(conf, file, tag);
+
+    payload = peek_file_chunk(file, ID3V2_HEADER_LEN, tag->header.size);
+
+    if (payload)
+    {
+        tag->mapsize = file->size;
+        tag->map = detach_file_map(file);
+        return unpack_id3v2_frames(conf, tag, (char *)payload,
+                                   tag->header.size);
+    }
+
+    if (tag->header.size > LAZY_TAG_SIZE)
+        return read_id3v2_frames_lazily(conf, file, tag);
+
+    tag->raw = xmalloc(tag->header.size);
+
+    if (read_file_chunk(file, ID3V2_HEADER_LEN,
+                        tag->raw, tag->header.size) != 0)
+        return -EFAULT;
+
+    return unpack_id3v2_frames(conf, tag, tag->raw, tag->header.size);
+}
+
+int read_id3v2_ext_header(struct file *file, struct id3v2_tag *tag)
 {
     if (tag->header.flags & ID3V2_FLAG_EXT_HEADER)
     {
@@ -305,14 +471,15 @@ int find_id3v2_tag(struct id3v2_header *header, FILE *fp_src, FILE *fp_dst)
 }
 #endif
 
-static int read_id3v2_headfoot(int fd, struct id3v2_header *hdr, int footer)
+static int read_id3v2_headfoot(struct file *file, off_t pos,
+                               struct id3v2_header *hdr, int footer)
 {
     char         buf[ID3V2_HEADER_LEN];
-    size_t       pos;
+    size_t       i;
     const char  *id = footer ? "3DI" : "ID3";
     int          ret;
 
-    ret = readordie(fd, buf, ID3V2_HEADER_LEN);
+    ret = read_file_chunk(file, pos, buf, ID3V2_HEADER_LEN);
 
     if (ret != 0)
         return ret == -ENOENT ? ret : -EFAULT;
@@ -320,10 +487,10 @@ static int read_id3v2_headfoot(int fd, struct id3v2_header *hdr, int footer)
     if (memcmp(buf, id, 3))
         return -ENOENT;
 
-    for (pos = 3; pos < ID3V2_HEADER_LEN; pos++)
+    for (i = 3; i < ID3V2_HEADER_LEN; i++)
     {
-        if (((uint8_t)buf[pos] == 0xFF && (pos == 3 || pos == 4))
-            || (((uint8_t)buf[pos] & 0x80) && pos >= 6 && pos <= 9))
+        if (((uint8_t)buf[i] == 0xFF && (i == 3 || i == 4))
+            || (((uint8_t)buf[i] & 0x80) && i >= 6 && i <= 9))
             return -ENOENT;
     }
 
@@ -338,14 +505,14 @@ static int read_id3v2_headfoot(int fd, struct id3v2_header *hdr, int footer)
     return 0;
 }
 
-int read_id3v2_header(int fd, struct id3v2_header *hdr)
+int read_id3v2_header(struct file *file, off_t pos, struct id3v2_header *hdr)
 {
-    return read_id3v2_headfoot(fd, hdr, 0);
+    return read_id3v2_headfoot(file, pos, hdr, 0);
 }
 
-int read_id3v2_footer(int fd, struct id3v2_header *hdr)
+int read_id3v2_footer(struct file *file, off_t pos, struct id3v2_header *hdr)
 {
-    int ret = read_id3v2_headfoot(fd, hdr, 1);
+    int ret = read_id3v2_headfoot(file, pos, hdr, 1);
 
     if (ret == 0 && hdr->version != 4)
     {
@@ -361,85 +528,54 @@ int read_id3v2_footer(int fd, struct id3v2_header *hdr)
  * Pack functions
  */
 
-/***
- * pack_id3v2_frame
- *
- * Returns packed frame size or (size_t)-1 if the frame is too big to be
- * packed correctly.
- */
-
-static size_t pack_id3v2_frame(const struct id3v2_frame *frame,
-                               struct id3v2_header *hdr,
-                               char post,
-                               char *buf, size_t size)
+/* returns the byte which follows a frame payload once it is packed, in case
+ * it needs unsynchronisation */
+static char get_unsync_post(const struct id3v2_tag *tag,
+                            const struct id3v2_frame *frame)
 {
-    size_t  hdr_size = (hdr->version == 2)
-                       ? ID3V22_FRAME_HEADER_SIZE
-                       : ID3V2_FRAME_HEADER_SIZE;
-    uint8_t format_flags = frame->format_flags;
-    size_t  payload_size;
-    char   *hdr_buf = buf;
-    static const uint32_t frame_max_size[] =
-    {
-        /* unused */ 0,
-        /* unused */ 0,
-        /*  v2.2  */ ID3V22_FRAME_MAX_SIZE,
-        /*  v2.3  */ ID3V23_FRAME_MAX_SIZE,
-        /*  v2.4  */ ID3V24_FRAME_MAX_SIZE,
-    };
-
-    if (size < hdr_size + frame->size)
-        return hdr_size + frame->size;
-
-    buf += hdr_size;
-
-    if (hdr->version == 4 && (g_config.options & ID321_OPT_UNSYNC))
-    {
-        payload_size = unsync_buf(buf, size - hdr_size,
-                                  frame->data, frame->size, post);
-
-        /* check if unsynchronisation has changed the frame payload */
-        if (payload_size != frame->size)
-            format_flags |= ID3V24_FRM_FMT_FLAG_UNSYNC;
-        else
-        {
-            format_flags &= ~ID3V24_FRM_FMT_FLAG_UNSYNC;
-            /* reset the unsync bit in the tag header, as at least one
-             * frame has not been affected by unsynchronisation */
-            hdr->flags &= ~ID3V2_FLAG_UNSYNC;
-        }
-    }
-    else
-    {
-        memcpy(buf, frame->data, frame->size);
-        payload_size = frame->size;
-    }
-
-    /* check frame payload size */
-    if (payload_size > frame_max_size[hdr->version])
-        return (size_t)-1;
+    /* According to the ID3v2.3 and ID3v2.4 specifications the last byte
+     * of the last frame in the tag should be unsynchronised in case
+     * it is 0xFF. unsync_buf() implements this functionality in
+     * a general way, it takes a byte after buffer to decide whether
+     * the last byte should be unsynchronised or not. So we pass
+     * '\xFF' as a byte after buffer for the last frame to show that
+     * the last byte needs to be unsynchronised.
+     *
+     * Note that for the rest of frames we pass the first byte of the
+     * next frame ID as a byte after buffer because it will actually be
+     * such a byte. According to the standards frame ID should be
+     * composed of [A-Z0-9], so it will guarantee that the last byte of
+     * each frame but last will not be unsynchronised. */
+
+    return (frame + 1 == tag->frames + tag->frame_count)
+           ? '\xFF' : frame[1].id[0];
+}
 
-    if (hdr->version == 2)
+static void pack_id3v2_frame_header(const struct id3v2_frame *frame,
+                                    unsigned version,
+                                    size_t payload_size,
+                                    uint8_t format_flags,
+                                    char *buf)
+{
+    if (version == 2)
     {
-        memcpy(hdr_buf, frame->id, 3);
+        memcpy(buf, frame->id, 3);
         /* no need to do htonl(payload_size), as we use shift operator here */
-        hdr_buf[3] = (uint8_t)((payload_size >> 16) & 0xFF);
-        hdr_buf[4] = (uint8_t)((payload_size >> 8) & 0xFF);
-        hdr_buf[5] = (uint8_t)(payload_size & 0xFF);
+        buf[3] = (uint8_t)((payload_size >> 16) & 0xFF);
+        buf[4] = (uint8_t)((payload_size >> 8) & 0xFF);
+        buf[5] = (uint8_t)(payload_size & 0xFF);
     }
     else
     {
-        uint32_t net_payload_size = (hdr->version == 4)
+        uint32_t net_payload_size = (version == 4)
                                     ? htonl(unsync_uint32(payload_size))
                                     : htonl(payload_size);
 
-        memcpy(hdr_buf, frame->id, 4);
-        memcpy(hdr_buf + 4, &net_payload_size, sizeof(uint32_t));
-        hdr_buf[8] = frame->status_flags;
-        hdr_buf[9] = format_flags;
+        memcpy(buf, frame->id, 4);
+        memcpy(buf + 4, &net_payload_size, sizeof(uint32_t));
+        buf[8] = frame->status_flags;
+        buf[9] = format_flags;
     }
-
-    return hdr_size + payload_size;
 }
 
 static void pack_id3v2_header(const struct id3v2_header *hdr, char *buf)
@@ -453,108 +589,165 @@ static void pack_id3v2_header(const struct id3v2_header *hdr, char *buf)
     memcpy(buf + 6, &net_tag_size, sizeof(uint32_t));
 }
 
-ssize_t pack_id3v2_tag(const struct id3v2_tag *tag, char **buf, off_t filesize)
+static void add_piece(struct id3v2_layout *layout,
+                      const char *data, off_t offset, size_t size,
+                      size_t packed_size, char post)
+{
+    struct id3v2_piece *piece = &layout->pieces[layout->count++];
+
+    piece->data = data;
+    piece->offset = offset;
+    piece->size = size;
+    piece->packed_size = packed_size;
+    piece->post = post;
+    piece->is_unsync = (packed_size != size);
+    piece->is_owned = 0;
+}
+
+/***
+ * layout_id3v2_tag
+ *
+ * Lays @tag out the way pack_id3v2_tag() packs it, but instead of copying
+ * the frames, describes the tag as a list of pieces. The tag header and
+ * frame headers are generated into @layout->meta, and the pieces refer to
+ * them and to the frame payloads wherever they are: in memory, or in the
+ * source file of @tag if they have not been loaded. The padding follows
+ * the last piece up to @layout->size.
+ *
+ * Frames only have to be loaded if they are to be unsynchronised, which
+ * is done piece by piece when the pieces are written out.
+ * Whether the tag is unsynchronised, and its size if it is to be changed,
+ * are taken from @conf.
+ *
+ * The layout refers to @tag, so it must not outlive @tag, and @tag must
+ * not be changed until the layout is freed with free_id3v2_layout().
+ *
+ * Returns the size of the packed tag, or -EINVAL if a frame is too big to
+ * be packed correctly, or -E2BIG if the tag is too big, or -EFAULT if
+ * a frame payload cannot be read.
+ */
+
+ssize_t layout_id3v2_tag(const struct id321_config *conf,
+                         const struct id3v2_tag *tag,
+                         struct id3v2_layout *layout, off_t filesize)
 {
     struct id3v2_header header = tag->header;
     const struct id3v2_frame *frame;
-    size_t bufsize = header.size > BLOCK_SIZE ? header.size : BLOCK_SIZE;
-    size_t pos = ID3V2_HEADER_LEN;
-    size_t frame_size;
-    size_t newsize;
-
-    *buf = xmalloc(bufsize);
+    size_t  hdr_size = (header.version == 2)
+                       ? ID3V22_FRAME_HEADER_SIZE
+                       : ID3V2_FRAME_HEADER_SIZE;
+    int     is_unsync = (conf->options & ID321_OPT_UNSYNC);
+    int     is_whole_unsync = is_unsync && header.version != 4;
+    size_t  unsync_extra = 0; /* growth of the whole tag unsynchronised */
+    char   *meta;
+    size_t  pos = ID3V2_HEADER_LEN;
+    size_t  newsize;
+    size_t  i;
+    int     ret;
+    static const uint32_t frame_max_size[] =
+    {
+        /* unused */ 0,
+        /* unused */ 0,
+        /*  v2.2  */ ID3V22_FRAME_MAX_SIZE,
+        /*  v2.3  */ ID3V23_FRAME_MAX_SIZE,
+        /*  v2.4  */ ID3V24_FRAME_MAX_SIZE,
+    };
 
-    if (header.version == 4 && (g_config.options & ID321_OPT_UNSYNC))
+    if (header.version == 4 && is_unsync)
         header.flags |= ID3V2_FLAG_UNSYNC;
     else
         header.flags &= ~ID3V2_FLAG_UNSYNC;
 
-    for (frame = tag->frame_head.next; frame != &tag->frame_head;)
+    layout->meta = xmalloc(ID3V2_HEADER_LEN + tag->frame_count * hdr_size);
+    layout->pieces = xmalloc((2 * tag->frame_count + 1)
+                             * sizeof(struct id3v2_piece));
+    layout->count = 0;
+    layout->size = 0;
+    meta = layout->meta + ID3V2_HEADER_LEN;
+    add_piece(layout, layout->meta, 0, ID3V2_HEADER_LEN, ID3V2_HEADER_LEN, 0);
+
+    for_each_frame(tag, frame)
     {
-        char post = (frame->next == &tag->frame_head)
-                    ? '\xFF' : frame->next->id[0];
-
-        /* According to the ID3v2.3 and ID3v2.4 specifications the last byte
-         * of the last frame in the tag should be unsynchronised in case
-         * it is 0xFF. unsync_buf() implements this functionality in
-         * a general way, it takes a byte after buffer to decide whether
-         * the last byte should be unsynchronised or not. So we pass
-         * '\xFF' as a byte after buffer for the last frame to show that
-         * the last byte needs to be unsynchronised.
-         *
-         * Note that for the rest of frames we pass the first byte of the
-         * next frame ID as a byte after buffer because it will actually be
-         * such a byte. According to the standards frame ID should be
-         * composed of [A-Z0-9], so it will guarantee that the last byte of
-         * each frame but last will not be unsynchronised. */
-
-        frame_size = pack_id3v2_frame(frame, &header, post,
-                                      *buf+pos, bufsize-pos);
-
-        if (frame_size == (size_t)-1)
+        char    post = get_unsync_post(tag, frame);
+        size_t  payload_size = frame->size;
+        uint8_t format_flags = frame->format_flags;
+
+        if (is_unsync && load_frame_data(tag, frame) != 0)
         {
-            /* frame too big */
-            free(*buf);
-            *buf = NULL;
-            return -EINVAL;
+            ret = -EFAULT;
+            goto fail;
         }
-        else if (frame_size > bufsize - pos)
-        {
-            bufsize *= 2;
 
-            while (bufsize < pos + frame_size)
-                bufsize *= 2;
+        if (is_unsync && header.version == 4)
+        {
+            payload_size = unsync_buf(NULL, 0, frame->data, frame->size,
+                                      post);
 
-            *buf = xrealloc(*buf, bufsize);
-            continue;
+            /* check if unsynchronisation has changed the frame payload */
+            if (payload_size != frame->size)
+                format_flags |= ID3V24_FRM_FMT_FLAG_UNSYNC;
+            else
+            {
+                format_flags &= ~ID3V24_FRM_FMT_FLAG_UNSYNC;
+                /* reset the unsync bit in the tag header, as at least one
+                 * frame has not been affected by unsynchronisation */
+                header.flags &= ~ID3V2_FLAG_UNSYNC;
+            }
         }
 
-        pos += frame_size;
-        frame = frame->next;
-    }
-
-    if ((header.version == 2 || header.version == 3)
-        && (g_config.options & ID321_OPT_UNSYNC))
-    {
-        size_t reqbufsize = ID3V2_HEADER_LEN +
-                            unsync_buf(NULL, 0, *buf + ID3V2_HEADER_LEN,
-                                       pos - ID3V2_HEADER_LEN, '\xFF');
-
-        /* check if unsynchronisation has changed the tag payload */
-        if (reqbufsize != pos)
+        /* check frame payload size */
+        if (payload_size > frame_max_size[header.version])
         {
-            size_t newbufsize = reqbufsize;
-            char *newbuf = xmalloc(newbufsize);
-
-            (void)unsync_buf(newbuf + ID3V2_HEADER_LEN,
-                             reqbufsize - ID3V2_HEADER_LEN,
-                             *buf + ID3V2_HEADER_LEN,
-                             pos - ID3V2_HEADER_LEN, '\xFF');
-
-            memcpy(newbuf, *buf, ID3V2_HEADER_LEN);
-            free(*buf);
-            bufsize = newbufsize;
-            *buf = newbuf;
-            pos = reqbufsize;
+            ret = -EINVAL;
+            goto fail;
+        }
 
-            if (reqbufsize > header.size + ID3V2_HEADER_LEN)
-                header.size = reqbufsize - ID3V2_HEADER_LEN;
+        pack_id3v2_frame_header(frame, header.version, payload_size,
+                                format_flags, meta);
 
-            header.flags |= ID3V2_FLAG_UNSYNC;
+        if (is_whole_unsync)
+        {
+            /* the whole tag is unsynchronised as a single stream */
+            char first = UNSYNC_POST((frame->size > 0)
+                                     ? frame->data[0] : post);
+            size_t packed_hdr_size = unsync_buf(NULL, 0, meta, hdr_size,
+                                                first);
+
+            payload_size = unsync_buf(NULL, 0, frame->data, frame->size,
+                                      UNSYNC_POST(post));
+            unsync_extra += packed_hdr_size - hdr_size
+                            + payload_size - frame->size;
+            add_piece(layout, meta, 0, hdr_size, packed_hdr_size, first);
+            add_piece(layout, frame->data, 0, frame->size, payload_size,
+                      UNSYNC_POST(post));
+            pos += packed_hdr_size + payload_size;
+        }
+        else
+        {
+            add_piece(layout, meta, 0, hdr_size, hdr_size, 0);
+            add_piece(layout, frame->data, frame->offset, frame->size,
+                      payload_size, post);
+            pos += hdr_size + payload_size;
         }
+
+        meta += hdr_size;
     }
 
-    if (g_config.options & ID321_OPT_CHANGE_SIZE)
+    /* the tag is marked unsynchronised only if it has been changed */
+    if (unsync_extra > 0)
+        header.flags |= ID3V2_FLAG_UNSYNC;
+
+    if (conf->options & ID321_OPT_CHANGE_SIZE)
     {
-        if (g_config.options & ID321_OPT_ALIGN_SIZE)
+        if (conf->options & ID321_OPT_ALIGN_SIZE)
         {
-            size_t remainder = (pos + filesize) % g_config.size;
-            size_t padding = (remainder) ? (g_config.size - remainder) : 0;
+            size_t remainder = (pos + filesize) % conf->size;
+            size_t padding = (remainder) ? (conf->size - remainder) : 0;
             newsize = pos + padding;
         }
         else
         {
-            newsize = g_config.size;
+            newsize = conf->size;
         }
     }
     else
@@ -564,32 +757,153 @@ ssize_t pack_id3v2_tag(const struct id3v2_tag *tag, char **buf, off_t filesize)
         newsize = header.size + ID3V2_HEADER_LEN;
     }
 
-    if (pos <= newsize)
-    {
-        /* it seems there should be a padding, so fill it with null bytes */
-
-        if (bufsize < newsize)
-        {
-            /* damn, the current buffer is not large enough; need to
-             * enlarge it */
-            *buf = xrealloc(*buf, newsize);
-        }
-
-        memset(*buf + pos, '\0', newsize - pos);
+    /* it seems there should be a padding */
+    if (pos < newsize)
         pos = newsize;
-    }
 
     header.size = pos - ID3V2_HEADER_LEN;
 
     if (header.size > ID3V2_TAG_MAX_SIZE)
     {
         /* tag too big */
-        free(*buf);
-        *buf = NULL;
-        return -E2BIG;
+        ret = -E2BIG;
+        goto fail;
     }
 
-    pack_id3v2_header(&header, *buf);
+    /* pieces of a tag which whole unsynchronisation has not changed are
+     * copied as they are */
+    for (i = 0; is_whole_unsync && unsync_extra == 0 && i < layout->count; i++)
+        layout->pieces[i].is_unsync = 0;
+
+    pack_id3v2_header(&header, layout->meta);
+    layout->size = pos;
 
     return pos;
+
+fail:
+    free_id3v2_layout(layout);
+    return ret;
+}
+
+/***
+ * pad_id3v2_layout
+ *
+ * Enlarges the padding of the tag laid out as @layout, so that the tag
+ * takes @size bytes.
+ *
+ * Returns 0 on success, or -E2BIG if the tag would be too big.
+ */
+
+int pad_id3v2_layout(struct id3v2_layout *layout, size_t size)
+{
+    uint32_t net_tag_size;
+
+    if (size - ID3V2_HEADER_LEN > ID3V2_TAG_MAX_SIZE)
+        return -E2BIG;
+
+    net_tag_size = htonl(unsync_uint32(size - ID3V2_HEADER_LEN));
+    memcpy(layout->meta + 6, &net_tag_size, sizeof(uint32_t));
+    layout->size = size;
+
+    return 0;
+}
+
+void free_id3v2_layout(struct id3v2_layout *layout)
+{
+    size_t i;
+
+    for (i = 0; i < layout->count; i++)
+        if (layout->pieces[i].is_owned)
+            xfree((char *)layout->pieces[i].data);
+
+    xfree(layout->meta);
+    xfree(layout->pieces);
+    layout->meta = NULL;
+    layout->pieces = NULL;
+    layout->count = 0;
+}
+
+/***
+ * render_id3v2_piece
+ *
+ * Copies @size bytes of @piece of @tag starting at @pos to @buf,
+ * unsynchronising them if needed, so @buf must be large enough for twice
+ * @size bytes in that case. The bytes are read from the source file of
+ * @tag if the piece is not in memory.
+ *
+ * Returns the number of bytes written to @buf, or -EFAULT if the piece
+ * cannot be read.
+ */
+
+ssize_t render_id3v2_piece(const struct id3v2_tag *tag,
+                           const struct id3v2_piece *piece,
+                           size_t pos, size_t size,
+                           char *buf, size_t bufsize)
+{
+    if (piece->is_unsync)
+    {
+        char post = (pos + size < piece->size)
+                    ? UNSYNC_POST(piece->data[pos + size]) : piece->post;
+
+        return unsync_buf(buf, bufsize, piece->data + pos, size, post);
+    }
+
+    if (piece->data)
+        memcpy(buf, piece->data + pos, size);
+    else if (!tag->src ||
+             read_file_chunk(tag->src, piece->offset + pos, buf, size) != 0)
+        return -EFAULT;
+
+    return size;
+}
+
+/***
+ * pack_id3v2_tag
+ *
+ * Packs @tag into a buffer allocated to the exact size of the resulting
+ * tag, which is laid out up front (see layout_id3v2_tag()), so that every
+ * byte of the tag is written once. *@buf will be pointing to the buffer,
+ * it must be freed with xfree() after use.
+ *
+ * Returns the size of the packed tag, or the same errors as
+ * layout_id3v2_tag().
+ */
+
+ssize_t pack_id3v2_tag(const struct id321_config *conf,
+                       const struct id3v2_tag *tag,
+                       char **buf, off_t filesize)
+{
+    struct id3v2_layout layout;
+    ssize_t size = layout_id3v2_tag(conf, tag, &layout, filesize);
+    size_t pos = 0;
+    size_t i;
+
+    *buf = NULL;
+
+    if (size < 0)
+        return size;
+
+    *buf = xmalloc(size);
+
+    for (i = 0; i < layout.count; i++)
+    {
+        const struct id3v2_piece *piece = &layout.pieces[i];
+
+        if (render_id3v2_piece(tag, piece, 0, piece->size,
+                               *buf + pos, piece->packed_size) < 0)
+        {
+            free_id3v2_layout(&layout);
+            xfree(*buf);
+            *buf = NULL;
+            return -EFAULT;
+        }
+
+        pos += piece->packed_size;
+    }
+
+    /* fill the padding with null bytes */
+    memset(*buf + pos, '\0', size - pos);
+    free_id3v2_layout(&layout);
+
+    return size;
 }
@@ -3,6 +3,8 @@
 
 #include <inttypes.h>
 #include <sys/types.h>
+#include "file.h"
+#include "params.h"
 #include "u32_char.h"
 
 #ifdef _FRAME_LIST
@@ -89,28 +91,44 @@ struct id3v2_ext_header
     uint8_t   flags;
 };
 
+struct frame_index_entry;
+
+/* frame descriptor, tags keep them in contiguous arrays (see framelist.c) */
 struct id3v2_frame
 {
-    PRIVATE(struct id3v2_frame *, prev);
-    PRIVATE(struct id3v2_frame *, next);
-
     char      id[ID3V2_FRAME_ID_MAX_SIZE];
     uint32_t  size;
     uint8_t   status_flags;
     uint8_t   format_flags;
+    PRIVATE(uint8_t, borrowed); /* data points into memory owned by the tag */
     char     *data;
+    PRIVATE(off_t, offset); /* payload position in the source file, if the
+                             * payload is not loaded yet (data is NULL) */
 };
 
 struct id3v2_tag
 {
     struct id3v2_header     header;
     struct id3v2_ext_header ext_header;
-    struct id3v2_frame      frame_head;
+    struct id3v2_frame     *frames;   /* frames in the tag order */
+    size_t                  frame_count;
+    size_t                  frame_alloc;
+    struct frame_index_entry *index;  /* frames sorted by id */
+    size_t                  index_size;
+    int                     index_stale;
+    char                   *raw;      /* tag payload read in one go, if any */
+    char                   *map;      /* file mapping frames refer to, if any */
+    size_t                  mapsize;
+    struct file            *src;      /* file not loaded frames are read from */
+    struct file_id          origin;   /* file frames have been read from */
+    uint32_t                padding;  /* padding length in bytes */
+    int                     padding_dirty; /* padding has non-zero bytes
+                                            * (checked in verify mode only) */
 };
 
-typedef int (* id3_frame_handler_t)(const struct id3v2_frame *,
-                                    u32_char *buf,
-                                    size_t size);
+typedef int (* id3_frame_handler_t)(const struct id321_config *conf,
+                                    const struct id3v2_frame *,
+                                    u32_char **ustr);
 
 typedef struct id3_frame_handler_table_t
 {
@@ -125,12 +143,44 @@ void free_id3v2_tag(struct id3v2_tag *tag);
 int is_valid_frame_id_str(const char *str, size_t len);
 int is_valid_frame_id(const char *str);
 
-int read_id3v2_header(int fd, struct id3v2_header *hdr);
-int read_id3v2_footer(int fd, struct id3v2_header *hdr);
-int read_id3v2_ext_header(int fd, struct id3v2_tag *tag);
-int read_id3v2_frames(int fd, struct id3v2_tag *tag);
+int read_id3v2_header(struct file *file, off_t pos, struct id3v2_header *hdr);
+int read_id3v2_footer(struct file *file, off_t pos, struct id3v2_header *hdr);
+int read_id3v2_ext_header(struct file *file, struct id3v2_tag *tag);
+int read_id3v2_frames(const struct id321_config *conf,
+                      struct file *file, struct id3v2_tag *tag);
+
+/* a piece of a tag laid out by layout_id3v2_tag() */
+struct id3v2_piece
+{
+    const char *data;        /* NULL if the piece is in the source file */
+    off_t       offset;      /* position within the source file of the tag */
+    size_t      size;        /* size of the piece as it is */
+    size_t      packed_size; /* size of the piece within the packed tag */
+    char        post;        /* byte after the piece for unsync_buf() */
+    int         is_unsync;   /* piece is to be unsynchronised */
+    int         is_owned;    /* data is a copy to be freed with the layout */
+};
+
+struct id3v2_layout
+{
+    char               *meta;    /* tag header followed by frame headers */
+    struct id3v2_piece *pieces;
+    size_t              count;
+    size_t              size;    /* size of the tag including padding */
+};
 
-ssize_t pack_id3v2_tag(const struct id3v2_tag *tag, char **buf, off_t filesize);
+ssize_t layout_id3v2_tag(const struct id321_config *conf,
+                         const struct id3v2_tag *tag,
+                         struct id3v2_layout *layout, off_t filesize);
+int pad_id3v2_layout(struct id3v2_layout *layout, size_t size);
+void free_id3v2_layout(struct id3v2_layout *layout);
+ssize_t render_id3v2_piece(const struct id3v2_tag *tag,
+                           const struct id3v2_piece *piece,
+                           size_t pos, size_t size,
+                           char *buf, size_t bufsize);
+ssize_t pack_id3v2_tag(const struct id321_config *conf,
+                       const struct id3v2_tag *tag,
+                       char **buf, off_t filesize);
 
 const char *map_v22_to_v24(const char *v23frame);
 const char *map_v23_to_v24(const char *v23frame);
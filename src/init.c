@@ -1,9 +1,10 @@
 #include <config.h>
 #include <errno.h>
 #include <inttypes.h>
-#include <stdio.h>        /* fread(), puts(), stdin */
+#include <stdio.h>        /* fread(), fputs(), stdin */
 #include <stdlib.h>       /* atoi(), size_t */
 #include <string.h>
+#include <unistd.h>       /* sysconf() */
 #include "common.h"
 #include "iconv_wrap.h"
 #include "id3v1.h"
@@ -22,9 +23,25 @@
 #define OPT_START_TIME 2
 #define OPT_END_TIME   3
 #define OPT_NO_UNSYNC  4
+#define OPT_VERIFY_PADDING 5
+#define OPT_REWRITE    6
+#define OPT_PADDING    7
+#define OPT_SOCKET     8
+
+/* the most files processed at once */
+#define MAX_JOBS 1024
 
 extern void help(void);
 
+/* set once stdin is taken by batch commands, so frame data cannot be read
+ * from it */
+static int is_stdin_reserved;
+
+void reserve_stdin(void)
+{
+    is_stdin_reserved = 1;
+}
+
 /***
  * split_colon_separated_list
  *
@@ -98,7 +115,7 @@ static void unescape_chars(char *str, const char *chars, char esc)
  *
  * @enc_str - string containing a colon-separated list of encodings
  *
- * The routine setups encodings in g_config from a colon-separated list of
+ * The routine setups encodings in @conf from a colon-separated list of
  * encodings passed in the string @enc_str and checks if they are supported
  * by iconv.
  *
@@ -107,27 +124,26 @@ static void unescape_chars(char *str, const char *chars, char esc)
  * Notes: This function reports about errors itself.
  */
 
-static inline int setup_encodings(char *enc_str)
+static inline int setup_encodings(struct id321_config *conf, char *enc_str)
 {
 #define ENC_OPT_ARG_CNT 6
 
     size_t i;
     size_t argc;
     char *argv[ENC_OPT_ARG_CNT] = { };
-    id321_iconv_t cd;
-    static struct
+    struct
     {
         const char  *desc;
         const char **name;
     }
     enc[ENC_OPT_ARG_CNT] =
     {
-        { "ID3v1",      &g_config.enc_v1 },
-        { "ISO-8859-1", &g_config.enc_iso8859_1 },
-        { "UCS-2",      &g_config.enc_ucs2 },
-        { "UTF-16",     &g_config.enc_utf16 },
-        { "UTF-16BE",   &g_config.enc_utf16be },
-        { "UTF-8",      &g_config.enc_utf8 },
+        { "ID3v1",      &conf->enc_v1 },
+        { "ISO-8859-1", &conf->enc_iso8859_1 },
+        { "UCS-2",      &conf->enc_ucs2 },
+        { "UTF-16",     &conf->enc_utf16 },
+        { "UTF-16BE",   &conf->enc_utf16be },
+        { "UTF-8",      &conf->enc_utf8 },
     };
 
     if (enc_str)
@@ -152,15 +168,12 @@ static inline int setup_encodings(char *enc_str)
             *(enc[i].name) = argv[i];
 
         print(OS_INFO, "   %s=%s", enc[i].desc, *(enc[i].name));
-        cd = id321_iconv_open(*(enc[i].name), U32_CHAR_CODESET);
-        if (cd == (id321_iconv_t)-1)
+        if (!can_convert(*(enc[i].name), U32_CHAR_CODESET))
         {
             print(OS_ERROR, "codeset '%s' is not supported by your iconv",
                   *(enc[i].name));
             return -1;
         }
-        else
-            id321_iconv_close(cd);
     }
 
     return 0;
@@ -169,8 +182,8 @@ static inline int setup_encodings(char *enc_str)
 /***
  * parse_comment_optarg - parse comment option argument
  *
- * The routine modifies comment-related fields of the g_config structure
- * in accordance with @arg passed.
+ * The routine modifies comment-related fields of @conf in accordance with
+ * @arg passed.
  *
  * Comment option argument shall be in the format
  *
@@ -181,23 +194,23 @@ static inline int setup_encodings(char *enc_str)
  * text shall be escaped with '\' not to have their special meaning.
  */
 
-static inline int parse_comment_optarg(char *arg)
+static inline int parse_comment_optarg(struct id321_config *conf, char *arg)
 {
 #define COM_OPT_ARG_CNT 3
 
     size_t argc;
     size_t i;
     char *stack[COM_OPT_ARG_CNT];
-    const char **conf[COM_OPT_ARG_CNT] =
+    const char **field[COM_OPT_ARG_CNT] =
     {
-        &g_config.comment,
-        &g_config.comment_desc,
-        &g_config.comment_lang
+        &conf->comment,
+        &conf->comment_desc,
+        &conf->comment_lang
     };
 
     /* default values */
-    g_config.comment_desc = "";
-    g_config.comment_lang = "XXX";
+    conf->comment_desc = "";
+    conf->comment_lang = "XXX";
 
     /* at first, fill stack with all values available */
     argc = split_colon_separated_list(arg, stack, COM_OPT_ARG_CNT);
@@ -205,35 +218,35 @@ static inline int parse_comment_optarg(char *arg)
     /* then, propagate the collected values to the proper fields */
     for (i = 0; argc > 0; argc--, i++)
     {
-        if (!strcmp(stack[argc-1], "*") && conf[i] != &g_config.comment)
-            *conf[i] = NULL;
+        if (!strcmp(stack[argc-1], "*") && field[i] != &conf->comment)
+            *field[i] = NULL;
         else
         {
             unescape_chars(stack[argc-1], ":*\\", '\\');
-            *conf[i] = stack[argc-1];
+            *field[i] = stack[argc-1];
         }
     }
 
-    return (g_config.comment_lang
-            && strlen(g_config.comment_lang) != ID3V2_LANG_HDR_SIZE)
+    return (conf->comment_lang
+            && strlen(conf->comment_lang) != ID3V2_LANG_HDR_SIZE)
            ? -EFAULT : 0;
 }
 
 /***
  * parse_frame_optarg - parse frame option argument
  *
- * The routine modifies arbitrary frame-related fields of the g_config
- * structure in accordance with @arg passed.
+ * The routine modifies arbitrary frame-related fields of @conf in
+ * accordance with @arg passed.
  *
  * Frame option argument shall be in the format
  *
  *     <frame_id>['['<frame_number>']'][[:{<enc>|bin}]:<value>]
  *
  * where value can have special value '-' that means stdin. Use '\-' to set
- * literaly single dash.
+ * literaly single dash. Returns -EBUSY for stdin if it is reserved.
  */
 
-static inline int parse_frame_optarg(char *arg)
+static inline int parse_frame_optarg(struct id321_config *conf, char *arg)
 {
 #define FRAME_OPT_ARG_CNT 3
 
@@ -249,14 +262,14 @@ static inline int parse_frame_optarg(char *arg)
         unescape_chars(argv[i], ":\\", '\\');
 
     /* then, propagate the collected values to the proper fields */
-    g_config.frame_enc = NULL;
+    conf->frame_enc = NULL;
 
     /* parse frame id and frame number */
     {
         char *opb;
 
-        g_config.frame_id = *curarg++;
-        opb = strchr(g_config.frame_id, '[');
+        conf->frame_id = *curarg++;
+        opb = strchr(conf->frame_id, '[');
 
         if (opb)
         {
@@ -270,33 +283,33 @@ static inline int parse_frame_optarg(char *arg)
             *opb = *clb = '\0';
 
             if (index == clb) /* empty brackets */
-                g_config.options |= ID321_OPT_CREATE_FRAME;
+                conf->options |= ID321_OPT_CREATE_FRAME;
             else if (!strcmp(index, "*"))
-                g_config.options |= ID321_OPT_ALL_FRAMES;
+                conf->options |= ID321_OPT_ALL_FRAMES;
             else if (str_to_long(index, &frame_no) == 0)
-                g_config.frame_no = (int) frame_no;
+                conf->frame_no = (int) frame_no;
             else
                 return -EILSEQ;
         }
         else
         {
-            g_config.frame_no = 0;
-            g_config.options |= ID321_OPT_CREATE_FRAME_IF_NOT_EXISTS;
+            conf->frame_no = 0;
+            conf->options |= ID321_OPT_CREATE_FRAME_IF_NOT_EXISTS;
         }
 
-        if (strlen(g_config.frame_id) > ID3V2_FRAME_ID_MAX_SIZE)
+        if (strlen(conf->frame_id) > ID3V2_FRAME_ID_MAX_SIZE)
             return -EILSEQ;
     }
 
-    if (argc == 1 && !(g_config.options & ID321_OPT_CREATE_FRAME))
-        g_config.options |= ID321_OPT_RM_FRAME;
+    if (argc == 1 && !(conf->options & ID321_OPT_CREATE_FRAME))
+        conf->options |= ID321_OPT_RM_FRAME;
 
     if (argc == 3)
     {
         if (!strcasecmp(*curarg, "bin"))
-            g_config.options |= ID321_OPT_BIN_FRAME;
+            conf->options |= ID321_OPT_BIN_FRAME;
         else
-            g_config.frame_enc = *curarg;
+            conf->frame_enc = *curarg;
 
         curarg++;
     }
@@ -305,6 +318,9 @@ static inline int parse_frame_optarg(char *arg)
     {
         if (!strcmp(*curarg, "-"))
         {
+            if (is_stdin_reserved)
+                return -EBUSY;
+
             size_t bufsize = BLOCK_SIZE;
             size_t datasize = 0;
             char *buf = xmalloc(bufsize);
@@ -321,13 +337,13 @@ static inline int parse_frame_optarg(char *arg)
                 }
             } while (!feof(stdin));
 
-            g_config.frame_data = buf;
-            g_config.frame_size = datasize;
+            conf->frame_data = buf;
+            conf->frame_size = datasize;
         }
         else
         {
-            g_config.frame_data = (!strcmp(*curarg, "\\-")) ? "-" : *curarg;
-            g_config.frame_size = strlen(g_config.frame_data);
+            conf->frame_data = (!strcmp(*curarg, "\\-")) ? "-" : *curarg;
+            conf->frame_size = strlen(conf->frame_data);
         }
     }
 
@@ -344,7 +360,7 @@ static inline int parse_frame_optarg(char *arg)
  * where id3v1_genre_id may be specified by name.
  */
 
-static inline int parse_genre_optarg(char *arg)
+static inline int parse_genre_optarg(struct id321_config *conf, char *arg)
 {
 #define GENRE_OPT_ARG_CNT 2
 
@@ -355,16 +371,16 @@ static inline int parse_genre_optarg(char *arg)
 
     if (arg[0] == '\0')
     {
-        g_config.options |= ID321_OPT_RM_GENRE_FRAME | ID321_OPT_SET_GENRE_ID;
-        g_config.genre_id = ID3V1_UNKNOWN_GENRE;
-        g_config.genre_str = "";
+        conf->options |= ID321_OPT_RM_GENRE_FRAME | ID321_OPT_SET_GENRE_ID;
+        conf->genre_id = ID3V1_UNKNOWN_GENRE;
+        conf->genre_str = "";
         return 0;
     }
 
     argc = split_colon_separated_list(arg, argv, GENRE_OPT_ARG_CNT);
 
     if (argc == 2)
-        g_config.genre_str = argv[1];
+        conf->genre_str = argv[1];
 
     if (argv[0][0] == '\0')
         return 0; /* genre_id is omitted */
@@ -372,21 +388,88 @@ static inline int parse_genre_optarg(char *arg)
     ret = str_to_long(argv[0], &long_val);
     if (ret == 0 && long_val >= 0 && long_val <= 0xFF)
     {
-        g_config.genre_id = long_val;
-        g_config.options |= ID321_OPT_SET_GENRE_ID;
+        conf->genre_id = long_val;
+        conf->options |= ID321_OPT_SET_GENRE_ID;
     }
     else
     {
-        g_config.genre_id = get_id3v1_genre_id(argv[0]);
-        if (g_config.genre_id == ID3V1_UNKNOWN_GENRE)
+        conf->genre_id = get_id3v1_genre_id(argv[0]);
+        if (conf->genre_id == ID3V1_UNKNOWN_GENRE)
             return -EILSEQ;
-        g_config.options |= ID321_OPT_SET_GENRE_ID;
+        conf->options |= ID321_OPT_SET_GENRE_ID;
     }
 
     return 0;
 }
 
-int init_config(int *argc, char ***argv)
+static unsigned get_cpu_count(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (count > 0) ? count : 1;
+}
+
+/***
+ * parse_padding_optarg
+ *
+ * Parses the argument of option --padding which has the following format:
+ *
+ *    <headroom>[%][:<max_headroom>]
+ */
+
+static inline int parse_padding_optarg(struct id321_config *conf, char *arg)
+{
+#define PADDING_OPT_ARG_CNT 2
+
+    size_t argc;
+    char *argv[PADDING_OPT_ARG_CNT];
+    size_t len;
+    int ret;
+    long long_val;
+
+    argc = split_colon_separated_list(arg, argv, PADDING_OPT_ARG_CNT);
+    len = strlen(argv[0]);
+
+    if (len > 0 && argv[0][len - 1] == '%')
+    {
+        argv[0][len - 1] = '\0';
+        conf->options |= ID321_OPT_PADDING_PERCENT;
+    }
+    else
+        conf->options &= ~ID321_OPT_PADDING_PERCENT;
+
+    ret = str_to_long(argv[0], &long_val);
+    if (ret != 0 || long_val < 0 || long_val > UINT32_MAX)
+        return -EINVAL;
+
+    conf->padding = long_val;
+
+    if (argc == 2)
+    {
+        ret = str_to_long(argv[1], &long_val);
+        if (ret != 0 || long_val < 0 || long_val > UINT32_MAX)
+            return -EINVAL;
+
+        conf->padding_max = long_val;
+    }
+
+    return 0;
+}
+
+/***
+ * init_config
+ *
+ * Fills @conf in from the command line @argv, and makes @argc and @argv
+ * refer to the arguments after the options. It may be called again for
+ * another command line.
+ *
+ * Returns 0 on success, 1 if the help or the version has been printed
+ * and there is nothing else to do, or -1 on error.
+ *
+ * Notes: This function reports about errors itself.
+ */
+
+int init_config(struct id321_config *conf, int *argc, char ***argv)
 {
     int       c;
     long      long_val;
@@ -398,6 +481,8 @@ int init_config(int *argc, char ***argv)
     { if (cond) { print(OS_ERROR, __VA_ARGS__); return -1; } }
 #define ID3_GRP_WRITE ( ID3_MODIFY | ID3_SYNC | ID3_COPY )
 #define ID3_GRP_ALL ( ID3_GRP_WRITE | ID3_PRINT | ID3_DELETE )
+#define ID3_GRP_ANY ( ID3_GRP_ALL | ID3_BATCH | ID3_SERVE )
+#define ID3_GRP_JOBS ( (ID3_GRP_ALL & ~ID3_COPY) | ID3_SERVE )
 
     static const struct opt optlist[] =
     {
@@ -408,9 +493,10 @@ int init_config(int *argc, char ***argv)
         { "fmt",        'f',            OPT_REQ_ARG, ID3_MODIFY | ID3_PRINT },
         { "expert",     'x',            OPT_NO_ARG,  ID3_MODIFY | ID3_DELETE },
         { "frame",      'F',            OPT_REQ_ARG, ID3_MODIFY | ID3_PRINT },
-        { "help",       'h',            OPT_NO_ARG,  ID3_GRP_ALL },
+        { "help",       'h',            OPT_NO_ARG,  ID3_GRP_ANY },
         { "verbose",    'v',            OPT_NO_ARG,  ID3_GRP_ALL },
-        { "version",    'V',            OPT_NO_ARG,  ID3_GRP_ALL },
+        { "jobs",       'j',            OPT_REQ_ARG, ID3_GRP_JOBS },
+        { "version",    'V',            OPT_NO_ARG,  ID3_GRP_ANY },
         { "title",      't',            OPT_REQ_ARG, ID3_MODIFY },
         { "artist",     'a',            OPT_REQ_ARG, ID3_MODIFY },
         { "album",      'l',            OPT_REQ_ARG, ID3_MODIFY },
@@ -421,9 +507,14 @@ int init_config(int *argc, char ***argv)
         { "size",       's',            OPT_REQ_ARG, ID3_GRP_WRITE },
         { "unsync",     'u',            OPT_NO_ARG,  ID3_GRP_WRITE },
         { "no-unsync",  OPT_NO_UNSYNC,  OPT_NO_ARG,  ID3_GRP_WRITE },
+        { "rewrite",    OPT_REWRITE,    OPT_NO_ARG,  ID3_GRP_WRITE },
+        { "padding",    OPT_PADDING,    OPT_REQ_ARG, ID3_GRP_WRITE },
         { "speed",      OPT_SPEED,      OPT_REQ_ARG, ID3_MODIFY },
         { "start-time", OPT_START_TIME, OPT_REQ_ARG, ID3_MODIFY },
         { "end-time",   OPT_END_TIME,   OPT_REQ_ARG, ID3_MODIFY },
+        { "verify-padding", OPT_VERIFY_PADDING, OPT_NO_ARG, ID3_PRINT },
+        { "null",       '0',            OPT_NO_ARG,  ID3_BATCH },
+        { "socket",     OPT_SOCKET,     OPT_REQ_ARG, ID3_SERVE },
         { NULL,         0,              0, 0 }
     };
 
@@ -439,20 +530,12 @@ int init_config(int *argc, char ***argv)
         { "mo", ID3_MODIFY }, { "modify", ID3_MODIFY },
         { "sy", ID3_SYNC   }, { "sync",   ID3_SYNC   },
         { "cp", ID3_COPY   }, { "copy",   ID3_COPY   },
+        { "batch", ID3_BATCH }, { "serve", ID3_SERVE },
     };
 
     init_output(OS_ERROR);
-    g_config.action = ID3_PRINT;
-    g_config.ver.major = NOT_SET;
-    g_config.ver.minor = NOT_SET;
-
-    g_config.enc_v1 = g_config.enc_iso8859_1 = ISO_8859_1_CODESET;
-    g_config.enc_ucs2 = "UCS-2";
-    g_config.enc_utf16 = "UTF-16";
-    g_config.enc_utf16be = "UTF-16BE";
-    g_config.enc_utf8 = "UTF-8";
-
-    g_config.default_v2_enc = NULL;
+    init_default_config(conf);
+    reset_opt();
 
     /* determine action if specified, by default print tags */
     if (*argc > 1 && (*argv)[1][0] != '-')
@@ -463,27 +546,32 @@ int init_config(int *argc, char ***argv)
         {
             if (!strcmp((*argv)[1], actions[i].act_name))
             {
-                g_config.action = actions[i].act_id;
+                conf->action = actions[i].act_id;
                 opt_ind = 2;
                 break;
             }
         }
     }
 
-    while ((c = get_opt(*argc, *argv, optlist)) != -1)
+    /* a server takes as many commands at once as there are processors,
+     * unless told otherwise */
+    if (conf->action == ID3_SERVE)
+        conf->jobs = get_cpu_count();
+
+    while ((c = get_opt(*argc, *argv, optlist, conf->action)) != -1)
     {
         switch (c)
         {
             case 'h':
                 help();
-                exit(EXIT_SUCCESS);
+                return 1;
 
             case 'V':
-                puts("id321 " VERSION);
-                exit(EXIT_SUCCESS);
+                fputs("id321 " VERSION "\n", get_out_stream());
+                return 1;
 
             case '1':
-                g_config.ver.major = 1;
+                conf->ver.major = 1;
                 if (opt_arg != 0)
                 {
                     if (strlen(opt_arg) == 1)
@@ -494,21 +582,21 @@ int init_config(int *argc, char ***argv)
                             case '1':
                             case '2':
                             case '3':
-                                g_config.ver.minor = atoi(opt_arg);
+                                conf->ver.minor = atoi(opt_arg);
                                 break;
 
                             case 'e':
-                                g_config.ver.minor = ID3V1E_MINOR;
+                                conf->ver.minor = ID3V1E_MINOR;
                                 break;
                         }
                     }
-                    FATAL(g_config.ver.minor == NOT_SET,
+                    FATAL(conf->ver.minor == NOT_SET,
                           "unknown minor version of ID3v1: %s", opt_arg);
                 }
                 break;
 
             case '2':
-                g_config.ver.major = 2;
+                conf->ver.major = 2;
                 if (opt_arg != 0)
                 {
                     if (strlen(opt_arg) == 1)
@@ -518,11 +606,11 @@ int init_config(int *argc, char ***argv)
                             case '2':
                             case '3':
                             case '4':
-                                g_config.ver.minor = atoi(opt_arg);
+                                conf->ver.minor = atoi(opt_arg);
                                 break;
                         }
                     }
-                    FATAL(g_config.ver.minor == NOT_SET,
+                    FATAL(conf->ver.minor == NOT_SET,
                           "unknown minor version of ID3v2: %s", opt_arg);
                 }
                 break;
@@ -530,42 +618,44 @@ int init_config(int *argc, char ***argv)
             case 's':
                 if (opt_arg[0] == '*')
                 {
-                    g_config.options |= ID321_OPT_ALIGN_SIZE;
+                    conf->options |= ID321_OPT_ALIGN_SIZE;
                     opt_arg++;
                 }
                 ret = str_to_long(opt_arg, &long_val);
                 FATAL(ret != 0 || long_val < 0, "invalid tag size specified");
-                g_config.size = long_val;
-                g_config.options |= ID321_OPT_CHANGE_SIZE;
-                FATAL((g_config.options & ID321_OPT_ALIGN_SIZE) &&
-                      g_config.size == 0,
+                conf->size = long_val;
+                conf->options |= ID321_OPT_CHANGE_SIZE;
+                FATAL((conf->options & ID321_OPT_ALIGN_SIZE) &&
+                      conf->size == 0,
                       "invalid file size multiplier specified");
                 break;
 
             case 'g':
-                ret = parse_genre_optarg(opt_arg);
+                ret = parse_genre_optarg(conf, opt_arg);
                 FATAL(ret != 0, "invalid genre specified");
                 break;
 
             case 'c':
-                ret = parse_comment_optarg(opt_arg);
+                ret = parse_comment_optarg(conf, opt_arg);
                 FATAL(ret != 0, "invalid comment spec specified");
                 break;
 
-            case 'a': g_config.artist = opt_arg; break;
-            case 'l': g_config.album = opt_arg; break;
-            case 'n': g_config.track = opt_arg; break;
-            case 't': g_config.title = opt_arg; break;
-            case 'y': g_config.year = opt_arg; break;
+            case 'a': conf->artist = opt_arg; break;
+            case 'l': conf->album = opt_arg; break;
+            case 'n': conf->track = opt_arg; break;
+            case 't': conf->title = opt_arg; break;
+            case 'y': conf->year = opt_arg; break;
             case 'F':
-                ret = parse_frame_optarg(opt_arg);
+                ret = parse_frame_optarg(conf, opt_arg);
+                FATAL(ret == -EBUSY, "frame data cannot be read from stdin "
+                                     "in batch mode");
                 FATAL(ret != 0, "invalid frame spec specified");
                 break;
 
             case 'e':
                 if (!opt_arg)
                 {
-                    g_config.enc_v1 = g_config.enc_iso8859_1 =
+                    conf->enc_v1 = conf->enc_iso8859_1 =
                         locale_encoding();
                     enc_str = NULL;
                 }
@@ -574,25 +664,44 @@ int init_config(int *argc, char ***argv)
                 break;
 
             case 'E':
-                g_config.default_v2_enc = opt_arg;
+                conf->default_v2_enc = opt_arg;
+                break;
+
+            case 'j':
+                ret = str_to_long(opt_arg, &long_val);
+                FATAL(ret != 0 || long_val < 0 || long_val > MAX_JOBS,
+                      "invalid number of jobs specified");
+                /* as many as there are processors, if zero */
+                conf->jobs = (long_val > 0) ? long_val : get_cpu_count();
                 break;
 
             case 'v': debug_mask = (debug_mask << 1) | 1; break;
-            case 'f': g_config.fmtstr = opt_arg; break;
-            case 'x': g_config.options |= ID321_OPT_EXPERT; break;
-            case 'u': g_config.options |= ID321_OPT_UNSYNC; break;
-            case OPT_NO_UNSYNC: g_config.options &= ~ID321_OPT_UNSYNC; break;
+            case 'f': conf->fmtstr = opt_arg; break;
+            case 'x': conf->options |= ID321_OPT_EXPERT; break;
+            case '0': conf->options |= ID321_OPT_NUL_DELIMITED; break;
+            case 'u': conf->options |= ID321_OPT_UNSYNC; break;
+            case OPT_NO_UNSYNC: conf->options &= ~ID321_OPT_UNSYNC; break;
+            case OPT_REWRITE: conf->options |= ID321_OPT_REWRITE; break;
+            case OPT_SOCKET: conf->socket_path = opt_arg; break;
+            case OPT_PADDING:
+                ret = parse_padding_optarg(conf, opt_arg);
+                FATAL(ret != 0, "invalid padding specified");
+                break;
+
+            case OPT_VERIFY_PADDING:
+                conf->options |= ID321_OPT_VERIFY_PADDING;
+                break;
 
             case OPT_SPEED:
-                g_config.speed = get_id3v1e_speed_id(opt_arg);
-                if (g_config.speed == 0)
+                conf->speed = get_id3v1e_speed_id(opt_arg);
+                if (conf->speed == 0)
                 {
                     ret = str_to_long(opt_arg, &long_val);
                     FATAL(ret != 0 || long_val != (long_val & 0xFF),
                           "invalid speed value");
-                    g_config.speed = (uint8_t)long_val;
+                    conf->speed = (uint8_t)long_val;
                 }
-                g_config.options |= ID321_OPT_SET_SPEED;
+                conf->options |= ID321_OPT_SET_SPEED;
                 break;
 
             case '?':
@@ -600,65 +709,68 @@ int init_config(int *argc, char ***argv)
         }
     }
 
-    if (g_config.default_v2_enc)
+    if (conf->default_v2_enc)
     {
-        FATAL(g_config.ver.major != 2,
+        FATAL(conf->ver.major != 2,
               "default encoding is only configurable for ID3v2 tags; "
               "if you want to write an ID3v1 tag with non-standard "
               "encoding, use option -e instead");
 
         FATAL(get_id3v2_tag_encoding_byte(
-                    g_config.ver.minor,
-                    g_config.default_v2_enc) == ID3V2_UNSUPPORTED_ENCODING,
+                    conf->ver.minor,
+                    conf->default_v2_enc) == ID3V2_UNSUPPORTED_ENCODING,
               "ID3v2.%d tag has no support of encoding '%s'",
-              g_config.ver.minor, g_config.default_v2_enc);
+              conf->ver.minor, conf->default_v2_enc);
     }
 
     /* no debug output before this line is possible (i.e. only errors) */
     init_output(debug_mask);
 
-    ret = setup_encodings(enc_str);
+    ret = setup_encodings(conf, enc_str);
     if (ret != 0)
         return -1;
 
-    FATAL(g_config.action == ID3_SYNC && g_config.ver.major == NOT_SET,
+    FATAL(conf->action == ID3_SYNC && conf->ver.major == NOT_SET,
           "target version for synchronisation is not specified");
 
-    if (!(g_config.options & ID321_OPT_EXPERT))
+    FATAL(conf->action == ID3_SERVE && !conf->socket_path,
+          "socket to serve requests on is not specified");
+
+    if (!(conf->options & ID321_OPT_EXPERT))
     {
-        FATAL(g_config.action == ID3_DELETE
-              && (g_config.ver.minor == 0 || g_config.ver.minor == 1
-                  || g_config.ver.minor == 3),
+        FATAL(conf->action == ID3_DELETE
+              && (conf->ver.minor == 0 || conf->ver.minor == 1
+                  || conf->ver.minor == 3),
               "removing of namely ID3v1.%u tag may lead to "
               "a garbage at the end of the file in case there is an "
               "ID3v1.2 or ID3v1 enhanced tag; if you are sure use -x "
               "to do so",
-              g_config.ver.minor);
+              conf->ver.minor);
 
-        FATAL((g_config.options & ID321_OPT_SET_SPEED)
-              && !(is_valid_id3v1e_speed_id(g_config.speed)),
+        FATAL((conf->options & ID321_OPT_SET_SPEED)
+              && !(is_valid_id3v1e_speed_id(conf->speed)),
               "non standard speed value '%u' specified; "
               "if you are sure what you are doing use -x to force this",
-              g_config.speed);
+              conf->speed);
 
-        FATAL((g_config.options & ID321_OPT_SET_GENRE_ID)
-              && g_config.genre_id > ID3V1_GENRE_ID_MAX
-              && g_config.genre_id != ID3V1_UNKNOWN_GENRE,
+        FATAL((conf->options & ID321_OPT_SET_GENRE_ID)
+              && conf->genre_id > ID3V1_GENRE_ID_MAX
+              && conf->genre_id != ID3V1_UNKNOWN_GENRE,
               "non standard genre id '%u' specified; "
               "if you are sure what you are doing use -x to force this",
-              g_config.genre_id);
+              conf->genre_id);
 
-        FATAL(g_config.comment_lang
-              && !is_valid_langcode(g_config.comment_lang),
+        FATAL(conf->comment_lang
+              && !is_valid_langcode(conf->comment_lang),
               "non standard language code '%s' specified; "
               "if you are sure what you are doing use -x to force this",
-              g_config.comment_lang);
+              conf->comment_lang);
 
-        FATAL(g_config.action == ID3_MODIFY && g_config.frame_id
-              && !is_valid_frame_id(g_config.frame_id),
+        FATAL(conf->action == ID3_MODIFY && conf->frame_id
+              && !is_valid_frame_id(conf->frame_id),
               "invalid frame ID '%s' specified; "
               "if you are sure what you are doing use -x to force this",
-              g_config.frame_id);
+              conf->frame_id);
     }
 
     *argc -= opt_ind;
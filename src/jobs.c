@@ -0,0 +1,181 @@
+#include <config.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>     /* free() */
+#include "arena.h"
+#include "common.h"     /* close_iconv_cache() */
+#include "jobs.h"
+#include "output.h"
+#include "params.h"
+#include "xalloc.h"
+
+/*
+ * Files are processed by a pool of threads, each of which takes the next
+ * file not taken yet as soon as it is done with the previous one, so that
+ * threads which happen to get small files take more of them. What the
+ * processing of a file outputs is kept in memory, and it is written out
+ * by the calling thread, to its own output streams, in the order of the
+ * files once all the files before are written out. Each thread has its own
+ * arena, reset after each file, and its own iconv cache, and is as verbose
+ * as the calling thread.
+ */
+
+struct job
+{
+    const char *filename;
+    char       *out;        /* what has been written to stdout */
+    size_t      out_size;
+    char       *err;        /* what has been written to stderr */
+    size_t      err_size;
+    int         ret;
+    int         is_done;
+};
+
+struct job_pool
+{
+    int           (*func)(const struct id321_config *, const char *);
+    const struct id321_config *conf;
+    uint16_t        output_mask;    /* that of the calling thread */
+    struct job     *jobs;
+    size_t          count;
+    size_t          next;   /* the first job not taken yet */
+    pthread_mutex_t lock;
+    pthread_cond_t  done;   /* signalled whenever a job is done */
+};
+
+static void run_job(const struct job_pool *pool, struct job *job)
+{
+    FILE *out = open_memstream(&job->out, &job->out_size);
+    FILE *err = open_memstream(&job->err, &job->err_size);
+
+    /* if the output cannot be kept, it goes to the standard streams */
+    set_output_streams(out, err);
+    job->ret = pool->func(pool->conf, job->filename);
+    set_output_streams(NULL, NULL);
+
+    if (out)
+        fclose(out);
+    if (err)
+        fclose(err);
+}
+
+static void *run_worker(void *arg)
+{
+    struct job_pool *pool = arg;
+    struct arena *arena = new_arena();
+
+    init_output(pool->output_mask);
+    set_alloc_arena(arena);
+
+    for (;;)
+    {
+        struct job *job = NULL;
+
+        pthread_mutex_lock(&pool->lock);
+        if (pool->next < pool->count)
+            job = &pool->jobs[pool->next++];
+        pthread_mutex_unlock(&pool->lock);
+
+        if (!job)
+            break;
+
+        run_job(pool, job);
+        reset_arena(arena);
+
+        pthread_mutex_lock(&pool->lock);
+        job->is_done = 1;
+        pthread_cond_broadcast(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    set_alloc_arena(NULL);
+    free_arena(arena);
+    close_iconv_cache();
+
+    return NULL;
+}
+
+/***
+ * run_jobs
+ *
+ * Calls @func with @conf for each of @count @filenames on up to @threads
+ * threads, and writes out what the calls output in the order of @filenames,
+ * as if they were made one by one. @conf is shared by the threads, so it
+ * must not be changed until the call returns.
+ *
+ * Returns what @func returns for the last file.
+ */
+
+int run_jobs(int (*func)(const struct id321_config *, const char *),
+             const struct id321_config *conf,
+             char **filenames, size_t count, unsigned threads)
+{
+    struct job_pool pool;
+    pthread_t *tids;
+    unsigned started;
+    size_t i;
+    int ret = 0;
+
+    if (threads > count)
+        threads = count;
+
+    pool.func = func;
+    pool.conf = conf;
+    pool.output_mask = get_output_mask();
+    pool.jobs = xcalloc(count, sizeof(struct job));
+    pool.count = count;
+    pool.next = 0;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.done, NULL);
+
+    for (i = 0; i < count; i++)
+        pool.jobs[i].filename = filenames[i];
+
+    tids = xmalloc(threads * sizeof(pthread_t));
+
+    for (started = 0; started < threads; started++)
+        if (pthread_create(&tids[started], NULL, run_worker, &pool) != 0)
+            break;
+
+    /* if no thread can be started, the files are processed right here */
+    if (started == 0)
+        run_worker(&pool);
+
+    for (i = 0; i < count; i++)
+    {
+        struct job *job = &pool.jobs[i];
+
+        pthread_mutex_lock(&pool.lock);
+        while (!job->is_done)
+            pthread_cond_wait(&pool.done, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+
+        if (job->out)
+        {
+            fwrite(job->out, 1, job->out_size, get_out_stream());
+            free(job->out);
+        }
+
+        if (job->err)
+        {
+            if (job->err_size > 0)
+            {
+                fflush(get_out_stream());
+                fwrite(job->err, 1, job->err_size, get_err_stream());
+            }
+            free(job->err);
+        }
+
+        ret = job->ret;
+    }
+
+    while (started > 0)
+        pthread_join(tids[--started], NULL);
+
+    pthread_cond_destroy(&pool.done);
+    pthread_mutex_destroy(&pool.lock);
+    xfree(tids);
+    xfree(pool.jobs);
+
+    return ret;
+}
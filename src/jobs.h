@@ -0,0 +1,11 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stddef.h>
+#include "params.h"
+
+int run_jobs(int (*func)(const struct id321_config *, const char *),
+             const struct id321_config *conf,
+             char **filenames, size_t count, unsigned threads);
+
+#endif /* JOBS_H */
@@ -0,0 +1,503 @@
+#include <config.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <stdint.h>     /* UINT32_MAX */
+#include <string.h>
+#include <sys/mman.h>   /* munmap() */
+#include "arena.h"
+#include "common.h"
+#include "file.h"       /* O_TAGS_RDONLY */
+#include "framelist.h"
+#include "frames.h"     /* get_frame_data() */
+#include "id321.h"
+#include "id3v2.h"
+#include "output.h"     /* silence_output() */
+#include "params.h"
+#include "textframe.h"  /* update_id3v2_tag_text_frame() */
+#include "xalloc.h"
+
+/*
+ * Everything allocated for a file comes from its own arena, which is made
+ * the arena of the calling thread for the duration of each call, and is
+ * freed at once when the file is closed. Warnings and errors the core
+ * would print are not printed during a call. If memory cannot be allocated,
+ * fatal() jumps back to the call instead of exiting, and the call fails.
+ * Whatever the call has been doing is left half done then, so the file is
+ * marked broken and may only be closed.
+ */
+
+struct id321_file
+{
+    struct id321_config  conf;
+    struct arena        *arena;
+    char                *filename;
+    int                  mode;      /* open_file() mode */
+    struct id3v2_tag    *tag;
+    struct file         *files;     /* files opened by calls and not closed */
+    int                  is_broken;
+};
+
+static void enter_call(struct id321_file *file, jmp_buf *env)
+{
+    set_alloc_arena(file->arena);
+    set_fatal_jump(env);
+    set_file_list(&file->files);
+    silence_output(1);
+}
+
+static int leave_call(int ret)
+{
+    silence_output(0);
+    set_file_list(NULL);
+    set_fatal_jump(NULL);
+    set_alloc_arena(NULL);
+    return ret;
+}
+
+/* called when fatal() has jumped back to a call on @file */
+static int fail_call(struct id321_file *file)
+{
+    int ret = errno ? -errno : -EFAULT;
+
+    file->is_broken = 1;
+    return leave_call(ret);
+}
+
+static int read_tag(struct id321_file *file)
+{
+    struct version ver = { 2, NOT_SET };
+    struct id3v1_tag *tag1;
+
+    file->tag = NULL;
+
+    if (get_tags(&file->conf, file->filename, ver, file->mode,
+                 &tag1, &file->tag) != 0)
+        return -EFAULT;
+
+    if (!file->tag)
+        file->tag = new_id3v2_tag();
+
+    return 0;
+}
+
+static int is_valid_id(const struct id3v2_tag *tag, const char *frame_id)
+{
+    size_t len = (tag->header.version == 2) ? 3 : 4;
+
+    return frame_id && strlen(frame_id) == len && is_valid_frame_id(frame_id);
+}
+
+/* returns the @index-th frame @frame_id of @tag, or NULL if there is none */
+static struct id3v2_frame *find_frame(const struct id3v2_tag *tag,
+                                      const char *frame_id, unsigned index)
+{
+    struct id3v2_frame *frame = NULL;
+
+    do
+        frame = peek_next_frame(tag, frame_id, frame);
+    while (frame && index-- > 0);
+
+    return frame;
+}
+
+/***
+ * id321_set_allocator
+ *
+ * Makes all the memory of the library be allocated with @alloc_fn and
+ * @realloc_fn, and freed with @free_fn, which are expected to behave as
+ * malloc(), realloc() and free() do. It may only be called before any
+ * other function of the library.
+ *
+ * Returns 0 on success, or -EINVAL if any of the functions is NULL.
+ */
+
+int id321_set_allocator(void *(*alloc_fn)(size_t),
+                        void *(*realloc_fn)(void *, size_t),
+                        void (*free_fn)(void *))
+{
+    if (!alloc_fn || !realloc_fn || !free_fn)
+        return -EINVAL;
+
+    set_heap_hooks(alloc_fn, realloc_fn, free_fn);
+    return 0;
+}
+
+/***
+ * id321_open
+ *
+ * Opens @filename for reading, or also for writing if @flags has
+ * ID321_RDWR, and reads its ID3v2 tag. *@file will be pointing to the
+ * opened file, which must be closed with id321_close().
+ *
+ * Returns 0 on success, -ENOMEM if memory cannot be allocated, or -EFAULT
+ * if the file cannot be opened or its tag cannot be read.
+ */
+
+int id321_open(const char *filename, int flags, struct id321_file **file)
+{
+    struct id321_file *f;
+    size_t size = strlen(filename) + 1;
+    jmp_buf env;
+    int ret;
+
+    *file = NULL;
+    f = heap_alloc(sizeof(struct id321_file));
+
+    if (!f)
+        return -ENOMEM;
+
+    memset(f, 0, sizeof(struct id321_file));
+    init_default_config(&f->conf);
+    f->mode = (flags & ID321_RDWR) ? O_RDWR : O_TAGS_RDONLY;
+    f->filename = heap_alloc(size);
+
+    if (!f->filename)
+    {
+        id321_close(f);
+        return -ENOMEM;
+    }
+
+    memcpy(f->filename, filename, size);
+
+    enter_call(f, &env);
+
+    if (setjmp(env) != 0)
+    {
+        ret = fail_call(f);
+        id321_close(f);
+        return ret;
+    }
+
+    f->arena = new_arena();
+    set_alloc_arena(f->arena);
+    ret = read_tag(f);
+    leave_call(ret);
+
+    if (ret != 0)
+        id321_close(f);
+    else
+        *file = f;
+
+    return ret;
+}
+
+void id321_close(struct id321_file *file)
+{
+    if (!file)
+        return;
+
+    set_alloc_arena(file->arena);
+
+    /* the frames of a broken file may be inconsistent, so only what the
+     * tag holds outside of the arena is released, and the files a failed
+     * call has left open, including the tag source, are closed */
+    if (file->is_broken)
+    {
+        if (file->tag && file->tag->map)
+            munmap(file->tag->map, file->tag->mapsize);
+
+        while (file->files)
+            close_file(file->files);
+    }
+    else if (file->tag)
+        free_id3v2_tag(file->tag);
+
+    set_alloc_arena(NULL);
+
+    free_arena(file->arena);
+    heap_free(file->filename);
+    heap_free(file);
+}
+
+/***
+ * id321_get_version
+ *
+ * Returns the minor version of the ID3v2 tag of @file, i.e. 2, 3 or 4, or
+ * -EIO if @file is broken.
+ */
+
+int id321_get_version(const struct id321_file *file)
+{
+    return file->is_broken ? -EIO : (int)file->tag->header.version;
+}
+
+/***
+ * id321_get_frame
+ *
+ * Makes *@data point to the payload of the @index-th (counting from 0)
+ * frame @frame_id of @file as it is stored in the tag, and sets *@size to
+ * its size. The payload belongs to @file, and is only valid until @file is
+ * changed, written or closed.
+ *
+ * Returns 0 on success, -ENOENT if there is no such frame, -EINVAL if
+ * @frame_id is not valid for the tag version, -EFAULT if the payload
+ * cannot be read, or -EIO if @file is broken.
+ */
+
+int id321_get_frame(struct id321_file *file, const char *frame_id,
+                    unsigned index, const void **data, size_t *size)
+{
+    struct id3v2_frame *frame;
+    jmp_buf env;
+    int ret;
+
+    if (file->is_broken)
+        return -EIO;
+
+    if (!is_valid_id(file->tag, frame_id))
+        return -EINVAL;
+
+    enter_call(file, &env);
+
+    if (setjmp(env) != 0)
+        return fail_call(file);
+
+    frame = find_frame(file->tag, frame_id, index);
+    ret = 0;
+
+    if (!frame)
+        ret = -ENOENT;
+    else if (load_frame_data(file->tag, frame) != 0)
+        ret = -EFAULT;
+    else
+    {
+        *data = frame->data;
+        *size = frame->size;
+    }
+
+    return leave_call(ret);
+}
+
+/***
+ * id321_get_frame_text
+ *
+ * Makes *@text point to the null-terminated UTF-8 text of the @index-th
+ * (counting from 0) frame @frame_id of @file, the way the id321 print
+ * action shows it. The text must be freed with id321_free().
+ *
+ * Returns the length of the text in bytes on success, or the same errors
+ * as id321_get_frame(), or -ENOSYS if the frame has no text representation,
+ * or -EILSEQ if the frame is malformed, or -ENOMEM.
+ */
+
+int id321_get_frame_text(struct id321_file *file, const char *frame_id,
+                         unsigned index, char **text)
+{
+    struct id3v2_frame *frame;
+    u32_char *ustr = NULL;
+    char *buf = NULL;
+    size_t size = 0;
+    jmp_buf env;
+    int ret;
+
+    if (file->is_broken)
+        return -EIO;
+
+    if (!is_valid_id(file->tag, frame_id))
+        return -EINVAL;
+
+    enter_call(file, &env);
+
+    if (setjmp(env) != 0)
+        return fail_call(file);
+
+    frame = find_frame(file->tag, frame_id, index);
+
+    if (!frame)
+        return leave_call(-ENOENT);
+
+    ret = get_frame_data(&file->conf, file->tag, frame, &ustr);
+
+    if (ret < 0)
+        return leave_call(ret);
+
+    if (ret > 0)
+        iconv_alloc(file->conf.enc_utf8, U32_CHAR_CODESET,
+                    (const char *)ustr, ret * sizeof(u32_char),
+                    &buf, &size);
+
+    *text = heap_alloc(size + 1);
+
+    if (*text)
+    {
+        memcpy(*text, buf, size);
+        (*text)[size] = '\0';
+        ret = size;
+    }
+    else
+        ret = -ENOMEM;
+
+    xfree(buf);
+    xfree(ustr);
+
+    return leave_call(ret);
+}
+
+/***
+ * id321_set_frame
+ *
+ * Replaces the payload of the @index-th (counting from 0) frame @frame_id
+ * of @file with @size bytes at @data, or appends a new frame @frame_id if
+ * there is no such frame. If @data is NULL, the frame is removed instead.
+ * The change is only made in memory until id321_write() is called.
+ *
+ * Returns 0 on success, -ENOENT if there is no frame to remove, -EINVAL if
+ * @frame_id is not valid for the tag version, or -EIO if @file is broken.
+ */
+
+int id321_set_frame(struct id321_file *file, const char *frame_id,
+                    unsigned index, const void *data, size_t size)
+{
+    struct id3v2_frame *frame;
+    jmp_buf env;
+    int ret;
+
+    if (file->is_broken)
+        return -EIO;
+
+    if (!is_valid_id(file->tag, frame_id) || size > UINT32_MAX)
+        return -EINVAL;
+
+    enter_call(file, &env);
+
+    if (setjmp(env) != 0)
+        return fail_call(file);
+
+    frame = find_frame(file->tag, frame_id, index);
+    ret = 0;
+
+    if (!data)
+    {
+        if (frame)
+            delete_frame(file->tag, frame);
+        else
+            ret = -ENOENT;
+    }
+    else
+    {
+        char *payload = xmalloc(size);
+
+        if (!frame)
+        {
+            struct id3v2_frame new_frame = { 0 };
+
+            strncpy(new_frame.id, frame_id, ID3V2_FRAME_ID_MAX_SIZE);
+            frame = append_frame(file->tag, &new_frame);
+        }
+
+        memcpy(payload, data, size);
+        attach_frame_data(frame, payload, size);
+    }
+
+    return leave_call(ret);
+}
+
+/***
+ * id321_set_frame_text
+ *
+ * Sets the text information frame @frame_id of @file to the null-terminated
+ * UTF-8 @text, the way the id321 modify action does, or removes all such
+ * frames if @text is NULL or empty. The text is stored in ISO-8859-1 if it
+ * is ASCII, and in UTF-8 or UCS-2 otherwise depending on the tag version.
+ *
+ * Returns 0 on success, -EINVAL if @frame_id is not a text information
+ * frame, or -EIO if @file is broken.
+ */
+
+int id321_set_frame_text(struct id321_file *file, const char *frame_id,
+                         const char *text)
+{
+    struct id3v2_frame *frame;
+    jmp_buf env;
+    int ret;
+
+    if (file->is_broken)
+        return -EIO;
+
+    /* user defined text frames have a description before the text */
+    if (!is_valid_id(file->tag, frame_id) || frame_id[0] != 'T'
+        || !strcmp(frame_id, "TXX") || !strcmp(frame_id, "TXXX"))
+        return -EINVAL;
+
+    enter_call(file, &env);
+
+    if (setjmp(env) != 0)
+        return fail_call(file);
+
+    ret = 0;
+
+    if (IS_EMPTY_STR(text))
+    {
+        while ((frame = peek_frame(file->tag, frame_id)))
+            delete_frame(file->tag, frame);
+    }
+    else
+        ret = update_id3v2_tag_text_frame(&file->conf, file->tag, frame_id,
+                                          file->conf.enc_utf8,
+                                          text, strlen(text));
+
+    return leave_call(ret);
+}
+
+/***
+ * id321_write
+ *
+ * Writes the tag of @file to the file, or removes the tag from the file if
+ * it has no frames. The tag is then read anew from the file, whether or
+ * not it has been written.
+ *
+ * Returns 0 on success, -EBADF if @file is not open for writing, -EFAULT
+ * if the tag cannot be written, or -EIO if @file is broken, which it
+ * becomes if the tag cannot be read anew.
+ */
+
+int id321_write(struct id321_file *file)
+{
+    jmp_buf env;
+    int ret;
+
+    if (file->is_broken)
+        return -EIO;
+
+    if (file->mode != O_RDWR)
+        return -EBADF;
+
+    enter_call(file, &env);
+
+    if (setjmp(env) != 0)
+        return fail_call(file);
+
+    ret = write_tags(&file->conf, file->filename, NULL, file->tag);
+
+    /* frames not loaded refer to where they have been within the file */
+    free_id3v2_tag(file->tag);
+    reset_arena(file->arena);
+
+    if (read_tag(file) != 0)
+    {
+        file->is_broken = 1;
+        ret = -EIO;
+    }
+
+    return leave_call(ret);
+}
+
+/* frees memory returned by the library */
+
+void id321_free(void *ptr)
+{
+    heap_free(ptr);
+}
+
+/***
+ * id321_release_thread
+ *
+ * Releases the conversion descriptors the library has cached for the
+ * calling thread. A thread which has used the library should call it
+ * before it exits.
+ */
+
+void id321_release_thread(void)
+{
+    close_iconv_cache();
+}
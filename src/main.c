@@ -1,26 +1,41 @@
 #include <errno.h>
 #include <locale.h>
 #include <stdlib.h> /* EXIT_*, size_t */
-#include "common.h" /* for_each() */
+#include "arena.h"
+#include "batch.h"
+#include "common.h" /* for_each(), close_iconv_cache() */
+#include "jobs.h"
 #include "output.h"
 #include "params.h"
+#include "xalloc.h" /* set_alloc_arena() */
 
-extern int init_config(int *argc, char ***argv);
-extern int print_tags(const char *filename);
-extern int delete_tags(const char *filename);
-extern int modify_tags(const char *filename);
-extern int sync_tags(const char *filename);
-extern int copy_tags(int argc, char **argv);
+extern int init_config(struct id321_config *conf, int *argc, char ***argv);
+extern int print_tags(const struct id321_config *conf, const char *filename);
+extern int delete_tags(const struct id321_config *conf, const char *filename);
+extern int modify_tags(const struct id321_config *conf, const char *filename);
+extern int sync_tags(const struct id321_config *conf, const char *filename);
+extern int copy_tags(const struct id321_config *conf, int argc, char **argv);
+extern int run_serve(const struct id321_config *conf);
 
-char *program_name;
-struct id321_config g_config;
+/***
+ * run_action
+ *
+ * Performs the action of @conf on @argc files @argv. Unless the files are
+ * processed by several threads, the memory allocated while processing a
+ * file comes from @arena, and is released at once before the next one.
+ *
+ * Returns what the action returns for the last file, or -1 if there are
+ * no files.
+ */
 
-int main(int argc, char **argv)
+int run_action(const struct id321_config *conf, int argc, char **argv,
+               struct arena *arena)
 {
     int ret = 0;
+    size_t i;
     static const struct {
         enum id3_action action;
-        int (*func)(const char *);
+        int (*func)(const struct id321_config *, const char *);
     }
     actions[] =
     {
@@ -30,35 +45,75 @@ int main(int argc, char **argv)
         { ID3_SYNC,   sync_tags   },
     };
 
-    /* take care of locale */
-    setlocale(LC_ALL, "");
-
-    program_name = argv[0];
-
-    if (init_config(&argc, &argv) != 0)
-        return EXIT_FAILURE;
-
     if (argc == 0)
     {
         print(OS_ERROR, "no input files");
-        return EXIT_FAILURE;
+        return -1;
     }
 
-    if (g_config.action == ID3_COPY)
+    for_each (i, actions)
+        if (actions[i].action == conf->action)
+            break;
+
+    /* each thread has its own arena */
+    if (conf->action != ID3_COPY && conf->jobs > 1 && argc > 1)
+        return run_jobs(actions[i].func, conf, argv, argc, conf->jobs);
+
+    set_alloc_arena(arena);
+
+    if (conf->action == ID3_COPY)
     {
-        ret = copy_tags(argc, argv);
+        ret = copy_tags(conf, argc, argv);
     }
     else
     {
-        size_t i;
+        for (; argc > 0; argc--, argv++)
+        {
+            ret = actions[i].func(conf, *argv);
+            reset_arena(arena);
+        }
+    }
 
-        for_each (i, actions)
-            if (actions[i].action == g_config.action)
-                break;
+    set_alloc_arena(NULL);
 
-        for (; argc > 0; argc--, argv++)
-            ret = actions[i].func(*argv);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    struct id321_config config;
+    int ret;
+    struct arena *arena;
+
+    /* take care of locale */
+    setlocale(LC_ALL, "");
+
+    program_name = argv[0];
+
+    ret = init_config(&config, &argc, &argv);
+    if (ret != 0)
+        return ret > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    if (config.action & (ID3_BATCH | ID3_SERVE))
+    {
+        if (argc > 0)
+        {
+            print(OS_ERROR, "%s mode takes commands, not files",
+                  config.action == ID3_BATCH ? "batch" : "serve");
+            return EXIT_FAILURE;
+        }
+
+        ret = (config.action == ID3_BATCH) ? run_batch(&config)
+                                           : run_serve(&config);
     }
+    else
+    {
+        arena = new_arena();
+        ret = run_action(&config, argc, argv, arena);
+        free_arena(arena);
+    }
+
+    close_iconv_cache();
 
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>  /* O_RDWR */
 #include <stdio.h>  /* sscanf() */
 #include <stdlib.h>
 #include <string.h>
@@ -17,20 +18,21 @@
 #include "u32_char.h"
 #include "xalloc.h"
 
-static int modify_v1_tag(struct id3v1_tag *tag)
+static int modify_v1_tag(const struct id321_config *conf,
+                         struct id3v1_tag *tag)
 {
     unsigned track;
     const char fields[] = "talycG";
     const char *field_alias;
 
-    if (g_config.ver.minor != NOT_SET)
-        tag->version = g_config.ver.minor;
+    if (conf->ver.minor != NOT_SET)
+        tag->version = conf->ver.minor;
     else if (tag->version == 0 || tag->version == 1)
         tag->version = 3;
 
     for (field_alias = fields; *field_alias != '\0'; field_alias++)
     {
-        const char *new_value = get_config_data_by_alias(*field_alias);
+        const char *new_value = get_config_data_by_alias(conf, *field_alias);
 
         if (new_value)
         {
@@ -38,63 +40,63 @@ static int modify_v1_tag(struct id3v1_tag *tag)
             char *field = get_v1_data_by_alias(*field_alias, tag, &field_size);
 
             memset(field, '\0', field_size);
-            iconvordie(g_config.enc_v1, locale_encoding(),
+            iconvordie(conf->enc_v1, locale_encoding(),
                        new_value, strlen(new_value), field, field_size - 1);
         }
     }
 
-    if (g_config.options & ID321_OPT_SET_GENRE_ID)
-        tag->genre_id = g_config.genre_id;
+    if (conf->options & ID321_OPT_SET_GENRE_ID)
+        tag->genre_id = conf->genre_id;
 
-    if (g_config.track && sscanf(g_config.track, "%u", &track))
+    if (conf->track && sscanf(conf->track, "%u", &track))
         tag->track = (track <= 0xFF) ? track : 0;
 
-    if (g_config.options & ID321_OPT_SET_SPEED)
-        tag->speed = g_config.speed;
+    if (conf->options & ID321_OPT_SET_SPEED)
+        tag->speed = conf->speed;
 
     return 0;
 }
 
-static void modify_arbitrary_frame(struct id3v2_tag *tag,
+static void modify_arbitrary_frame(const struct id321_config *conf,
+                                   struct id3v2_tag *tag,
                                    struct id3v2_frame **frame)
 {
-    if (g_config.options & ID321_OPT_RM_FRAME)
+    if (conf->options & ID321_OPT_RM_FRAME)
     {
-        struct id3v2_frame *prev = (*frame)->prev;
+        struct id3v2_frame *prev = prev_frame(tag, *frame);
 
         /* delete frame */
-        unlink_frame(*frame);
-        free_frame(*frame);
+        delete_frame(tag, *frame);
 
         *frame = prev;
         /* we need to rewind the frame pointer to the previous frame
          * in order to make the caller able to continue iterating */
     }
-    else if (g_config.options & ID321_OPT_BIN_FRAME)
+    else if (conf->options & ID321_OPT_BIN_FRAME)
     {
-        free((*frame)->data);
-        (*frame)->data = xmalloc(g_config.frame_size);
-        memcpy((*frame)->data, g_config.frame_data, g_config.frame_size);
-        (*frame)->size = g_config.frame_size;
+        char *data = xmalloc(conf->frame_size);
+
+        memcpy(data, conf->frame_data, conf->frame_size);
+        attach_frame_data(*frame, data, conf->frame_size);
     }
     else
     {
         char *buf;
         size_t bufsize;
         char frame_enc_byte = 0; /* all minor versions use 0 for ISO-8859-1 */
-        const char *frame_encoding = g_config.frame_enc;
+        const char *frame_encoding = conf->frame_enc;
 
         if (!frame_encoding)
         {
             int nr_errors = iconv_alloc(ASCII_CODESET, locale_encoding(),
-                                        g_config.frame_data,
-                                        g_config.frame_size,
+                                        conf->frame_data,
+                                        conf->frame_size,
                                         &buf, &bufsize);
 
             if (nr_errors != 0)
             {
-                free(buf);
-                frame_encoding = g_config.default_v2_enc;
+                xfree(buf);
+                frame_encoding = conf->default_v2_enc;
             }
         }
 
@@ -103,7 +105,8 @@ static void modify_arbitrary_frame(struct id3v2_tag *tag,
             /* Either explicit encoding was specified or data contains
              * characters outside ASCII range. */
             const char *tgt_encoding;
-            char frame_enc_byte = get_id3v2_frame_encoding(tag->header.version,
+            char frame_enc_byte = get_id3v2_frame_encoding(conf,
+                                                           tag->header.version,
                                                            frame_encoding,
                                                            &tgt_encoding);
 
@@ -111,20 +114,21 @@ static void modify_arbitrary_frame(struct id3v2_tag *tag,
                 return;
 
             iconv_alloc(tgt_encoding, locale_encoding(),
-                        g_config.frame_data, g_config.frame_size,
+                        conf->frame_data, conf->frame_size,
                         &buf, &bufsize);
         }
 
         update_id3v2_tag_text_frame_payload(
                 *frame, frame_enc_byte, buf, bufsize);
 
-        free(buf);
+        xfree(buf);
     }
 
     return;
 }
 
-static int modify_v2_tag(const char *filename, struct id3v2_tag *tag)
+static int modify_v2_tag(const struct id321_config *conf,
+                         const char *filename, struct id3v2_tag *tag)
 {
     const char  frames[] = "talyn";
     const char *frame_alias;
@@ -135,7 +139,7 @@ static int modify_v2_tag(const char *filename, struct id3v2_tag *tag)
 
     for (frame_alias = frames; *frame_alias != '\0'; frame_alias++)
     {
-        const char *data = get_config_data_by_alias(*frame_alias);
+        const char *data = get_config_data_by_alias(conf, *frame_alias);
 
         if (data)
         {
@@ -146,19 +150,17 @@ static int modify_v2_tag(const char *filename, struct id3v2_tag *tag)
             if (data_sz == 0)
             {
                 /* delete frame if it exists */
-                struct id3v2_frame *frame =
-                    peek_frame(&tag->frame_head, frame_id);
+                struct id3v2_frame *frame = peek_frame(tag, frame_id);
 
                 if (frame)
                 {
-                    unlink_frame(frame);
-                    free_frame(frame);
+                    delete_frame(tag, frame);
                 }
             }
             else
             {
                 int ret = update_id3v2_tag_text_frame(
-                        tag, frame_id, locale_encoding(),
+                        conf, tag, frame_id, locale_encoding(),
                         data, data_sz);
 
                 if (ret != 0)
@@ -168,13 +170,14 @@ static int modify_v2_tag(const char *filename, struct id3v2_tag *tag)
     }
 
     /* modify comment */
-    if (g_config.comment)
+    if (conf->comment)
     {
         int ret;
-        u32_char *udesc = locale_to_u32_alloc(g_config.comment_desc);
-        u32_char *utext = locale_to_u32_alloc(g_config.comment);
+        u32_char *udesc = locale_to_u32_alloc(conf->comment_desc);
+        u32_char *utext = locale_to_u32_alloc(conf->comment);
 
-        ret = update_id3v2_frm_comm(tag, g_config.comment_lang, udesc, utext);
+        ret = update_id3v2_frm_comm(conf, tag, conf->comment_lang,
+                                    udesc, utext);
 
         if (ret == -ENOENT)
         {
@@ -182,90 +185,91 @@ static int modify_v2_tag(const char *filename, struct id3v2_tag *tag)
             ret = 0;
         }
 
-        free(utext);
-        free(udesc); /* may be null pointer, but it is ok to free(NULL) */
+        xfree(utext);
+        xfree(udesc); /* may be null pointer, but it is ok to xfree(NULL) */
 
         if (ret != 0)
             return ret;
     }
 
     /* modify genre */
-    if (g_config.options & ID321_OPT_RM_GENRE_FRAME)
+    if (conf->options & ID321_OPT_RM_GENRE_FRAME)
     {
         const char *frame_id = get_frame_id_by_alias('g', tag->header.version);
-        struct id3v2_frame *frame = peek_frame(&tag->frame_head, frame_id);
+        struct id3v2_frame *frame = peek_frame(tag, frame_id);
 
         /* delete frame if it exists */
         if (frame)
         {
-            unlink_frame(frame);
-            free_frame(frame);
+            delete_frame(tag, frame);
         }
     }
     else
     {
         u32_char *genre_ustr = NULL;
-        uint8_t genre_id = (g_config.options & ID321_OPT_SET_GENRE_ID)
-                           ? g_config.genre_id : ID3V1_UNKNOWN_GENRE;
+        uint8_t genre_id = (conf->options & ID321_OPT_SET_GENRE_ID)
+                           ? conf->genre_id : ID3V1_UNKNOWN_GENRE;
 
-        if (!IS_EMPTY_STR(g_config.genre_str))
+        if (!IS_EMPTY_STR(conf->genre_str))
         {
             iconv_alloc(U32_CHAR_CODESET, locale_encoding(),
-                        g_config.genre_str, strlen(g_config.genre_str),
+                        conf->genre_str, strlen(conf->genre_str),
                         (void *)&genre_ustr, NULL);
         }
 
-        int ret = set_id3v2_tag_genre(tag, genre_id, genre_ustr);
-        free(genre_ustr);
+        int ret = set_id3v2_tag_genre(conf, tag, genre_id, genre_ustr);
+        xfree(genre_ustr);
 
         if (ret != 0)
             return ret;
     }
 
     /* modify arbitrary frame */
-    if (g_config.frame_id)
+    if (conf->frame_id)
     {
         struct id3v2_frame *frame = NULL;
 
-        if ((g_config.options & ID321_OPT_CREATE_FRAME_IF_NOT_EXISTS
-             && !(g_config.options & ID321_OPT_RM_FRAME))
-            || g_config.options & ID321_OPT_CREATE_FRAME)
+        if ((conf->options & ID321_OPT_CREATE_FRAME_IF_NOT_EXISTS
+             && !(conf->options & ID321_OPT_RM_FRAME))
+            || conf->options & ID321_OPT_CREATE_FRAME)
         {
-            if (g_config.options & ID321_OPT_CREATE_FRAME_IF_NOT_EXISTS)
-                frame = peek_frame(&tag->frame_head, g_config.frame_id);
+            if (conf->options & ID321_OPT_CREATE_FRAME_IF_NOT_EXISTS)
+                frame = peek_frame(tag, conf->frame_id);
 
             if (!frame)
             {
-                frame = xcalloc(1, sizeof(struct id3v2_frame));
-                strncpy(frame->id, g_config.frame_id, ID3V2_FRAME_ID_MAX_SIZE);
-                append_frame(&tag->frame_head, frame);
+                struct id3v2_frame new_frame = { 0 };
+
+                strncpy(new_frame.id, conf->frame_id,
+                        ID3V2_FRAME_ID_MAX_SIZE);
+                frame = append_frame(tag, &new_frame);
             }
 
-            modify_arbitrary_frame(tag, &frame);
+            modify_arbitrary_frame(conf, tag, &frame);
         }
         else
         {
             int frame_no;
 
-            for (frame_no = 0, frame = &tag->frame_head;
-                 (frame_no <= g_config.frame_no
-                  || (g_config.options & ID321_OPT_ALL_FRAMES)) &&
-                 (frame = peek_next_frame(&tag->frame_head, g_config.frame_id,
-                                          frame)); frame_no++)
+            for (frame_no = 0, frame = NULL;
+                 (frame_no <= conf->frame_no
+                  || (conf->options & ID321_OPT_ALL_FRAMES)) &&
+                 (frame = peek_next_frame(tag, conf->frame_id, frame));
+                 frame_no++)
             {
-                if ((g_config.options & ID321_OPT_ALL_FRAMES)
-                    || frame_no == g_config.frame_no)
-                    modify_arbitrary_frame(tag, &frame);
+                if ((conf->options & ID321_OPT_ALL_FRAMES)
+                    || frame_no == conf->frame_no)
+                    modify_arbitrary_frame(conf, tag, &frame);
                 else
                     ; /* iterate through the matching frames until
                        * frame_no is reached */
             }
 
-            if (!(g_config.options & ID321_OPT_ALL_FRAMES)
-                && frame_no != g_config.frame_no + 1)
+            if (!(conf->options & ID321_OPT_ALL_FRAMES)
+                && frame_no != conf->frame_no + 1)
             {
                 print(OS_WARN, "no matching frame '%s' found",
-                               g_config.frame_id);
+                               conf->frame_id);
             }
         }
     }
@@ -273,28 +277,28 @@ static int modify_v2_tag(const char *filename, struct id3v2_tag *tag)
     return 0;
 }
 
-int modify_tags(const char *filename)
+int modify_tags(const struct id321_config *conf, const char *filename)
 {
     struct id3v1_tag *tag1 = NULL;
     struct id3v2_tag *tag2 = NULL;
-    struct version ver = { g_config.ver.major, NOT_SET };
+    struct version ver = { conf->ver.major, NOT_SET };
     int ret;
 
-    ret = get_tags(filename, ver, &tag1, &tag2);
+    ret = get_tags(conf, filename, ver, O_RDWR, &tag1, &tag2);
 
     if (ret != 0)
         return -EFAULT;
 
-    if (g_config.ver.major == 1 && !tag1)
+    if (conf->ver.major == 1 && !tag1)
     {
         tag1 = xcalloc(1, sizeof(struct id3v1_tag));
         tag1->version =
-            (g_config.ver.minor != NOT_SET) ? g_config.ver.minor : 3;
+            (conf->ver.minor != NOT_SET) ? conf->ver.minor : 3;
         tag1->genre_id = ID3V1_UNKNOWN_GENRE;
     }
 
-    if (tag2 && g_config.ver.major == 2 && g_config.ver.minor != NOT_SET
-        && g_config.ver.minor != tag2->header.version)
+    if (tag2 && conf->ver.major == 2 && conf->ver.minor != NOT_SET
+        && conf->ver.minor != tag2->header.version)
     {
         print(OS_ERROR, "%s: present ID3v2 tag has a different "
                         "minor version, conversion is not implemented "
@@ -304,25 +308,25 @@ int modify_tags(const char *filename)
 
         ret = -ENOSYS;
     }
-    else if ((g_config.ver.major == 2
-              || (g_config.ver.major == NOT_SET && !tag1)) && !tag2)
+    else if ((conf->ver.major == 2
+              || (conf->ver.major == NOT_SET && !tag1)) && !tag2)
     {
         tag2 = new_id3v2_tag();
 
-        if (g_config.ver.minor != NOT_SET)
-            tag2->header.version = g_config.ver.minor;
+        if (conf->ver.minor != NOT_SET)
+            tag2->header.version = conf->ver.minor;
     }
 
     if (tag1)
-        ret = modify_v1_tag(tag1);
+        ret = modify_v1_tag(conf, tag1);
 
     if (ret == 0 && tag2)
-        ret = modify_v2_tag(filename, tag2);
+        ret = modify_v2_tag(conf, filename, tag2);
 
     if (ret == 0)
-        ret = write_tags(filename, tag1, tag2);
+        ret = write_tags(conf, filename, tag1, tag2);
 
-    free(tag1);
+    xfree(tag1);
     free_id3v2_tag(tag2);
     return SUCC_OR_FAULT(ret);
 }
@@ -1,13 +1,23 @@
 #include <string.h> /* strlen(), strncmp() */
 #include "opts.h"
 #include "output.h"
-#include "params.h"
 
-int opt_ind = 1;
-char *opt_arg;
+/* each thread parses its own command lines */
+__thread int opt_ind = 1;
+__thread char *opt_arg;
 
-static int prev_opt_ind = -1;
-static unsigned prev_opt_offset = 0;
+static __thread int prev_opt_ind = -1;
+static __thread unsigned prev_opt_offset = 0;
+
+/* makes get_opt() start over with another argument vector */
+
+void reset_opt(void)
+{
+    opt_ind = 1;
+    opt_arg = NULL;
+    prev_opt_ind = -1;
+    prev_opt_offset = 0;
+}
 
 static int parse_option(int argc, char **argv,
                         const struct opt *opt, int is_long)
@@ -43,7 +53,10 @@ static int parse_option(int argc, char **argv,
     return opt->shortopt;
 }
 
-int get_opt(int argc, char **argv, const struct opt *optlist)
+/* only the options of @optlist applicable to @action are recognised */
+
+int get_opt(int argc, char **argv, const struct opt *optlist,
+            unsigned action)
 {
     char *opt;
     int is_long = 0;
@@ -79,7 +92,7 @@ int get_opt(int argc, char **argv, const struct opt *optlist)
 
         for (; optlist->shortopt; optlist++)
             if (optlist->longopt && !strncmp(opt, optlist->longopt, optlen)
-                && optlist->actions & g_config.action)
+                && optlist->actions & action)
             {
                 if (!opt_match)
                     opt_match = optlist;
@@ -99,7 +112,7 @@ int get_opt(int argc, char **argv, const struct opt *optlist)
     {
         for (; optlist->shortopt; optlist++)
             if (*opt == (char)optlist->shortopt
-                && optlist->actions & g_config.action)
+                && optlist->actions & action)
             {
                 if (opt[1] == '\0')
                     prev_opt_offset = 0;
@@ -15,9 +15,11 @@ struct opt
     unsigned          actions;
 };
 
-extern int opt_ind;
-extern char *opt_arg;
+extern __thread int opt_ind;
+extern __thread char *opt_arg;
 
-int get_opt(int argc, char **argv, const struct opt *optlist);
+void reset_opt(void);
+int get_opt(int argc, char **argv, const struct opt *optlist,
+            unsigned action);
 
 #endif /* OPTS_H */
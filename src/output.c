@@ -1,31 +1,97 @@
+#include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include <inttypes.h>
 #include "output.h"
 
-static uint16_t g_output_mask = OS_ERROR | OS_WARN;
-extern char *program_name;
+/* each thread may be given its own verbosity */
+static __thread uint16_t output_mask = OS_ERROR | OS_WARN;
+
+/* prefix of warnings and errors */
+char *program_name = "id321";
+
+/* streams the thread writes to instead of stdout and stderr, if any */
+static __thread FILE *out_stream;
+static __thread FILE *err_stream;
+
+/* whether warnings and errors of the thread are not to be printed at all */
+static __thread int is_silenced;
 
 void init_output(uint16_t mask)
 {
-    g_output_mask = mask;
+    output_mask = mask;
 }
 
-void print(output_severity sev, const char* format, ...)
+uint16_t get_output_mask(void)
 {
-    va_list ap;
-    FILE *fd = stderr;
+    return output_mask;
+}
+
+/***
+ * set_output_streams
+ *
+ * Makes the calling thread write what it would write to stdout to @out,
+ * and what it would write to stderr to @err, or restores the standard
+ * streams if they are NULL.
+ */
+
+void set_output_streams(FILE *out, FILE *err)
+{
+    out_stream = out;
+    err_stream = err;
+}
+
+/* makes the calling thread not print warnings and errors if @silence */
+
+void silence_output(int silence)
+{
+    is_silenced = silence;
+}
+
+FILE *get_out_stream(void)
+{
+    return out_stream ? out_stream : stdout;
+}
 
-    if (g_output_mask & sev)
+FILE *get_err_stream(void)
+{
+    return err_stream ? err_stream : stderr;
+}
+
+void vprint(output_severity sev, const char *format, va_list ap)
+{
+    FILE *fd = get_err_stream();
+
+    if (is_silenced && (sev & (OS_ERROR | OS_WARN)))
+        return;
+
+    if (output_mask & sev)
     {
         if (sev & (OS_INFO | OS_DEBUG))
-            fd = stdout;
+            fd = get_out_stream();
         else
             fprintf(fd, "%s: ", program_name);
 
-        va_start(ap, format);
         vfprintf(fd, format, ap);
         fprintf(fd, "\n");
-        va_end(ap);
     }
 }
+
+void print(output_severity sev, const char* format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    vprint(sev, format, ap);
+    va_end(ap);
+}
+
+/* the same as perror(), but for the stream of the calling thread */
+void print_errno(const char *str)
+{
+    if (is_silenced)
+        return;
+
+    fprintf(get_err_stream(), "%s: %s\n", str, strerror(errno));
+}
@@ -2,6 +2,8 @@
 #define OUTPUT_H
 
 #include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
 
 typedef enum {
     OS_DEBUG = 0x8,
@@ -11,6 +13,15 @@ typedef enum {
 } output_severity;
 
 void init_output(uint16_t mask);
+uint16_t get_output_mask(void);
+void set_output_streams(FILE *out, FILE *err);
+void silence_output(int silence);
+FILE *get_out_stream(void);
+FILE *get_err_stream(void);
+extern char *program_name;
+
 void print(output_severity sev, const char *format, ...);
+void vprint(output_severity sev, const char *format, va_list ap);
+void print_errno(const char *str);
 
 #endif /* OUTPUT_H */
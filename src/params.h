@@ -15,6 +15,10 @@
 #define ID321_OPT_CREATE_FRAME_IF_NOT_EXISTS 0x800
 #define ID321_OPT_ALL_FRAMES                 0x1000
 #define ID321_OPT_ALIGN_SIZE                 0x2000
+#define ID321_OPT_VERIFY_PADDING             0x4000
+#define ID321_OPT_REWRITE                    0x8000
+#define ID321_OPT_PADDING_PERCENT            0x10000
+#define ID321_OPT_NUL_DELIMITED              0x20000
 
 #define NOT_SET 255
 
@@ -25,6 +29,8 @@ enum id3_action
     ID3_DELETE = 0x4,
     ID3_SYNC   = 0x8,
     ID3_COPY   = 0x10,
+    ID3_BATCH  = 0x20,
+    ID3_SERVE  = 0x40,
 };
 
 struct version
@@ -33,11 +39,21 @@ struct version
     unsigned minor;
 };
 
+/*
+ * Everything a file is processed with. There is no global instance: each
+ * action is given the one it runs with, so files may be processed at once
+ * with different settings.
+ */
+
 struct id321_config
 {
     enum id3_action action;
     uint32_t        options;
     uint32_t        size;
+    uint32_t        padding;     /* headroom reserved when a tag grows */
+    uint32_t        padding_max;
+    unsigned        jobs;        /* files or requests processed at once */
+    const char     *socket_path; /* where requests are served */
     struct version  ver;
     const char     *default_v2_enc;
     const char     *fmtstr;
@@ -68,6 +84,6 @@ struct id321_config
     uint8_t         speed;
 };
 
-extern struct id321_config g_config;
+void init_default_config(struct id321_config *conf);
 
 #endif /* PARAMS_H */
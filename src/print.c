@@ -1,18 +1,20 @@
 #include <ctype.h>        /* isdigit() */
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "alias.h"
 #include "common.h"
-#include "params.h"       /* g_config, NOT_SET */
+#include "file.h"         /* O_TAGS_RDONLY */
+#include "params.h"       /* NOT_SET */
 #include "id3v1.h"
 #include "id3v1_genres.h"
 #include "id3v1e_speed.h"
 #include "id3v2.h"
 #include "output.h"
 #include "printfmt.h"
-#include "frames.h"       /* get_frame_data() */
+#include "frames.h"       /* get_frame_data(), get_frame_text() */
 #include "frm_trck.h"     /* get_id3v2_tag_trackno() */
 #include "framelist.h"
 #include "u32_char.h"
@@ -20,8 +22,11 @@
 
 extern void printfmt(const struct print_fmt *pf, char *str);
 extern void u32_printfmt(const struct print_fmt *pf, u32_char *ustr);
+extern void printfmt_text(const struct print_fmt *pf, const char *codeset,
+                          const char *str, size_t size, int nul_as_slash);
 
-static void print_id3v1_data(char alias, const struct id3v1_tag *tag,
+static void print_id3v1_data(const struct id321_config *conf,
+                             char alias, const struct id3v1_tag *tag,
                              struct print_fmt *pfmt)
 {
     size_t size;
@@ -36,89 +41,94 @@ static void print_id3v1_data(char alias, const struct id3v1_tag *tag,
         printfmt(pfmt, int_str);
     }
     else
-    {
-        u32_char *ustr;
-        iconv_alloc(U32_CHAR_CODESET, g_config.enc_v1,
-                    buf, strlen(buf),
-                    (void *)&ustr, NULL);
-        u32_printfmt(pfmt, ustr);
-        free(ustr);
-    }
+        printfmt_text(pfmt, conf->enc_v1, buf, strlen(buf), 0);
 }
 
-static void print_id3v1_tag_field(const char *name, const char *value)
+static void print_id3v1_tag_field(const struct id321_config *conf,
+                                  const char *name, const char *value)
 {
-    u32_char *ustr = NULL;
-
-    iconv_alloc(U32_CHAR_CODESET, g_config.enc_v1,
-                value, strlen(value),
-                (void *)&ustr, NULL);
-
-    printf("%s: ", name);
-    u32_printfmt(NULL, ustr);
-    putchar('\n');
-    free(ustr);
+    fprintf(get_out_stream(), "%s: ", name);
+    printfmt_text(NULL, conf->enc_v1, value, strlen(value), 0);
+    putc('\n', get_out_stream());
 }
 
-static void print_id3v1_tag(const struct id3v1_tag *tag)
+static void print_id3v1_tag(const struct id321_config *conf,
+                            const struct id3v1_tag *tag)
 {
     const char *genre_str = get_id3v1_genre_str(tag->genre_id);
     const char *speed_str = get_id3v1e_speed_str(tag->speed);
 
-    print_id3v1_tag_field("Title", tag->title);
-    print_id3v1_tag_field("Artist", tag->artist);
-    print_id3v1_tag_field("Album", tag->album);
-    print_id3v1_tag_field("Year", tag->year);
-    print_id3v1_tag_field("Comment", tag->comment);
-    printf("Genre: (%u) %s\n", tag->genre_id, genre_str ? genre_str : "");
+    print_id3v1_tag_field(conf, "Title", tag->title);
+    print_id3v1_tag_field(conf, "Artist", tag->artist);
+    print_id3v1_tag_field(conf, "Album", tag->album);
+    print_id3v1_tag_field(conf, "Year", tag->year);
+    print_id3v1_tag_field(conf, "Comment", tag->comment);
+    fprintf(get_out_stream(), "Genre: (%u) %s\n",
+            tag->genre_id, genre_str ? genre_str : "");
 
     if (tag->version != 0 && tag->track != '\0')
-        printf("Track no.: %u\n", tag->track);
+        fprintf(get_out_stream(), "Track no.: %u\n", tag->track);
 
     if (tag->version == 2 || tag->version == ID3V1E_MINOR)
-        print_id3v1_tag_field("Genre2", tag->genre_str);
+        print_id3v1_tag_field(conf, "Genre2", tag->genre_str);
 
     if (tag->version == ID3V1E_MINOR)
     {
-        print_id3v1_tag_field("Start time", tag->starttime);
-        print_id3v1_tag_field("End time", tag->endtime);
-        printf("Speed: (%u) %s\n", tag->speed, speed_str ? speed_str : "");
+        print_id3v1_tag_field(conf, "Start time", tag->starttime);
+        print_id3v1_tag_field(conf, "End time", tag->endtime);
+        fprintf(get_out_stream(), "Speed: (%u) %s\n",
+                tag->speed, speed_str ? speed_str : "");
     }
 }
 
-static void print_id3v2_tag(const struct id3v2_tag *tag)
+static void print_id3v2_tag(const struct id321_config *conf,
+                            const struct id3v2_tag *tag)
 {
     const struct id3v2_frame *frame;
 
-    for (frame = tag->frame_head.next;
-         frame != &tag->frame_head;
-         frame = frame->next)
+    for_each_frame(tag, frame)
     {
-        int len = get_frame_data(tag, frame, NULL, 0);
+        struct frame_text text;
+        u32_char *ustr = NULL;
+        int len = get_frame_text(conf, tag, frame, &text);
+
+        fprintf(get_out_stream(), "%.*s: ",
+                ID3V2_FRAME_ID_MAX_SIZE, frame->id);
 
-        printf("%.*s: ", ID3V2_FRAME_ID_MAX_SIZE, frame->id);
+        if (len == 0)
+        {
+            if (text.size > 0)
+                printfmt_text(NULL, text.codeset, text.data, text.size,
+                              text.is_list);
+            putc('\n', get_out_stream());
+            continue;
+        }
+        else if (len == -ENOSYS)
+            len = get_frame_data(conf, tag, frame, &ustr);
 
         if (len > 0)
         {
-            u32_char *ustr = xmalloc(sizeof(u32_char) * (len + 1));
-            get_frame_data(tag, frame, ustr, len);
-            ustr[len] = U32_CHAR('\0');
             u32_printfmt(NULL, ustr);
-            putchar('\n');
-            free(ustr);
+            putc('\n', get_out_stream());
         }
         else if (len == 0)
-            putchar('\n');
+            putc('\n', get_out_stream());
         else if (len == -ENOSYS)
-            puts("[parser for this frame is not implemented yet]");
+            fputs("[parser for this frame is not implemented yet]\n",
+                  get_out_stream());
         else if (len == -EINVAL)
-            puts("[unknown frame]");
+            fputs("[unknown frame]\n", get_out_stream());
         else if (len == -EILSEQ)
-            puts("[malformed frame]");
+            fputs("[malformed frame]\n", get_out_stream());
+        else if (len == -EFAULT)
+            fputs("[unable to read frame]\n", get_out_stream());
+
+        xfree(ustr);
     }
 }
 
-static void print_tag(const struct id3v1_tag *tag1,
+static void print_tag(const struct id321_config *conf,
+                      const struct id3v1_tag *tag1,
                       const struct id3v2_tag *tag2)
 {
     const char *pos;
@@ -130,14 +140,14 @@ static void print_tag(const struct id3v1_tag *tag1,
     } state = st_normal;
     struct print_fmt pfmt = { };
 
-    if (!g_config.fmtstr)
+    if (!conf->fmtstr)
         return;
 
     /* let's parse format string */
-    len = strlen(g_config.fmtstr);
+    len = strlen(conf->fmtstr);
 
-    for (pos = g_config.fmtstr, frame = NULL;
-         pos < g_config.fmtstr + len;
+    for (pos = conf->fmtstr, frame = NULL;
+         pos < conf->fmtstr + len;
          pos++)
     {
         switch (state)
@@ -149,18 +159,19 @@ static void print_tag(const struct id3v1_tag *tag1,
                     case '%':  memset(&pfmt, '\0', sizeof(pfmt));
                                lastspec = pos;
                                state = st_flags; break;
-                    default:   putchar(*pos);
+                    default:   putc(*pos, get_out_stream());
                 }
                 break;
 
             case st_escape:
                 switch (*pos)
                 {
-                    case 'n': putchar('\n'); break;
-                    case 'r': putchar('\r'); break;
-                    case 't': putchar('\t'); break;
-                    case '\\': putchar('\\'); break;
-                    default:  putchar('\\'); pos--; /* process it again */
+                    case 'n': putc('\n', get_out_stream()); break;
+                    case 'r': putc('\r', get_out_stream()); break;
+                    case 't': putc('\t', get_out_stream()); break;
+                    case '\\': putc('\\', get_out_stream()); break;
+                    default:  putc('\\', get_out_stream());
+                              pos--; /* process it again */
                 }
                 state = st_normal;
                 break;
@@ -207,7 +218,7 @@ static void print_tag(const struct id3v1_tag *tag1,
                     int trackno = -1;
 
                     if (tag2)
-                        trackno = get_id3v2_tag_trackno(tag2);
+                        trackno = get_id3v2_tag_trackno(conf, tag2);
 
                     if (trackno < 0 && tag1 && tag1->track != 0)
                         trackno = tag1->track;
@@ -227,41 +238,46 @@ static void print_tag(const struct id3v1_tag *tag1,
                     {
                         const char *frame_id =
                             get_frame_id_by_alias(*pos, tag2->header.version);
-                        frame = peek_frame(&tag2->frame_head, frame_id);
+                        frame = peek_frame(tag2, frame_id);
                     }
 
                     if (!frame && tag1)
-                        print_id3v1_data(*pos, tag1, &pfmt);
+                        print_id3v1_data(conf, *pos, tag1, &pfmt);
                 }
-                else if (tag2 && (pos + 2 < g_config.fmtstr + len)
+                else if (tag2 && (pos + 2 < conf->fmtstr + len)
                          && is_valid_frame_id_str(pos, 3))
                 {
                     char   local_frame_id[ID3V2_FRAME_ID_MAX_SIZE] = "\0";
-                    size_t frame_id_len = ((pos + 3 < g_config.fmtstr + len)
+                    size_t frame_id_len = ((pos + 3 < conf->fmtstr + len)
                                            && is_valid_frame_id_str(pos + 3, 1))
                                           ? 4 : 3;
 
                     strncpy(local_frame_id, pos, frame_id_len);
                     pos += frame_id_len - 1;
-                    frame = peek_frame(&tag2->frame_head, local_frame_id);
+                    frame = peek_frame(tag2, local_frame_id);
                 }
                 else if (*pos == '%' && pos - lastspec == 1)
-                    putchar('%');
+                    putc('%', get_out_stream());
                 else /* invalid format spec, so just print it as is */
-                    printf("%.*s", pos - lastspec + 1, lastspec);
+                    fprintf(get_out_stream(), "%.*s",
+                            pos - lastspec + 1, lastspec);
 
                 if (frame)
                 {
-                    int len = get_frame_data(tag2, frame, NULL, 0);
+                    struct frame_text text;
+                    u32_char *ustr = NULL;
+                    int len = get_frame_text(conf, tag2, frame, &text);
+
+                    if (len == 0 && text.size > 0)
+                        printfmt_text(&pfmt, text.codeset, text.data,
+                                      text.size, text.is_list);
+                    else if (len == -ENOSYS)
+                        len = get_frame_data(conf, tag2, frame, &ustr);
 
                     if (len > 0)
-                    {
-                        u32_char *ustr = xmalloc(sizeof(u32_char) * (len + 1));
-                        get_frame_data(tag2, frame, ustr, len);
-                        ustr[len] = U32_CHAR('\0');
                         u32_printfmt(&pfmt, ustr);
-                        free(ustr);
-                    }
+
+                    xfree(ustr);
 
                     frame = NULL;
                 }
@@ -275,19 +291,19 @@ static void print_tag(const struct id3v1_tag *tag1,
 
     switch (state)
     {
-        case st_escape: puts("\\"); break;
-        case st_normal: putchar('\n'); break;
-        default:        puts(lastspec); break;
+        case st_escape: fputs("\\\n", get_out_stream()); break;
+        case st_normal: putc('\n', get_out_stream()); break;
+        default:        fprintf(get_out_stream(), "%s\n", lastspec); break;
     }
 }
 
-int print_tags(const char *filename)
+int print_tags(const struct id321_config *conf, const char *filename)
 {
     struct id3v2_tag *tag2 = NULL;
     struct id3v1_tag *tag1 = NULL;
     int               ret;
 
-    ret = get_tags(filename, g_config.ver, &tag1, &tag2);
+    ret = get_tags(conf, filename, conf->ver, O_TAGS_RDONLY, &tag1, &tag2);
 
     if (ret != 0)
         return -EFAULT;
@@ -295,59 +311,74 @@ int print_tags(const char *filename)
     if (!tag1 && !tag2)
     {
         print(OS_WARN, "%s: file has no ID3 tags%s", filename,
-              g_config.ver.major != NOT_SET ? " of specified version" : "");
+              conf->ver.major != NOT_SET ? " of specified version" : "");
         return 0;
     }
 
-    if (g_config.fmtstr)
-        print_tag(tag1, tag2);
-    else if (g_config.frame_id)
+    if (tag2 && tag2->padding_dirty)
+        print(OS_WARN, "%s: ID3v2 tag padding contains non-zero bytes",
+              filename);
+
+    if (conf->fmtstr)
+        print_tag(conf, tag1, tag2);
+    else if (conf->frame_id)
     {
         struct id3v2_frame *frame = NULL;
 
         if (tag2)
         {
-            frame = peek_frame(&tag2->frame_head, g_config.frame_id);
+            frame = peek_frame(tag2, conf->frame_id);
 
-            if (!(g_config.options & ID321_OPT_ALL_FRAMES))
+            if (!(conf->options & ID321_OPT_ALL_FRAMES))
             {
                 int i;
-                for (i = g_config.frame_no; frame && i > 0; i--)
+                for (i = conf->frame_no; frame && i > 0; i--)
                 {
-                    frame = peek_next_frame(&tag2->frame_head,
-                            g_config.frame_id, frame);
+                    frame = peek_next_frame(tag2, conf->frame_id, frame);
                 }
             }
         }
 
         if (frame)
         {
-            if (g_config.options & ID321_OPT_ALL_FRAMES)
+            if (conf->options & ID321_OPT_ALL_FRAMES)
             {
                 while (frame)
                 {
-                    fwrite(frame->data, frame->size, 1, stdout);
-                    frame = peek_next_frame(&tag2->frame_head,
-                                            g_config.frame_id, frame);
+                    if (load_frame_data(tag2, frame) == 0)
+                        fwrite(frame->data, frame->size, 1, get_out_stream());
+                    frame = peek_next_frame(tag2, conf->frame_id, frame);
                 }
             }
-            else
-                fwrite(frame->data, frame->size, 1, stdout);
+            else if (load_frame_data(tag2, frame) == 0)
+                fwrite(frame->data, frame->size, 1, get_out_stream());
         }
         else
             print(OS_ERROR, "%s: file has no matching ID3v2 frame '%s[%d]'",
-                  filename, g_config.frame_id, g_config.frame_no);
+                  filename, conf->frame_id, conf->frame_no);
     }
     else
     {
         if (tag2)
-            print_id3v2_tag(tag2);
+        {
+            print_id3v2_tag(conf, tag2);
+
+            if (conf->options & ID321_OPT_VERIFY_PADDING)
+            {
+                unsigned waste = tag2->header.size
+                    ? (uint64_t)tag2->padding * 100 / tag2->header.size : 0;
+
+                fprintf(get_out_stream(),
+                        "Padding: %" PRIu32 " bytes (%u%% of the tag)\n",
+                        tag2->padding, waste);
+            }
+        }
 
         if (tag1)
-            print_id3v1_tag(tag1);
+            print_id3v1_tag(conf, tag1);
     }
 
-    free(tag1);
+    xfree(tag1);
     free_id3v2_tag(tag2);
 
     return 0;
@@ -1,38 +1,35 @@
+#include <stdint.h>   /* SIZE_MAX */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "common.h"
+#include "output.h"
 #include "printfmt.h"
+#include "transcode.h"
 #include "u32_char.h"
+#include "xalloc.h"
 
 static inline void print_padding(char ch, size_t len)
 {
     for (; len > 0; len--)
-        putchar(ch);
+        putc(ch, get_out_stream());
 }
 
+static const struct print_fmt default_pf = {}; /* to use when @pf is NULL */
+
 /***
- * printfmt_gen - prints string @str using format from @pf
+ * print_leading_padding
  *
- * @pf - pointer to format struct
- * @str - char or u32_char string
- * @is_u32 - kind of string @str is pointed to
+ * Prints the padding which precedes the string of *@len characters to be
+ * printed using format from @pf, and cuts *@len down to the precision.
  *
- * The function can be called with @pf pointing to NULL. In this case default
- * format is used.
+ * Returns the number of characters the string takes with zero padding.
  */
 
-static void printfmt_gen(const struct print_fmt *pf, void *str, int is_u32)
+static int print_leading_padding(const struct print_fmt *pf, size_t *len)
 {
-    size_t len = is_u32 ? u32_strlen(str) : strlen(str);
-    int precision;
-    int actlen = len;
-    static const struct print_fmt default_pf = {}; /* to use when @pf is NULL */
-
-    if (!pf)
-        pf = &default_pf;
-
-    precision = pf->precision;
+    int precision = pf->precision;
+    int actlen = *len;
 
     if (pf->flags & FL_INT)
     {
@@ -40,20 +37,50 @@ static void printfmt_gen(const struct print_fmt *pf, void *str, int is_u32)
             && !(pf->flags & FL_LEFT))
             precision = pf->width;
 
-        actlen = len > precision ? len : precision;
+        actlen = *len > precision ? *len : precision;
     }
-    else if ((pf->flags & FL_PREC) && precision < len)
-        actlen = len = precision;
+    else if ((pf->flags & FL_PREC) && precision < *len)
+        actlen = *len = precision;
 
     if (pf->width > actlen && !(pf->flags & FL_LEFT))
         print_padding(' ', pf->width - actlen);
 
-    if ((pf->flags & FL_INT) && precision > len)
-        print_padding('0', precision - len);
+    if ((pf->flags & FL_INT) && precision > *len)
+        print_padding('0', precision - *len);
+
+    return actlen;
+}
+
+static void print_trailing_padding(const struct print_fmt *pf, int actlen)
+{
+    if (pf->width > actlen && (pf->flags & FL_LEFT))
+        print_padding(' ', pf->width - actlen);
+}
+
+/***
+ * printfmt_gen - prints string @str using format from @pf
+ *
+ * @pf - pointer to format struct
+ * @str - char or u32_char string
+ * @is_u32 - kind of string @str is pointed to
+ *
+ * The function can be called with @pf pointing to NULL. In this case default
+ * format is used.
+ */
+
+static void printfmt_gen(const struct print_fmt *pf, void *str, int is_u32)
+{
+    size_t len = is_u32 ? u32_strlen(str) : strlen(str);
+    int actlen;
+
+    if (!pf)
+        pf = &default_pf;
+
+    actlen = print_leading_padding(pf, &len);
 
     if (!is_u32)
     {
-        printf("%.*s", len, (char *)str);
+        fprintf(get_out_stream(), "%.*s", len, (char *)str);
     }
     else
     {
@@ -64,12 +91,11 @@ static void printfmt_gen(const struct print_fmt *pf, void *str, int is_u32)
                     (const char *)str, len * sizeof(u32_char),
                     &buf, &size);
 
-        printf("%.*s", size, buf);
-        free(buf);
+        fprintf(get_out_stream(), "%.*s", size, buf);
+        xfree(buf);
     }
 
-    if (pf->width > actlen && (pf->flags & FL_LEFT))
-        print_padding(' ', pf->width - actlen);
+    print_trailing_padding(pf, actlen);
 }
 
 void printfmt(const struct print_fmt *pf, char *str)
@@ -81,3 +107,83 @@ void u32_printfmt(const struct print_fmt *pf, u32_char *ustr)
 {
     printfmt_gen(pf, ustr, 1);
 }
+
+/* prints @size bytes of @buf, null characters as '/' if @nul_as_slash */
+static void print_bytes(const char *buf, size_t size, int nul_as_slash)
+{
+    const char *nul;
+
+    while (nul_as_slash && (nul = memchr(buf, '\0', size)) != NULL)
+    {
+        fwrite(buf, 1, nul - buf, get_out_stream());
+        putc('/', get_out_stream());
+        size -= nul - buf + 1;
+        buf = nul + 1;
+    }
+
+    fwrite(buf, 1, size, get_out_stream());
+}
+
+/* prints text converted to u32_char string the way get_frame_data() does */
+static void u32_printfmt_text(const struct print_fmt *pf, const char *codeset,
+                              const char *str, size_t size, int nul_as_slash)
+{
+    u32_char *ustr;
+    size_t len = iconv_u32_alloc(codeset, str, size, &ustr);
+    size_t i;
+
+    for (i = 0; nul_as_slash && i < len; i++)
+        if (ustr[i] == U32_CHAR('\0'))
+            ustr[i] = U32_CHAR('/');
+
+    u32_printfmt(pf, ustr);
+    xfree(ustr);
+}
+
+/***
+ * printfmt_text - prints text of @size bytes in @codeset using format
+ * from @pf
+ *
+ * The text is printed up to the first null character, or as a whole with
+ * null characters printed as '/' if @nul_as_slash is set.
+ *
+ * Text in codesets known to transcode.c is measured in place, and then
+ * converted to the locale encoding at once, or printed as is if it is the
+ * same in that encoding. Other text and malformed text are printed via
+ * u32_char string, so that what iconv cannot convert becomes '?'.
+ */
+
+void printfmt_text(const struct print_fmt *pf, const char *codeset,
+                   const char *str, size_t size, int nul_as_slash)
+{
+    const char *locale = locale_encoding();
+    struct text_span span;
+    char *buf = NULL;
+    size_t len;
+    int actlen;
+
+    if (!pf)
+        pf = &default_pf;
+
+    if (measure_text(codeset, str, size,
+                     (pf->flags & FL_PREC) ? pf->precision : SIZE_MAX,
+                     !nul_as_slash, &span) != 0)
+    {
+        u32_printfmt_text(pf, codeset, str, size, nul_as_slash);
+        return;
+    }
+
+    len = span.chars;
+    actlen = print_leading_padding(pf, &len);
+    size = span.bytes;
+
+    if (size > 0 && !is_same_text(locale, codeset, span.is_ascii))
+    {
+        iconv_alloc(locale, codeset, str, size, &buf, &size);
+        str = buf;
+    }
+
+    print_bytes(str, size, nul_as_slash);
+    xfree(buf);
+    print_trailing_padding(pf, actlen);
+}
@@ -0,0 +1,725 @@
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "arena.h"
+#include "batch.h"
+#include "common.h"     /* close_iconv_cache() */
+#include "output.h"
+#include "params.h"
+#include "xalloc.h"
+
+extern void reserve_stdin(void);
+
+/*
+ * In serve mode id321 listens on a Unix domain socket, and takes
+ * null-delimited commands on each connection, which are replied to on the
+ * connection as in batch mode. The main thread waits for the connections
+ * to have data, reads the commands from them, and queues each command for
+ * a fixed pool of threads, each of which keeps its arena and iconv cache
+ * from one command to another. A connection is not read from while its
+ * command is being run, so its commands are replied to in order, and one
+ * which has sent no command for IDLE_TIMEOUT seconds is closed. A command
+ * changing a file waits until no other command is using the file, and a
+ * command reading a file waits until no other command is changing it, the
+ * files being told apart by their inodes.
+ */
+
+/* the most connections served at once, others wait to be accepted */
+#define MAX_CONNECTIONS 256
+
+/* the seconds a connection may stay without a command */
+#define IDLE_TIMEOUT 60
+
+/* the longest command taken, in bytes */
+#define MAX_COMMAND_SIZE (1024 * 1024)
+
+struct connection
+{
+    int     fd;
+    FILE   *out;        /* where the commands are replied to */
+    char   *buf;        /* what has been read and not run yet */
+    size_t  size;
+    size_t  max_size;
+    size_t  cmd_size;   /* the size of the command being run, if any */
+    int     is_busy;    /* its command is queued or being run */
+    int     is_over;    /* nothing more is to be read from it */
+    int     is_closing; /* it is to be closed rather than read from */
+    time_t  last_used;  /* when a command has been read or replied to */
+};
+
+struct inode
+{
+    dev_t    dev;
+    ino_t    ino;
+    unsigned readers;   /* commands reading the file */
+    unsigned writers;   /* commands changing the file */
+};
+
+struct server
+{
+    struct connection *queue[MAX_CONNECTIONS]; /* a ring of connections
+                                                * with commands to run */
+    size_t           first;
+    size_t           count;
+    int              is_stopping;
+    int              wake[2];   /* a pipe threads wake the main one with */
+    struct inode    *inodes;    /* the inodes in use */
+    size_t           inode_count;
+    size_t           max_inodes;
+    pthread_mutex_t  lock;
+    pthread_cond_t   queued;    /* signalled when a command is queued */
+    pthread_cond_t   released;  /* signalled when inodes are released */
+};
+
+static struct server server;
+
+
+static volatile sig_atomic_t is_interrupted;
+
+static void interrupt(int sig)
+{
+    is_interrupted = 1;
+}
+
+static struct inode *find_inode(dev_t dev, ino_t ino)
+{
+    size_t i;
+
+    for (i = 0; i < server.inode_count; i++)
+        if (server.inodes[i].dev == dev && server.inodes[i].ino == ino)
+            return &server.inodes[i];
+
+    return NULL;
+}
+
+/* returns non-zero if none of @count inodes @files is in the way */
+
+static int are_inodes_free(const struct stat *files, size_t count,
+                           int is_write)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        struct inode *inode;
+
+        if (files[i].st_ino == 0)
+            continue;
+
+        inode = find_inode(files[i].st_dev, files[i].st_ino);
+
+        if (inode && (inode->writers > 0 || (is_write && inode->readers > 0)))
+            return 0;
+    }
+
+    return 1;
+}
+
+/***
+ * acquire_inodes
+ *
+ * Waits until none of @count inodes @files is changed by another command,
+ * or used at all if @is_write is non-zero, and then takes them. All the
+ * inodes are taken at once, so that commands cannot wait for each other.
+ * Inodes with zero st_ino are not taken, i.e. those of files which do not
+ * exist.
+ */
+
+static void acquire_inodes(const struct stat *files, size_t count,
+                           int is_write)
+{
+    size_t i;
+
+    pthread_mutex_lock(&server.lock);
+
+    while (!are_inodes_free(files, count, is_write))
+        pthread_cond_wait(&server.released, &server.lock);
+
+    for (i = 0; i < count; i++)
+    {
+        struct inode *inode;
+
+        if (files[i].st_ino == 0)
+            continue;
+
+        inode = find_inode(files[i].st_dev, files[i].st_ino);
+
+        if (!inode)
+        {
+            if (server.inode_count == server.max_inodes)
+            {
+                server.max_inodes = server.max_inodes * 2 + 16;
+                server.inodes = xrealloc(server.inodes,
+                                         server.max_inodes
+                                         * sizeof(struct inode));
+            }
+
+            inode = &server.inodes[server.inode_count++];
+            inode->dev = files[i].st_dev;
+            inode->ino = files[i].st_ino;
+            inode->readers = inode->writers = 0;
+        }
+
+        if (is_write)
+            inode->writers++;
+        else
+            inode->readers++;
+    }
+
+    pthread_mutex_unlock(&server.lock);
+}
+
+static void release_inodes(const struct stat *files, size_t count,
+                           int is_write)
+{
+    size_t i;
+
+    pthread_mutex_lock(&server.lock);
+
+    for (i = 0; i < count; i++)
+    {
+        struct inode *inode;
+
+        if (files[i].st_ino == 0)
+            continue;
+
+        inode = find_inode(files[i].st_dev, files[i].st_ino);
+
+        if (is_write)
+            inode->writers--;
+        else
+            inode->readers--;
+
+        if (inode->readers == 0 && inode->writers == 0)
+            *inode = server.inodes[--server.inode_count];
+    }
+
+    pthread_cond_broadcast(&server.released);
+    pthread_mutex_unlock(&server.lock);
+}
+
+/***
+ * run_served_action
+ *
+ * Performs the action of @conf on @argc files @argv as run_action() does,
+ * once no other command is in the way. The files are processed one by one,
+ * since it is the threads of the server that requests are spread over.
+ */
+
+static int run_served_action(const struct id321_config *conf,
+                             int argc, char **argv, struct arena *arena)
+{
+    struct id321_config serial = *conf;
+    struct stat *files = xcalloc(argc, sizeof(struct stat));
+    int is_write = (conf->action != ID3_PRINT);
+    int ret;
+    int i;
+
+    for (i = 0; i < argc; i++)
+        if (stat(argv[i], &files[i]) != 0)
+            files[i].st_ino = 0;
+
+    serial.jobs = 1;
+
+    acquire_inodes(files, argc, is_write);
+    ret = run_action(&serial, argc, argv, arena);
+    release_inodes(files, argc, is_write);
+
+    xfree(files);
+
+    return ret;
+}
+
+
+static time_t get_time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec;
+}
+
+/* runs the command of @conn, which is null-delimited words ended by an
+ * empty word, and replies to it */
+
+static void serve_command(struct connection *conn, struct arena *arena)
+{
+    char **argv = xmalloc((conn->cmd_size + 1) * sizeof(char *));
+    size_t argc = 0;
+    size_t pos;
+
+    argv[argc++] = program_name;
+
+    for (pos = 0; conn->buf[pos] != '\0'; pos += strlen(conn->buf + pos) + 1)
+        argv[argc++] = conn->buf + pos;
+
+    argv[argc] = NULL;
+
+    run_command(argc, argv, run_served_action, arena, conn->out);
+
+    xfree(argv);
+}
+
+static void *run_server_thread(void *arg)
+{
+    struct arena *arena = new_arena();
+
+    for (;;)
+    {
+        struct connection *conn;
+        int is_failed;
+
+        pthread_mutex_lock(&server.lock);
+        while (server.count == 0 && !server.is_stopping)
+            pthread_cond_wait(&server.queued, &server.lock);
+
+        if (server.is_stopping)
+        {
+            pthread_mutex_unlock(&server.lock);
+            break;
+        }
+
+        conn = server.queue[server.first];
+        server.first = (server.first + 1) % MAX_CONNECTIONS;
+        server.count--;
+        pthread_mutex_unlock(&server.lock);
+
+        serve_command(conn, arena);
+
+        /* the client has gone or does not read its replies */
+        is_failed = ferror(conn->out);
+
+        pthread_mutex_lock(&server.lock);
+        conn->is_busy = 0;
+        conn->is_closing |= is_failed;
+        pthread_mutex_unlock(&server.lock);
+
+        /* the main thread is to read the next command of the connection */
+        write(server.wake[1], "", 1);
+    }
+
+    free_arena(arena);
+    close_iconv_cache();
+
+    return NULL;
+}
+
+static struct connection *accept_connection(int fd)
+{
+    struct connection *conn;
+    struct timeval timeout = { IDLE_TIMEOUT, 0 };
+    int conn_fd = accept(fd, NULL, NULL);
+    int out_fd;
+
+    if (conn_fd < 0)
+        return NULL;
+
+    out_fd = dup(conn_fd);
+    conn = xcalloc(1, sizeof(struct connection));
+    conn->fd = conn_fd;
+    conn->out = (out_fd >= 0) ? fdopen(out_fd, "w") : NULL;
+    conn->last_used = get_time();
+
+    if (!conn->out)
+    {
+        if (out_fd >= 0)
+            close(out_fd);
+        close(conn_fd);
+        xfree(conn);
+        return NULL;
+    }
+
+    /* a client which does not read its replies is not to hold a thread */
+    setsockopt(conn_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    return conn;
+}
+
+static void close_connection(struct connection *conn)
+{
+    fclose(conn->out);
+    close(conn->fd);
+    xfree(conn->buf);
+    xfree(conn);
+}
+
+/* reads what @conn has got, which it has been polled for */
+
+static void read_connection(struct connection *conn)
+{
+    ssize_t len;
+
+    if (conn->size == conn->max_size)
+    {
+        conn->max_size = conn->max_size ? conn->max_size * 2 : 4096;
+        conn->buf = xrealloc(conn->buf, conn->max_size);
+    }
+
+    len = read(conn->fd, conn->buf + conn->size, conn->max_size - conn->size);
+
+    if (len > 0)
+    {
+        conn->size += len;
+        return;
+    }
+
+    conn->is_over = 1;
+
+    /* the last word may be not terminated at the end of the connection */
+    if (len == 0 && conn->size > 0)
+    {
+        if (conn->size + 2 > conn->max_size)
+        {
+            conn->max_size = conn->size + 2;
+            conn->buf = xrealloc(conn->buf, conn->max_size);
+        }
+
+        if (conn->buf[conn->size - 1] != '\0')
+            conn->buf[conn->size++] = '\0';
+        conn->buf[conn->size++] = '\0';
+    }
+    else if (len < 0)
+        conn->is_closing = 1;
+}
+
+/* returns the size of the first command read from @conn, or 0 if it has
+ * not been read as a whole yet */
+
+static size_t find_command(const struct connection *conn)
+{
+    size_t pos = 0;
+
+    while (pos < conn->size)
+    {
+        const char *end = memchr(conn->buf + pos, '\0', conn->size - pos);
+
+        if (!end)
+            break;
+
+        /* the empty word ending the command */
+        if (end == conn->buf + pos)
+            return pos + 1;
+
+        pos = end - conn->buf + 1;
+    }
+
+    return 0;
+}
+
+/***
+ * dispatch_command
+ *
+ * Drops the command of @conn which has just been replied to, if any, and
+ * queues the next one, if it has been read. Empty commands are dropped
+ * without a reply, as they are in batch mode.
+ *
+ * Returns 1 if a command has been queued, 0 if there is none to queue yet,
+ * or -1 if @conn is to be closed.
+ */
+
+static int dispatch_command(struct connection *conn)
+{
+    size_t size;
+
+    if (conn->cmd_size > 0)
+    {
+        conn->size -= conn->cmd_size;
+        memmove(conn->buf, conn->buf + conn->cmd_size, conn->size);
+        conn->cmd_size = 0;
+        conn->last_used = get_time();
+    }
+
+    if (conn->is_closing)
+        return -1;
+
+    while ((size = find_command(conn)) == 1)
+        memmove(conn->buf, conn->buf + 1, --conn->size);
+
+    if (size == 0)
+        return (conn->is_over || conn->size >= MAX_COMMAND_SIZE) ? -1 : 0;
+
+    conn->cmd_size = size;
+    conn->last_used = get_time();
+
+    pthread_mutex_lock(&server.lock);
+    conn->is_busy = 1;
+    server.queue[(server.first + server.count) % MAX_CONNECTIONS] = conn;
+    server.count++;
+    pthread_cond_signal(&server.queued);
+    pthread_mutex_unlock(&server.lock);
+
+    return 1;
+}
+
+/* returns non-zero if somebody is listening on @addr */
+
+static int is_listened(const struct sockaddr_un *addr)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    int ret;
+
+    if (fd < 0)
+        return 1;
+
+    ret = connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0
+          || errno != ECONNREFUSED;
+    close(fd);
+
+    return ret;
+}
+
+/***
+ * open_server_socket
+ *
+ * Creates a socket listening on @path. If there is a socket at @path which
+ * nobody listens on, as one left by a server which has not exited cleanly,
+ * it is replaced.
+ *
+ * Returns the socket on success, or -1 on error with errno set.
+ */
+
+static int open_server_socket(const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd;
+    int ret;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0)
+        return -1;
+
+    ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+
+    if (ret != 0 && errno == EADDRINUSE
+        && lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)
+        && !is_listened(&addr))
+    {
+        unlink(path);
+        ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    }
+
+    if (ret != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        int err = errno;
+
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    return fd;
+}
+
+/***
+ * run_serve
+ *
+ * Serves commands on the socket of @conf by up to @conf->jobs threads
+ * until SIGINT or SIGTERM is received. Once it is, no more commands are
+ * taken, and the connections are closed as soon as the commands being run
+ * are done.
+ *
+ * Returns 0 on success, or -1 if the socket cannot be served.
+ */
+
+int run_serve(const struct id321_config *conf)
+{
+    struct connection *conns[MAX_CONNECTIONS];
+    struct connection *polled[MAX_CONNECTIONS];
+    struct pollfd fds[MAX_CONNECTIONS + 2];
+    size_t conn_count = 0;
+    struct sigaction sa;
+    sigset_t sigs;
+    sigset_t oldsigs;
+    pthread_t *tids;
+    unsigned started;
+    int fd;
+
+    fd = open_server_socket(conf->socket_path);
+
+    if (fd < 0 || pipe(server.wake) != 0)
+    {
+        print(OS_ERROR, "%s: %s", conf->socket_path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    /* a connection may be gone by the time it is accepted, and the threads
+     * are not to wait for the main one to read the pipe */
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(server.wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(server.wake[1], F_SETFL, O_NONBLOCK);
+
+    /* the signals are only delivered while the main thread waits in
+     * ppoll(), so that none of them is lost before it does */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = interrupt;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    /* a client may go away before it is replied to */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* the commands of clients are not to take frame data from stdin */
+    reserve_stdin();
+
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.queued, NULL);
+    pthread_cond_init(&server.released, NULL);
+
+    tids = xmalloc(conf->jobs * sizeof(pthread_t));
+
+    /* the threads are created with the signals blocked */
+    for (started = 0; started < conf->jobs; started++)
+        if (pthread_create(&tids[started], NULL, run_server_thread,
+                           NULL) != 0)
+            break;
+
+    if (started == 0)
+        print(OS_ERROR, "unable to start any thread");
+
+    while (started > 0 && !is_interrupted)
+    {
+        struct timespec timeout = { IDLE_TIMEOUT, 0 };
+        size_t count = 0;
+        size_t nfds = 1;
+        size_t first_polled;
+        int is_accepting = (conn_count < MAX_CONNECTIONS);
+        time_t now = get_time();
+        size_t k;
+        char c;
+
+        /* the pipe only tells that some connections have been replied to */
+        while (read(server.wake[0], &c, 1) == 1)
+            ;
+
+        fds[0].fd = server.wake[0];
+        fds[0].events = POLLIN;
+
+        if (is_accepting)
+        {
+            fds[nfds].fd = fd;
+            fds[nfds++].events = POLLIN;
+        }
+
+        first_polled = nfds;
+
+        for (k = 0; k < conn_count;)
+        {
+            struct connection *conn = conns[k];
+            int is_busy;
+            int ret;
+
+            pthread_mutex_lock(&server.lock);
+            is_busy = conn->is_busy;
+            pthread_mutex_unlock(&server.lock);
+
+            ret = is_busy ? 1 : dispatch_command(conn);
+
+            if (ret < 0
+                || (ret == 0 && now - conn->last_used >= IDLE_TIMEOUT))
+            {
+                close_connection(conn);
+                conns[k] = conns[--conn_count];
+                continue;
+            }
+
+            if (ret == 0)
+            {
+                /* only the connections waited for may time out */
+                if (conn->last_used + IDLE_TIMEOUT - now < timeout.tv_sec)
+                    timeout.tv_sec = conn->last_used + IDLE_TIMEOUT - now;
+
+                polled[count++] = conn;
+                fds[nfds].fd = conn->fd;
+                fds[nfds++].events = POLLIN;
+            }
+
+            k++;
+        }
+
+        if (ppoll(fds, nfds, count > 0 ? &timeout : NULL, &oldsigs) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            print(OS_ERROR, "%s: %s", conf->socket_path, strerror(errno));
+            break;
+        }
+
+        for (k = 0; k < count; k++)
+            if (fds[first_polled + k].revents)
+                read_connection(polled[k]);
+
+        if (is_accepting && fds[1].revents)
+        {
+            struct connection *conn = accept_connection(fd);
+
+            if (conn)
+                conns[conn_count++] = conn;
+            else if (errno != EAGAIN && errno != EWOULDBLOCK
+                     && errno != ECONNABORTED && errno != EINTR)
+            {
+                print(OS_ERROR, "%s: %s", conf->socket_path,
+                      strerror(errno));
+                break;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&server.lock);
+    server.is_stopping = 1;
+    pthread_cond_broadcast(&server.queued);
+    pthread_mutex_unlock(&server.lock);
+
+    while (started > 0)
+        pthread_join(tids[--started], NULL);
+
+    pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+
+    /* the commands queued and not taken are dropped */
+    while (conn_count > 0)
+        close_connection(conns[--conn_count]);
+
+    close(server.wake[0]);
+    close(server.wake[1]);
+    close(fd);
+    unlink(conf->socket_path);
+
+    pthread_cond_destroy(&server.released);
+    pthread_cond_destroy(&server.queued);
+    pthread_mutex_destroy(&server.lock);
+    xfree(server.inodes);
+    xfree(tids);
+
+    return is_interrupted ? 0 : -1;
+}
@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>        /* O_RDWR */
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -20,7 +21,9 @@
 #include "u32_char.h"
 #include "xalloc.h"
 
-static int sync_v1_with_v2(struct id3v1_tag *tag1, const struct id3v2_tag *tag2)
+static int sync_v1_with_v2(const struct id321_config *conf,
+                           struct id3v1_tag *tag1,
+                           const struct id3v2_tag *tag2)
 {
     const char fields[] = "taly";
     const char *field_alias;
@@ -31,12 +34,12 @@ static int sync_v1_with_v2(struct id3v1_tag *tag1, const struct id3v2_tag *tag2)
     for (field_alias = fields; *field_alias != '\0'; field_alias++)
     {
         frame_id = get_frame_id_by_alias(*field_alias, tag2->header.version);
-        frame = peek_frame(&tag2->frame_head, frame_id);
+        frame = peek_frame(tag2, frame_id);
 
-        if (frame && frame->size > 1)
+        if (frame && frame->size > 1 && load_frame_data(tag2, frame) == 0)
         {
             const char *frame_enc_name =
-                get_id3v2_tag_encoding_name(tag2->header.version,
+                get_id3v2_tag_encoding_name(conf, tag2->header.version,
                                             frame->data[0]);
             if (frame_enc_name)
             {
@@ -45,7 +48,7 @@ static int sync_v1_with_v2(struct id3v1_tag *tag1, const struct id3v2_tag *tag2)
                                                    &field_size);
 
                 memset(field, '\0', field_size);
-                iconvordie(g_config.enc_v1, frame_enc_name,
+                iconvordie(conf->enc_v1, frame_enc_name,
                         frame->data + 1, frame->size - 1,
                         field, field_size - 1);
             }
@@ -55,21 +58,22 @@ static int sync_v1_with_v2(struct id3v1_tag *tag1, const struct id3v2_tag *tag2)
     /* sync comment - use a first comment frame */
     {
         frame_id = get_frame_id_by_alias('c', tag2->header.version);
-        frame = peek_frame(&tag2->frame_head, frame_id);
+        frame = peek_frame(tag2, frame_id);
 
-        if (frame)
+        if (frame && load_frame_data(tag2, frame) == 0)
         {
             int ret;
             struct id3v2_frm_comm *comm;
 
-            ret = unpack_id3v2_frm_comm(frame, tag2->header.version, &comm);
+            ret = unpack_id3v2_frm_comm(conf, frame, tag2->header.version,
+                                        &comm);
 
             if (ret == 0)
             {
                 if (comm->utext)
                 {
                     memset(tag1->comment, '\0', sizeof(tag1->comment));
-                    iconvordie(g_config.enc_v1, U32_CHAR_CODESET,
+                    iconvordie(conf->enc_v1, U32_CHAR_CODESET,
                                (char *)comm->utext,
                                u32_strlen(comm->utext) * sizeof(u32_char),
                                tag1->comment, sizeof(tag1->comment) - 1);
@@ -82,7 +86,7 @@ static int sync_v1_with_v2(struct id3v1_tag *tag1, const struct id3v2_tag *tag2)
 
     /* sync track number */
     {
-        int trackno = get_id3v2_tag_trackno(tag2);
+        int trackno = get_id3v2_tag_trackno(conf, tag2);
 
         if (trackno >= 0 && trackno <= 255)
             tag1->track = trackno;
@@ -97,7 +101,7 @@ static int sync_v1_with_v2(struct id3v1_tag *tag1, const struct id3v2_tag *tag2)
     /* sync genre_id and genre_str */
     {
         u32_char *genre_ustr = NULL;
-        int genre_id = get_id3v2_tag_genre(tag2, &genre_ustr);
+        int genre_id = get_id3v2_tag_genre(conf, tag2, &genre_ustr);
 
         if (genre_id >= 0)
         {
@@ -106,11 +110,11 @@ static int sync_v1_with_v2(struct id3v1_tag *tag1, const struct id3v2_tag *tag2)
             if (genre_ustr)
             {
                 memset(tag1->genre_str, '\0', sizeof(tag1->genre_str));
-                iconvordie(g_config.enc_v1, U32_CHAR_CODESET,
+                iconvordie(conf->enc_v1, U32_CHAR_CODESET,
                            (char *)genre_ustr,
                            u32_strlen(genre_ustr)*sizeof(u32_char),
                            tag1->genre_str, sizeof(tag1->genre_str) - 1);
-                free(genre_ustr);
+                xfree(genre_ustr);
             }
         }
         else if (genre_id == -EILSEQ)
@@ -146,7 +150,9 @@ static int32_t get_v1e_timestamp(const char *timestamp)
     return minutes*60 + seconds;
 }
 
-static int sync_v2_with_v1(struct id3v2_tag *tag2, const struct id3v1_tag *tag1)
+static int sync_v2_with_v1(const struct id321_config *conf,
+                           struct id3v2_tag *tag2,
+                           const struct id3v1_tag *tag1)
 {
     char        trackno[4] = "\0"; /* as maximum byte value is 255 */
     int32_t     time;
@@ -178,7 +184,7 @@ static int sync_v2_with_v1(struct id3v2_tag *tag2, const struct id3v1_tag *tag1)
         frame_id = get_frame_id_by_alias(*field_alias, tag2->header.version);
 
         int ret = update_id3v2_tag_text_frame(
-                tag2, frame_id, g_config.enc_v1,
+                conf, tag2, frame_id, conf->enc_v1,
                 field_data, field_data_sz);
 
         if (ret != 0)
@@ -192,12 +198,12 @@ static int sync_v2_with_v1(struct id3v2_tag *tag2, const struct id3v1_tag *tag1)
         int ret;
         u32_char *utext;
 
-        iconv_alloc(U32_CHAR_CODESET, g_config.enc_v1,
+        iconv_alloc(U32_CHAR_CODESET, conf->enc_v1,
                     tag1->comment, strlen(tag1->comment),
                     (void *)&utext, NULL);
 
-        ret = update_id3v2_frm_comm(tag2, "XXX", U32_EMPTY_STR, utext);
-        free(utext);
+        ret = update_id3v2_frm_comm(conf, tag2, "XXX", U32_EMPTY_STR, utext);
+        xfree(utext);
 
         if (ret != 0)
             return ret;
@@ -209,13 +215,13 @@ static int sync_v2_with_v1(struct id3v2_tag *tag2, const struct id3v1_tag *tag1)
 
         if (!IS_EMPTY_STR(tag1->genre_str))
         {
-            iconv_alloc(U32_CHAR_CODESET, g_config.enc_v1,
+            iconv_alloc(U32_CHAR_CODESET, conf->enc_v1,
                         tag1->genre_str, strlen(tag1->genre_str),
                         (void *)&genre_ustr, NULL);
         }
 
-        int ret = set_id3v2_tag_genre(tag2, tag1->genre_id, genre_ustr);
-        free(genre_ustr);
+        int ret = set_id3v2_tag_genre(conf, tag2, tag1->genre_id, genre_ustr);
+        xfree(genre_ustr);
 
         if (ret != 0)
             return ret;
@@ -235,19 +241,19 @@ static int sync_v2_with_v1(struct id3v2_tag *tag2, const struct id3v1_tag *tag1)
     return 0;
 }
 
-int sync_tags(const char *filename)
+int sync_tags(const struct id321_config *conf, const char *filename)
 {
     struct id3v1_tag *tag1 = NULL;
     struct id3v2_tag *tag2 = NULL;
     struct version    ver = { NOT_SET, NOT_SET };
     int               ret;
 
-    ret = get_tags(filename, ver, &tag1, &tag2);
+    ret = get_tags(conf, filename, ver, O_RDWR, &tag1, &tag2);
 
     if (ret != 0)
         return -EFAULT;
 
-    if (g_config.ver.major == 1)
+    if (conf->ver.major == 1)
     {
         if (!tag2)
         {
@@ -264,20 +270,21 @@ int sync_tags(const char *filename)
                 tag1->genre_id = ID3V1_UNKNOWN_GENRE;
             }
 
-            if (g_config.ver.minor != NOT_SET)
-                tag1->version = g_config.ver.minor;
+            if (conf->ver.minor != NOT_SET)
+                tag1->version = conf->ver.minor;
 
-            ret = sync_v1_with_v2(tag1, tag2);
+            ret = sync_v1_with_v2(conf, tag1, tag2);
 
             if (ret == 0)
             {
-                bool refresh_v2_tag = g_config.options &
+                bool refresh_v2_tag = conf->options &
                     (ID321_OPT_CHANGE_SIZE | ID321_OPT_UNSYNC);
-                ret = write_tags(filename, tag1, refresh_v2_tag ? tag2 : NULL);
+                ret = write_tags(conf, filename, tag1,
+                                 refresh_v2_tag ? tag2 : NULL);
             }
         }
     }
-    else if (g_config.ver.major == 2)
+    else if (conf->ver.major == 2)
     {
         if (!tag1)
         {
@@ -291,11 +298,11 @@ int sync_tags(const char *filename)
             {
                 tag2 = new_id3v2_tag();
 
-                if (g_config.ver.minor != NOT_SET)
-                    tag2->header.version = g_config.ver.minor;
+                if (conf->ver.minor != NOT_SET)
+                    tag2->header.version = conf->ver.minor;
             }
-            else if (g_config.ver.minor != tag2->header.version &&
-                     g_config.ver.minor != NOT_SET)
+            else if (conf->ver.minor != tag2->header.version &&
+                     conf->ver.minor != NOT_SET)
             {
                 print(OS_ERROR, "%s: present ID3v2 tag has a different "
                                 "minor version, conversion is not implemented "
@@ -308,15 +315,15 @@ int sync_tags(const char *filename)
 
             if (ret == 0)
             {
-                ret = sync_v2_with_v1(tag2, tag1);
+                ret = sync_v2_with_v1(conf, tag2, tag1);
 
                 if (ret == 0)
-                    ret = write_tags(filename, NULL, tag2);
+                    ret = write_tags(conf, filename, NULL, tag2);
             }
         }
     }
 
-    free(tag1);
+    xfree(tag1);
     free_id3v2_tag(tag2);
     return SUCC_OR_FAULT(ret);
 }
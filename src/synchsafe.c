@@ -1,5 +1,8 @@
 #include <inttypes.h>   /* uint32_t */
 #include <stddef.h>     /* size_t */
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 #include "synchsafe.h"  /* ss_uint32_t */
 
 ss_uint32_t unsync_uint32(uint32_t src)
@@ -40,6 +43,59 @@ uint32_t deunsync_uint32(ss_uint32_t src)
     return res;
 }
 
+/*
+ * Both unsync_buf() and deunsync_buf() look for 0xFF bytes sixteen at a
+ * time with SSE2 compares when the compiler targets it, and only blocks
+ * which actually need fixing up are processed one byte at a time. Such
+ * blocks are rare in real tags, so the rest is a plain copy.
+ */
+
+/* the width of an SSE2 vector, not the I/O block of common.h */
+#define VEC_SIZE 16
+
+/* tells whether 0xFF followed by @next (or by @post at the end of the
+ * buffer, see unsync_buf()) needs a zero byte inserted after it */
+static int needs_unsync(const unsigned char *src, size_t srcsize, size_t i,
+                        unsigned char post)
+{
+    unsigned char next = (i + 1 < srcsize) ? src[i + 1] : post;
+
+    return src[i] == 0xFF
+           && (post == 0x00 || (next & 0xE0) == 0xE0 || next == 0x00);
+}
+
+#ifdef __SSE2__
+/* returns the mask of bytes of @src which need unsynchronisation, there
+ * shall be at least one more byte past the block */
+static unsigned unsync_mask(const unsigned char *src, unsigned char post)
+{
+    __m128i cur = _mm_loadu_si128((const __m128i *)src);
+    __m128i next = _mm_loadu_si128((const __m128i *)(src + 1));
+    __m128i ff = _mm_cmpeq_epi8(cur, _mm_set1_epi8((char)0xFF));
+
+    if (post != 0x00)
+    {
+        __m128i top = _mm_set1_epi8((char)0xE0);
+        __m128i high = _mm_cmpeq_epi8(_mm_max_epu8(next, top), next);
+        __m128i zero = _mm_cmpeq_epi8(next, _mm_setzero_si128());
+
+        ff = _mm_and_si128(ff, _mm_or_si128(high, zero));
+    }
+
+    return _mm_movemask_epi8(ff);
+}
+#endif
+
+/* stores @c at offset *@pos of @dst unless it is beyond @dstsize, so that
+ * the output is truncated but still counted */
+static void put_byte(char *dst, size_t dstsize, size_t *pos, char c)
+{
+    if (*pos < dstsize)
+        dst[*pos] = c;
+
+    (*pos)++;
+}
+
 /***
  * unsync_buf - unsynchronise buffer
  *
@@ -47,6 +103,9 @@ uint32_t deunsync_uint32(ss_uint32_t src)
  * a result to the buffer @dst of size @dstsize. It may be called with
  * @dstsize == 0 to estimate the necessary destination buffer size.
  *
+ * The last byte of @src is unsynchronised as if it was followed by @post.
+ * Note that if @post is a zero byte, every 0xFF byte is unsynchronised.
+ *
  * Returns the size of the unsynchronised buffer, if it is greater than
  * @dstsize the value in @dst is truncated.
  */
@@ -54,57 +113,112 @@ uint32_t deunsync_uint32(ss_uint32_t src)
 size_t unsync_buf(char *dst, size_t dstsize,
                   const char *src, size_t srcsize, char post)
 {
-    size_t ressize = dstsize;
+    const unsigned char *in = (const unsigned char *)src;
+    size_t pos = 0; /* offset in the unsynchronised buffer */
+    size_t i = 0;
 
-    for (; srcsize > 0 && dstsize > 0; src++, dst++, srcsize--, dstsize--)
+#ifdef __SSE2__
+    for (; srcsize - i > VEC_SIZE; i += VEC_SIZE)
     {
-        *dst = *src;
+        unsigned mask = unsync_mask(in + i, (unsigned char)post);
+        size_t j;
 
-        if (*src == '\xFF' &&
-            (srcsize > 1 && ((*(src+1) & '\xE0') == '\xE0' || *(src+1) == '\0')
-             || srcsize == 1 && (post & '\xE0') == '\xE0' || post == '\0'))
+        if (pos >= dstsize)
+        {
+            /* just estimate required buffer size */
+            pos += VEC_SIZE + __builtin_popcount(mask);
+        }
+        else if (!mask && dstsize - pos >= VEC_SIZE)
+        {
+            _mm_storeu_si128((__m128i *)(dst + pos),
+                             _mm_loadu_si128((const __m128i *)(in + i)));
+            pos += VEC_SIZE;
+        }
+        else
         {
-            if (dstsize > 1)
+            for (j = 0; j < VEC_SIZE; j++, mask >>= 1)
             {
-                *++dst = '\0';
-                dstsize--;
+                put_byte(dst, dstsize, &pos, src[i + j]);
+
+                if (mask & 1)
+                    put_byte(dst, dstsize, &pos, '\0');
             }
-            else
-                ressize++;
         }
     }
+#endif
+
+    for (; i < srcsize; i++)
+    {
+        put_byte(dst, dstsize, &pos, src[i]);
 
-    /* just estimate required buffer size */
-    for (ressize += srcsize; srcsize > 0; src++, srcsize--)
-        if (*src == '\xFF' &&
-            (srcsize > 1 && ((*(src+1) & '\xE0') == '\xE0' || *(src+1) == '\0')
-             || srcsize == 1 && (post & '\xE0') == '\xE0' || post == '\0'))
-            ressize++;
+        if (needs_unsync(in, srcsize, i, (unsigned char)post))
+            put_byte(dst, dstsize, &pos, '\0');
+    }
 
-    return ressize - dstsize;
+    return pos;
 }
 
+/***
+ * deunsync_buf - deunsynchronise buffer in place
+ *
+ * Removes every zero byte which follows 0xFF from the buffer @buf of size
+ * @size. The first byte of @buf is considered to follow @pre.
+ *
+ * Returns the size of the deunsynchronised buffer.
+ */
+
 size_t deunsync_buf(char *buf, size_t size, char pre)
 {
-    char *wrptr = buf;
-    size_t origsize = size;
+    unsigned char *ptr = (unsigned char *)buf;
+    unsigned char prev = pre;
+    size_t wr = 0;
+    size_t rd = 0;
 
-    /* checking precondition */
-    if (pre == '\xFF' && size > 0 && *buf == '\0')
-    {
-        buf++;
-        size--;
-    }
+    /* bytes are only moved backwards, so each one is read before it may
+     * be overwritten */
+#ifdef __SSE2__
+    if (size > 0 && !(ptr[0] == 0x00 && prev == 0xFF))
+        ptr[wr++] = ptr[0];
 
     if (size > 0)
+        prev = ptr[rd++];
+
+    for (; size - rd >= VEC_SIZE; rd += VEC_SIZE)
     {
-        *wrptr++ = *buf++;
-        size--;
+        __m128i cur = _mm_loadu_si128((const __m128i *)(ptr + rd));
+        __m128i before = _mm_loadu_si128((const __m128i *)(ptr + rd - 1));
+        unsigned mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(cur, _mm_setzero_si128()),
+                          _mm_cmpeq_epi8(before, _mm_set1_epi8((char)0xFF))));
+
+        prev = ptr[rd + VEC_SIZE - 1];
+
+        if (!mask)
+        {
+            _mm_storeu_si128((__m128i *)(ptr + wr), cur);
+            wr += VEC_SIZE;
+        }
+        else
+        {
+            unsigned char block[VEC_SIZE];
+            size_t j;
+
+            _mm_storeu_si128((__m128i *)block, cur);
+
+            for (j = 0; j < VEC_SIZE; j++, mask >>= 1)
+                if (!(mask & 1))
+                    ptr[wr++] = block[j];
+        }
     }
+#endif
 
-    for (; size > 0; buf++, size--)
-        if (*(buf-1) != '\xFF' || *buf != '\0')
-            *wrptr++ = *buf;
+    for (; rd < size; rd++)
+    {
+        if (!(ptr[rd] == 0x00 && prev == 0xFF))
+            ptr[wr++] = ptr[rd];
+
+        prev = ptr[rd];
+    }
 
-    return origsize - (buf - wrptr);
+    return wr;
 }
@@ -13,4 +13,9 @@ size_t deunsync_buf(char *buf, size_t size, char pre);
 size_t unsync_buf(char *dst, size_t dstsize,
                   const char *src, size_t srcsize, char post);
 
+/* unsync_buf() unsynchronises every 0xFF byte if the byte after buffer
+ * is a null byte, so when a stream is unsynchronised piece by piece, 0xFF
+ * is passed instead, which makes the last byte be unsynchronised likewise */
+#define UNSYNC_POST(next) ((next) == '\0' ? '\xFF' : (next))
+
 #endif /* SYNCHSAFE_H */
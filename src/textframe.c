@@ -14,39 +14,41 @@
 /***
  * get_id3v2_tag_encoding - gets v2 tag frame encoding name by encoding byte
  *
+ * @conf - configuration which maps the encodings to iconv codesets
  * @minor - v2 tag minor version
  * @enc - encoding byte
  *
  * Returns string with encoding name on success, or NULL on error.
  */
 
-const char *get_id3v2_tag_encoding_name(unsigned minor, char enc)
+const char *get_id3v2_tag_encoding_name(const struct id321_config *conf,
+                                        unsigned minor, char enc)
 {
     switch (minor)
     {
         case 2:
             switch (enc)
             {
-                case ID3V22_STR_ISO88591: return g_config.enc_iso8859_1;
-                case ID3V22_STR_UCS2:     return g_config.enc_ucs2;
+                case ID3V22_STR_ISO88591: return conf->enc_iso8859_1;
+                case ID3V22_STR_UCS2:     return conf->enc_ucs2;
             }
             break;
 
         case 3:
             switch (enc)
             {
-                case ID3V23_STR_ISO88591: return g_config.enc_iso8859_1;
-                case ID3V23_STR_UCS2:     return g_config.enc_ucs2;
+                case ID3V23_STR_ISO88591: return conf->enc_iso8859_1;
+                case ID3V23_STR_UCS2:     return conf->enc_ucs2;
             }
             break;
 
         case 4:
             switch (enc)
             {
-                case ID3V24_STR_ISO88591: return g_config.enc_iso8859_1;
-                case ID3V24_STR_UTF16:    return g_config.enc_utf16;
-                case ID3V24_STR_UTF16BE:  return g_config.enc_utf16be;
-                case ID3V24_STR_UTF8:     return g_config.enc_utf8;
+                case ID3V24_STR_ISO88591: return conf->enc_iso8859_1;
+                case ID3V24_STR_UTF16:    return conf->enc_utf16;
+                case ID3V24_STR_UTF16BE:  return conf->enc_utf16be;
+                case ID3V24_STR_UTF8:     return conf->enc_utf8;
             }
             break;
 
@@ -101,7 +103,8 @@ char get_id3v2_tag_encoding_byte(unsigned minor, const char *enc_name)
     return ID3V2_UNSUPPORTED_ENCODING;
 }
 
-char get_id3v2_frame_encoding(uint8_t minor, const char *standard_encoding,
+char get_id3v2_frame_encoding(const struct id321_config *conf,
+                              uint8_t minor, const char *standard_encoding,
                               const char **actual_encoding)
 {
     if (!standard_encoding)
@@ -116,7 +119,8 @@ char get_id3v2_frame_encoding(uint8_t minor, const char *standard_encoding,
     }
     else
     {
-        *actual_encoding = get_id3v2_tag_encoding_name(minor, frame_enc_byte);
+        *actual_encoding =
+            get_id3v2_tag_encoding_name(conf, minor, frame_enc_byte);
     }
 
     return frame_enc_byte;
@@ -126,11 +130,11 @@ void update_id3v2_tag_text_frame_payload(struct id3v2_frame *frame,
                                          char frame_enc_byte,
                                          const char *data, size_t size)
 {
-    free(frame->data);
-    frame->size = size + 1;
-    frame->data = xmalloc(frame->size);
-    frame->data[0] = frame_enc_byte;
-    memcpy(frame->data + 1, data, size);
+    char *payload = xmalloc(size + 1);
+
+    payload[0] = frame_enc_byte;
+    memcpy(payload + 1, data, size);
+    attach_frame_data(frame, payload, size + 1);
 }
 
 static void update_id3v2_tag_text_frame_raw(struct id3v2_tag *tag,
@@ -138,19 +142,21 @@ static void update_id3v2_tag_text_frame_raw(struct id3v2_tag *tag,
                                             char frame_enc_byte,
                                             const char *data, size_t size)
 {
-    struct id3v2_frame *frame = peek_frame(&tag->frame_head, frame_id);
+    struct id3v2_frame *frame = peek_frame(tag, frame_id);
 
     if (!frame)
     {
-        frame = xcalloc(1, sizeof(struct id3v2_frame));
-        strncpy(frame->id, frame_id, ID3V2_FRAME_ID_MAX_SIZE);
-        append_frame(&tag->frame_head, frame);
+        struct id3v2_frame new_frame = { 0 };
+
+        strncpy(new_frame.id, frame_id, ID3V2_FRAME_ID_MAX_SIZE);
+        frame = append_frame(tag, &new_frame);
     }
 
     update_id3v2_tag_text_frame_payload(frame, frame_enc_byte, data, size);
 }
 
-int update_id3v2_tag_text_frame(struct id3v2_tag *tag,
+int update_id3v2_tag_text_frame(const struct id321_config *conf,
+                                struct id3v2_tag *tag,
                                 const char *frame_id,
                                 const char *encoding,
                                 const char *data, size_t size)
@@ -166,10 +172,10 @@ int update_id3v2_tag_text_frame(struct id3v2_tag *tag,
     if (nr_errors != 0)
     {
         /* Data contains characters outside ASCII range. */
-        free(frame_data);
+        xfree(frame_data);
         const char *tgt_encoding;
-        frame_enc_byte = get_id3v2_frame_encoding(tag->header.version,
-                                                  g_config.default_v2_enc,
+        frame_enc_byte = get_id3v2_frame_encoding(conf, tag->header.version,
+                                                  conf->default_v2_enc,
                                                   &tgt_encoding);
 
         if (frame_enc_byte == ID3V2_UNSUPPORTED_ENCODING)
@@ -183,15 +189,16 @@ int update_id3v2_tag_text_frame(struct id3v2_tag *tag,
     update_id3v2_tag_text_frame_raw(tag, frame_id, frame_enc_byte,
                                     frame_data, frame_data_sz);
 
-    free(frame_data);
+    xfree(frame_data);
     return 0;
 }
 
-int get_text_frame_data_by_alias(const struct id3v2_tag *tag, char alias,
+int get_text_frame_data_by_alias(const struct id321_config *conf,
+                                 const struct id3v2_tag *tag, char alias,
                                  u32_char **udata, size_t *udatasize)
 {
     const char *frame_id = get_frame_id_by_alias(alias, tag->header.version);
-    struct id3v2_frame *frame = peek_frame(&tag->frame_head, frame_id);
+    struct id3v2_frame *frame = peek_frame(tag, frame_id);
     const char *frame_enc_name;
 
     if (!frame)
@@ -200,8 +207,12 @@ int get_text_frame_data_by_alias(const struct id3v2_tag *tag, char alias,
     if (frame->size <= 1)
         return -EILSEQ;
 
+    if (load_frame_data(tag, frame) != 0)
+        return -EFAULT;
+
     frame_enc_name =
-        get_id3v2_tag_encoding_name(tag->header.version, frame->data[0]);
+        get_id3v2_tag_encoding_name(conf, tag->header.version,
+                                    frame->data[0]);
 
     if (!frame_enc_name)
         return -EILSEQ;
@@ -0,0 +1,937 @@
+#include <config.h>  /* WORDS_BIGENDIAN */
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+#include "common.h"  /* for_each() */
+#include "transcode.h"
+
+/*
+ * Native transcoders for the encodings ID3 tags are made of, so that
+ * iconv is only needed for codesets given by the user (e.g. CP1251 for
+ * ID3v1 tags). They behave as iconv() does: a conversion stops at the
+ * first invalid or unconvertible character, which is left in the input,
+ * and errno is set to EILSEQ, EINVAL or E2BIG respectively.
+ *
+ * Each conversion takes the longest run of characters at the current
+ * input position which map to the output trivially (e.g. ASCII characters
+ * of UTF-8, or UTF-16 units outside surrogates) with a vector kernel, and
+ * the following characters one by one, and so forth. Kernels are SSE2 or
+ * AVX2 when the compiler targets them, and scalar loops otherwise.
+ */
+
+#ifdef WORDS_BIGENDIAN
+#define NATIVE_BE 1
+#else
+#define NATIVE_BE 0
+#endif
+
+/* number of characters converted one by one before trying a kernel again */
+#define SCALAR_RUN 16
+
+static const struct
+{
+    const char *name;  /* upper case, without '-' and '_' */
+    enum native_codeset codeset;
+}
+codesets[] =
+{
+    { "ASCII",        NC_ASCII   },
+    { "USASCII",      NC_ASCII   },
+    { "ANSIX3.41968", NC_ASCII   },
+    { "ISO88591",     NC_LATIN1  },
+    { "LATIN1",       NC_LATIN1  },
+    { "UTF8",         NC_UTF8    },
+    { "UTF16",        NC_UTF16   },
+    { "UTF16LE",      NC_UTF16LE },
+    { "UTF16BE",      NC_UTF16BE },
+    { "UCS2",         NC_UCS2    },
+#ifdef WORDS_BIGENDIAN
+    { "UCS4BE",       NC_UTF32   },
+    { "UTF32BE",      NC_UTF32   },
+#else
+    { "UCS4LE",       NC_UTF32   },
+    { "UTF32LE",      NC_UTF32   },
+#endif
+};
+
+static enum native_codeset lookup_codeset(const char *name)
+{
+    char norm[16];
+    size_t len = 0;
+    size_t i;
+
+    for (; *name; name++)
+    {
+        if (*name == '-' || *name == '_')
+            continue;
+
+        if (len == sizeof(norm) - 1)
+            return NC_NONE;
+
+        norm[len++] = toupper((unsigned char)*name);
+    }
+
+    norm[len] = '\0';
+
+    for_each (i, codesets)
+        if (!strcmp(codesets[i].name, norm))
+            return codesets[i].codeset;
+
+    return NC_NONE;
+}
+
+/***
+ * open_transcoder
+ *
+ * Sets up @tc to convert from @fromcode to @tocode.
+ *
+ * Returns 0 on success, or -EINVAL if either codeset is not supported.
+ * Note that UTF-16 and UCS-2 are only supported as targets, the byte
+ * order of the source must be resolved by the caller.
+ */
+
+int open_transcoder(struct transcoder *tc,
+                    const char *tocode, const char *fromcode)
+{
+    tc->from = lookup_codeset(fromcode);
+    tc->to = lookup_codeset(tocode);
+    tc->bom_pos = 0;
+
+    if (tc->from == NC_NONE || tc->from == NC_UTF16 || tc->from == NC_UCS2
+        || tc->to == NC_NONE)
+        return -EINVAL;
+
+    return 0;
+}
+
+static int is_big_endian(enum native_codeset cs)
+{
+    return cs == NC_UTF16BE
+           || ((cs == NC_UTF16 || cs == NC_UCS2) && NATIVE_BE);
+}
+
+static uint32_t get16(const uint8_t *ptr, int be)
+{
+    return be ? (uint32_t)ptr[0] << 8 | ptr[1]
+              : (uint32_t)ptr[1] << 8 | ptr[0];
+}
+
+static void put16(uint8_t *ptr, uint32_t unit, int be)
+{
+    ptr[!be] = unit >> 8;
+    ptr[be] = unit & 0xFF;
+}
+
+static uint32_t get32(const uint8_t *ptr)
+{
+    uint32_t c;
+
+    memcpy(&c, ptr, sizeof(c));
+    return c;
+}
+
+static void put32(uint8_t *ptr, uint32_t c)
+{
+    memcpy(ptr, &c, sizeof(c));
+}
+
+static int is_8bit(enum native_codeset cs)
+{
+    return cs == NC_ASCII || cs == NC_LATIN1 || cs == NC_UTF8;
+}
+
+#define IS_SURROGATE(c) ((c) >= 0xD800 && (c) <= 0xDFFF)
+
+static int decode_utf8(const uint8_t *ptr, size_t size,
+                       uint32_t *c, size_t *len)
+{
+    uint32_t min;
+    size_t need;
+    size_t i;
+
+    if (ptr[0] < 0x80)
+    {
+        *c = ptr[0];
+        *len = 1;
+        return 0;
+    }
+    else if (ptr[0] < 0xC2)
+        return -EILSEQ;
+    else if (ptr[0] < 0xE0)
+    {
+        *c = ptr[0] & 0x1F;
+        need = 1;
+        min = 0x80;
+    }
+    else if (ptr[0] < 0xF0)
+    {
+        *c = ptr[0] & 0x0F;
+        need = 2;
+        min = 0x800;
+    }
+    else if (ptr[0] < 0xF5)
+    {
+        *c = ptr[0] & 0x07;
+        need = 3;
+        min = 0x10000;
+    }
+    else
+        return -EILSEQ;
+
+    for (i = 1; i <= need; i++)
+    {
+        if (i == size)
+            return -EINVAL;
+
+        if ((ptr[i] & 0xC0) != 0x80)
+            return -EILSEQ;
+
+        *c = (*c << 6) | (ptr[i] & 0x3F);
+    }
+
+    if (*c < min || IS_SURROGATE(*c) || *c > 0x10FFFF)
+        return -EILSEQ;
+
+    *len = need + 1;
+    return 0;
+}
+
+static int decode_utf16(const uint8_t *ptr, size_t size, int be,
+                        uint32_t *c, size_t *len)
+{
+    uint32_t hi;
+    uint32_t lo;
+
+    if (size < 2)
+        return -EINVAL;
+
+    hi = get16(ptr, be);
+
+    if (!IS_SURROGATE(hi))
+    {
+        *c = hi;
+        *len = 2;
+        return 0;
+    }
+    else if (hi >= 0xDC00)
+        return -EILSEQ;
+    else if (size < 4)
+        return -EINVAL;
+
+    lo = get16(ptr + 2, be);
+
+    if (lo < 0xDC00 || lo > 0xDFFF)
+        return -EILSEQ;
+
+    *c = 0x10000 + ((hi - 0xD800) << 10) + (lo - 0xDC00);
+    *len = 4;
+    return 0;
+}
+
+/***
+ * decode_char
+ *
+ * Returns 0 on success, -EILSEQ if the character at @ptr is invalid, or
+ * -EINVAL if it is incomplete.
+ */
+
+static int decode_char(enum native_codeset cs, const uint8_t *ptr,
+                       size_t size, uint32_t *c, size_t *len)
+{
+    switch (cs)
+    {
+        case NC_ASCII:
+            if (ptr[0] >= 0x80)
+                return -EILSEQ;
+            /* fall through */
+        case NC_LATIN1:
+            *c = ptr[0];
+            *len = 1;
+            return 0;
+        case NC_UTF8:
+            return decode_utf8(ptr, size, c, len);
+        case NC_UTF32:
+            if (size < 4)
+                return -EINVAL;
+            *c = get32(ptr);
+            *len = 4;
+            return 0;
+        default:
+            return decode_utf16(ptr, size, is_big_endian(cs), c, len);
+    }
+}
+
+/***
+ * encode_char
+ *
+ * Returns 0 on success, -EILSEQ if @c cannot be represented in @cs, or
+ * -E2BIG if there is no room for it. As with iconv, lack of room for the
+ * shortest character of @cs takes precedence.
+ */
+
+static int encode_char(enum native_codeset cs, uint32_t c,
+                       uint8_t *ptr, size_t size, size_t *len)
+{
+    int be;
+
+    if (size < (is_8bit(cs) ? 1 : cs == NC_UTF32 ? 4 : 2))
+        return -E2BIG;
+
+    switch (cs)
+    {
+        case NC_ASCII:
+        case NC_LATIN1:
+            if (c > (cs == NC_ASCII ? 0x7F : 0xFF))
+                return -EILSEQ;
+            ptr[0] = c;
+            *len = 1;
+            return 0;
+
+        case NC_UTF8:
+            if (IS_SURROGATE(c) || c > 0x10FFFF)
+                return -EILSEQ;
+
+            *len = (c < 0x80) ? 1 : (c < 0x800) ? 2 : (c < 0x10000) ? 3 : 4;
+
+            if (size < *len)
+                return -E2BIG;
+
+            switch (*len)
+            {
+                case 1:
+                    ptr[0] = c;
+                    break;
+                case 2:
+                    ptr[0] = 0xC0 | (c >> 6);
+                    ptr[1] = 0x80 | (c & 0x3F);
+                    break;
+                case 3:
+                    ptr[0] = 0xE0 | (c >> 12);
+                    ptr[1] = 0x80 | ((c >> 6) & 0x3F);
+                    ptr[2] = 0x80 | (c & 0x3F);
+                    break;
+                default:
+                    ptr[0] = 0xF0 | (c >> 18);
+                    ptr[1] = 0x80 | ((c >> 12) & 0x3F);
+                    ptr[2] = 0x80 | ((c >> 6) & 0x3F);
+                    ptr[3] = 0x80 | (c & 0x3F);
+            }
+            return 0;
+
+        case NC_UTF32:
+            put32(ptr, c);
+            *len = 4;
+            return 0;
+
+        default:
+            if (IS_SURROGATE(c) || c > (cs == NC_UCS2 ? 0xFFFF : 0x10FFFF))
+                return -EILSEQ;
+
+            be = is_big_endian(cs);
+            *len = (c < 0x10000) ? 2 : 4;
+
+            if (size < *len)
+                return -E2BIG;
+
+            if (c < 0x10000)
+                put16(ptr, c, be);
+            else
+            {
+                put16(ptr, 0xD800 + ((c - 0x10000) >> 10), be);
+                put16(ptr + 2, 0xDC00 + ((c - 0x10000) & 0x3FF), be);
+            }
+            return 0;
+    }
+}
+
+#ifdef __SSE2__
+static __m128i swap16(__m128i v)
+{
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+/* tells whether any 16-bit lane of @v is a surrogate */
+static int has_surrogate16(__m128i v)
+{
+    __m128i top = _mm_and_si128(v, _mm_set1_epi16((short)0xF800));
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi16(top,
+                                             _mm_set1_epi16((short)0xD800)));
+}
+#endif
+
+/* 8-bit characters up to @limit to UTF-32 */
+static void widen_8_32(const uint8_t **inp, const uint8_t *inend,
+                       uint8_t **outp, uint8_t *outend, uint32_t limit)
+{
+    const uint8_t *in = *inp;
+    uint8_t *out = *outp;
+
+#ifdef __AVX2__
+    while (inend - in >= 32 && outend - out >= 128)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)in);
+        int i;
+
+        if (limit < 0xFF && _mm256_movemask_epi8(v))
+            break;
+
+        for (i = 0; i < 4; i++)
+        {
+            __m128i part = _mm_loadl_epi64((const __m128i *)(in + 8 * i));
+
+            _mm256_storeu_si256((__m256i *)out + i,
+                                _mm256_cvtepu8_epi32(part));
+        }
+
+        in += 32;
+        out += 128;
+    }
+#endif
+#ifdef __SSE2__
+    while (inend - in >= 16 && outend - out >= 64)
+    {
+        __m128i zero = _mm_setzero_si128();
+        __m128i v = _mm_loadu_si128((const __m128i *)in);
+        __m128i lo, hi;
+
+        if (limit < 0xFF && _mm_movemask_epi8(v))
+            break;
+
+        lo = _mm_unpacklo_epi8(v, zero);
+        hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128((__m128i *)out + 1, _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128((__m128i *)out + 2, _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128((__m128i *)out + 3, _mm_unpackhi_epi16(hi, zero));
+
+        in += 16;
+        out += 64;
+    }
+#endif
+    for (; in < inend && outend - out >= 4 && *in <= limit; in++, out += 4)
+        put32(out, *in);
+
+    *inp = in;
+    *outp = out;
+}
+
+/* UTF-32 characters up to @limit to 8-bit ones */
+static void narrow_32_8(const uint8_t **inp, const uint8_t *inend,
+                        uint8_t **outp, uint8_t *outend, uint32_t limit)
+{
+    const uint8_t *in = *inp;
+    uint8_t *out = *outp;
+
+#ifdef __SSE2__
+    while (inend - in >= 64 && outend - out >= 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)in);
+        __m128i b = _mm_loadu_si128((const __m128i *)in + 1);
+        __m128i c = _mm_loadu_si128((const __m128i *)in + 2);
+        __m128i d = _mm_loadu_si128((const __m128i *)in + 3);
+        __m128i high = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+
+        high = _mm_and_si128(high, _mm_set1_epi32((int)~limit));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, _mm_setzero_si128()))
+            != 0xFFFF)
+            break;
+
+        _mm_storeu_si128((__m128i *)out,
+                         _mm_packus_epi16(_mm_packs_epi32(a, b),
+                                          _mm_packs_epi32(c, d)));
+        in += 64;
+        out += 16;
+    }
+#endif
+    for (; inend - in >= 4 && out < outend && get32(in) <= limit;
+         in += 4, out++)
+        *out = get32(in);
+
+    *inp = in;
+    *outp = out;
+}
+
+/* UTF-16 units outside surrogates to UTF-32 */
+static void widen_16_32(const uint8_t **inp, const uint8_t *inend,
+                        uint8_t **outp, uint8_t *outend, int be)
+{
+    const uint8_t *in = *inp;
+    uint8_t *out = *outp;
+
+#ifdef __AVX2__
+    while (inend - in >= 32 && outend - out >= 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)in);
+        __m128i b = _mm_loadu_si128((const __m128i *)in + 1);
+
+        if (be)
+        {
+            a = swap16(a);
+            b = swap16(b);
+        }
+
+        if (has_surrogate16(a) || has_surrogate16(b))
+            break;
+
+        _mm256_storeu_si256((__m256i *)out, _mm256_cvtepu16_epi32(a));
+        _mm256_storeu_si256((__m256i *)out + 1, _mm256_cvtepu16_epi32(b));
+        in += 32;
+        out += 64;
+    }
+#endif
+#ifdef __SSE2__
+    while (inend - in >= 16 && outend - out >= 32)
+    {
+        __m128i zero = _mm_setzero_si128();
+        __m128i v = _mm_loadu_si128((const __m128i *)in);
+
+        if (be)
+            v = swap16(v);
+
+        if (has_surrogate16(v))
+            break;
+
+        _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi16(v, zero));
+        _mm_storeu_si128((__m128i *)out + 1, _mm_unpackhi_epi16(v, zero));
+        in += 16;
+        out += 32;
+    }
+#endif
+    for (; inend - in >= 2 && outend - out >= 4 && !IS_SURROGATE(get16(in, be));
+         in += 2, out += 4)
+        put32(out, get16(in, be));
+
+    *inp = in;
+    *outp = out;
+}
+
+/* UTF-32 characters of the Basic Multilingual Plane to UTF-16 */
+static void narrow_32_16(const uint8_t **inp, const uint8_t *inend,
+                         uint8_t **outp, uint8_t *outend, int be)
+{
+    const uint8_t *in = *inp;
+    uint8_t *out = *outp;
+    uint32_t c;
+
+#ifdef __SSE2__
+    while (inend - in >= 32 && outend - out >= 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)in);
+        __m128i b = _mm_loadu_si128((const __m128i *)in + 1);
+        __m128i high = _mm_and_si128(_mm_or_si128(a, b),
+                                     _mm_set1_epi32((int)0xFFFF0000));
+        __m128i bias = _mm_set1_epi32(0x8000);
+        __m128i v;
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, _mm_setzero_si128()))
+            != 0xFFFF)
+            break;
+
+        /* values are biased to fit into signed saturation of packs */
+        v = _mm_packs_epi32(_mm_sub_epi32(a, bias), _mm_sub_epi32(b, bias));
+        v = _mm_add_epi16(v, _mm_set1_epi16((short)0x8000));
+
+        if (has_surrogate16(v))
+            break;
+
+        if (be)
+            v = swap16(v);
+
+        _mm_storeu_si128((__m128i *)out, v);
+        in += 32;
+        out += 16;
+    }
+#endif
+    for (; inend - in >= 4 && outend - out >= 2; in += 4, out += 2)
+    {
+        c = get32(in);
+
+        if (c > 0xFFFF || IS_SURROGATE(c))
+            break;
+
+        put16(out, c, be);
+    }
+
+    *inp = in;
+    *outp = out;
+}
+
+/* 8-bit characters up to @limit to UTF-16 */
+static void widen_8_16(const uint8_t **inp, const uint8_t *inend,
+                       uint8_t **outp, uint8_t *outend,
+                       uint32_t limit, int be)
+{
+    const uint8_t *in = *inp;
+    uint8_t *out = *outp;
+
+#ifdef __SSE2__
+    while (inend - in >= 16 && outend - out >= 32)
+    {
+        __m128i zero = _mm_setzero_si128();
+        __m128i v = _mm_loadu_si128((const __m128i *)in);
+
+        if (limit < 0xFF && _mm_movemask_epi8(v))
+            break;
+
+        if (be)
+        {
+            _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi8(zero, v));
+            _mm_storeu_si128((__m128i *)out + 1, _mm_unpackhi_epi8(zero, v));
+        }
+        else
+        {
+            _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi8(v, zero));
+            _mm_storeu_si128((__m128i *)out + 1, _mm_unpackhi_epi8(v, zero));
+        }
+
+        in += 16;
+        out += 32;
+    }
+#endif
+    for (; in < inend && outend - out >= 2 && *in <= limit; in++, out += 2)
+        put16(out, *in, be);
+
+    *inp = in;
+    *outp = out;
+}
+
+/* UTF-16 units up to @limit to 8-bit characters */
+static void narrow_16_8(const uint8_t **inp, const uint8_t *inend,
+                        uint8_t **outp, uint8_t *outend,
+                        uint32_t limit, int be)
+{
+    const uint8_t *in = *inp;
+    uint8_t *out = *outp;
+
+#ifdef __SSE2__
+    while (inend - in >= 32 && outend - out >= 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)in);
+        __m128i b = _mm_loadu_si128((const __m128i *)in + 1);
+        __m128i high;
+
+        if (be)
+        {
+            a = swap16(a);
+            b = swap16(b);
+        }
+
+        high = _mm_and_si128(_mm_or_si128(a, b),
+                             _mm_set1_epi16((short)(~limit & 0xFFFF)));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128()))
+            != 0xFFFF)
+            break;
+
+        _mm_storeu_si128((__m128i *)out, _mm_packus_epi16(a, b));
+        in += 32;
+        out += 16;
+    }
+#endif
+    for (; inend - in >= 2 && out < outend && get16(in, be) <= limit;
+         in += 2, out++)
+        *out = get16(in, be);
+
+    *inp = in;
+    *outp = out;
+}
+
+/* 8-bit characters up to @limit to the same ones */
+static void copy_8(const uint8_t **inp, const uint8_t *inend,
+                   uint8_t **outp, uint8_t *outend, uint32_t limit)
+{
+    const uint8_t *in = *inp;
+    uint8_t *out = *outp;
+
+#ifdef __SSE2__
+    while (inend - in >= 16 && outend - out >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)in);
+
+        if (limit < 0xFF && _mm_movemask_epi8(v))
+            break;
+
+        _mm_storeu_si128((__m128i *)out, v);
+        in += 16;
+        out += 16;
+    }
+#endif
+    for (; in < inend && out < outend && *in <= limit; in++, out++)
+        *out = *in;
+
+    *inp = in;
+    *outp = out;
+}
+
+/* the largest character of 8-bit @cs which is encoded as a single byte */
+static uint32_t single_byte_limit(enum native_codeset cs)
+{
+    return cs == NC_LATIN1 ? 0xFF : 0x7F;
+}
+
+static void run_kernel(const struct transcoder *tc,
+                       const uint8_t **in, const uint8_t *inend,
+                       uint8_t **out, uint8_t *outend)
+{
+    uint32_t limit;
+
+    if (is_8bit(tc->from))
+    {
+        limit = single_byte_limit(tc->from);
+
+        if (tc->to == NC_UTF32)
+            widen_8_32(in, inend, out, outend, limit);
+        else if (is_8bit(tc->to))
+        {
+            if (single_byte_limit(tc->to) < limit)
+                limit = single_byte_limit(tc->to);
+            copy_8(in, inend, out, outend, limit);
+        }
+        else
+            widen_8_16(in, inend, out, outend, limit, is_big_endian(tc->to));
+    }
+    else if (tc->from == NC_UTF32)
+    {
+        if (is_8bit(tc->to))
+            narrow_32_8(in, inend, out, outend, single_byte_limit(tc->to));
+        else if (tc->to != NC_UTF32)
+            narrow_32_16(in, inend, out, outend, is_big_endian(tc->to));
+    }
+    else
+    {
+        if (tc->to == NC_UTF32)
+            widen_16_32(in, inend, out, outend, is_big_endian(tc->from));
+        else if (is_8bit(tc->to))
+            narrow_16_8(in, inend, out, outend, single_byte_limit(tc->to),
+                        is_big_endian(tc->from));
+    }
+}
+
+#define BOM_SIZE 2
+
+static int is_bom_pending(const struct transcoder *tc)
+{
+    return (tc->to == NC_UTF16 || tc->to == NC_UCS2) && tc->bom_pos < BOM_SIZE;
+}
+
+/***
+ * transcode
+ *
+ * The counterpart of iconv() for transcoders. Passing NULL @inbuf resets
+ * the conversion state.
+ *
+ * Returns 0 on success, or (size_t)-1 with errno set on error.
+ */
+
+size_t transcode(struct transcoder *tc,
+                 const char **inbuf, size_t *inbytesleft,
+                 char **outbuf, size_t *outbytesleft)
+{
+    uint8_t bom[BOM_SIZE];
+    const uint8_t *in;
+    const uint8_t *inend;
+    uint8_t *out;
+    uint8_t *outend;
+    int err = 0;
+
+    if (!inbuf || !*inbuf)
+    {
+        tc->bom_pos = 0;
+        return 0;
+    }
+
+    in = (const uint8_t *)*inbuf;
+    inend = in + *inbytesleft;
+    out = (uint8_t *)*outbuf;
+    outend = out + *outbytesleft;
+
+    /* the UCS-2 wrapper of iconv puts BOM first thing, while iconv itself
+     * puts the one of UTF-16 before the first valid character */
+    if (tc->to == NC_UCS2)
+    {
+        put16(bom, 0xFEFF, NATIVE_BE);
+
+        for (; tc->bom_pos < BOM_SIZE && out < outend; tc->bom_pos++)
+            *out++ = bom[tc->bom_pos];
+
+        if (tc->bom_pos < BOM_SIZE)
+            err = E2BIG;
+    }
+
+    while (!err && in < inend)
+    {
+        size_t i;
+
+        if (!is_bom_pending(tc))
+            run_kernel(tc, &in, inend, &out, outend);
+
+        for (i = 0; i < SCALAR_RUN && in < inend; i++)
+        {
+            uint32_t c;
+            size_t inlen;
+            size_t outlen;
+            int ret = decode_char(tc->from, in, inend - in, &c, &inlen);
+
+            if (ret == 0 && is_bom_pending(tc))
+            {
+                if (outend - out < BOM_SIZE)
+                    ret = -E2BIG;
+                else
+                {
+                    put16(out, 0xFEFF, NATIVE_BE);
+                    out += BOM_SIZE;
+                    tc->bom_pos = BOM_SIZE;
+                }
+            }
+
+            if (ret == 0)
+                ret = encode_char(tc->to, c, out, outend - out, &outlen);
+
+            if (ret != 0)
+            {
+                err = -ret;
+                break;
+            }
+
+            in += inlen;
+            out += outlen;
+        }
+    }
+
+    *inbytesleft = inend - in;
+    *inbuf = (const char *)in;
+    *outbytesleft = outend - out;
+    *outbuf = (char *)out;
+
+    if (err)
+    {
+        errno = err;
+        return (size_t)-1;
+    }
+
+    return 0;
+}
+
+/***
+ * get_char_size
+ *
+ * Returns the size of the character at @src which is to be skipped if it
+ * cannot be converted, i.e. the size of the whole character if it is
+ * valid, or of a single code unit otherwise.
+ */
+
+size_t get_char_size(const char *codeset, const char *src, size_t size)
+{
+    enum native_codeset cs = lookup_codeset(codeset);
+    uint32_t c;
+    size_t len;
+
+    if (cs == NC_NONE || cs == NC_UTF16 || cs == NC_UCS2)
+        return 1;
+
+    if (decode_char(cs, (const uint8_t *)src, size, &c, &len) == 0)
+        return len;
+
+    if (is_8bit(cs))
+        return 1;
+
+    len = (cs == NC_UTF32) ? 4 : 2;
+    return size < len ? 1 : len;
+}
+
+/***
+ * measure_text
+ *
+ * Counts characters of the text of @size bytes at @src in @codeset, up to
+ * @maxchars of them, or up to the first null character if @stop_at_nul is
+ * set. Text in UTF-16 or UCS-2 must start with BOM, which is counted in
+ * bytes but not in characters.
+ *
+ * Returns 0 on success, -EINVAL if @codeset is not native, or -EILSEQ if
+ * the characters counted are malformed.
+ */
+
+int measure_text(const char *codeset, const char *src, size_t size,
+                 size_t maxchars, int stop_at_nul, struct text_span *span)
+{
+    enum native_codeset cs = lookup_codeset(codeset);
+    const uint8_t *ptr = (const uint8_t *)src;
+    const uint8_t *end = ptr + size;
+    uint32_t c;
+    size_t len;
+
+    span->chars = 0;
+    span->is_ascii = 1;
+
+    if (cs == NC_NONE)
+        return -EINVAL;
+
+    if (cs == NC_UTF16 || cs == NC_UCS2)
+    {
+        if (size >= 2 && ptr[0] == 0xFF && ptr[1] == 0xFE)
+            cs = NC_UTF16LE;
+        else if (size >= 2 && ptr[0] == 0xFE && ptr[1] == 0xFF)
+            cs = NC_UTF16BE;
+        else
+            return -EINVAL;
+
+        ptr += 2;
+    }
+
+    while (ptr < end && span->chars < maxchars)
+    {
+#ifdef __SSE2__
+        if (is_8bit(cs) && end - ptr >= 16 && maxchars - span->chars >= 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)ptr);
+            int nul = _mm_movemask_epi8(_mm_cmpeq_epi8(v,
+                                                       _mm_setzero_si128()));
+
+            if (!_mm_movemask_epi8(v) && !(stop_at_nul && nul))
+            {
+                ptr += 16;
+                span->chars += 16;
+                continue;
+            }
+        }
+#endif
+        if (decode_char(cs, ptr, end - ptr, &c, &len) != 0)
+            return -EILSEQ;
+
+        if (c == 0 && stop_at_nul)
+            break;
+
+        if (c >= 0x80)
+            span->is_ascii = 0;
+
+        ptr += len;
+        span->chars++;
+    }
+
+    span->bytes = ptr - (const uint8_t *)src;
+    return 0;
+}
+
+/***
+ * is_same_text
+ *
+ * Tells whether text in @fromcode is the same in @tocode byte for byte,
+ * given whether the text is ASCII only.
+ */
+
+int is_same_text(const char *tocode, const char *fromcode, int is_ascii)
+{
+    enum native_codeset from = lookup_codeset(fromcode);
+    enum native_codeset to = lookup_codeset(tocode);
+
+    if (!is_8bit(from) || !is_8bit(to))
+        return 0;
+
+    return from == to || is_ascii;
+}
@@ -0,0 +1,49 @@
+#ifndef TRANSCODE_H
+#define TRANSCODE_H
+
+#include <stddef.h>
+
+/* codesets transcoded natively, without iconv */
+enum native_codeset
+{
+    NC_NONE = 0,
+    NC_ASCII,
+    NC_LATIN1,
+    NC_UTF8,
+    NC_UTF16,    /* native byte order with BOM, only as a target */
+    NC_UTF16LE,
+    NC_UTF16BE,
+    NC_UCS2,     /* native byte order with BOM, only as a target */
+    NC_UTF32,    /* u32_char, i.e. UTF-32 in native byte order */
+};
+
+struct transcoder
+{
+    enum native_codeset from;
+    enum native_codeset to;
+    size_t bom_pos;
+};
+
+/* characters at the start of a text, see measure_text() */
+struct text_span
+{
+    size_t chars;
+    size_t bytes;
+    int    is_ascii;  /* all the characters are ASCII */
+};
+
+int open_transcoder(struct transcoder *tc,
+                    const char *tocode, const char *fromcode);
+
+size_t transcode(struct transcoder *tc,
+                 const char **inbuf, size_t *inbytesleft,
+                 char **outbuf, size_t *outbytesleft);
+
+size_t get_char_size(const char *codeset, const char *src, size_t size);
+
+int measure_text(const char *codeset, const char *src, size_t size,
+                 size_t maxchars, int stop_at_nul, struct text_span *span);
+
+int is_same_text(const char *tocode, const char *fromcode, int is_ascii);
+
+#endif /* TRANSCODE_H */
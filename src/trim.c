@@ -1,6 +1,5 @@
 #include <assert.h>
 #include <errno.h>
-#include <unistd.h> /* SEEK_* */
 #include <string.h>
 #include "id3v2.h"
 #include "id3v1.h"
@@ -30,10 +29,8 @@ static int trim_trailing_chunk(struct file *file, const char *hdr,
 
     if (file->crop.start + size <= file->crop.end)
     {
-        lseek(file->fd, file->crop.end - size, SEEK_SET);
-        read(file->fd, buf, hdr_sz);
-
-        if (!memcmp(buf, hdr, hdr_sz))
+        if (read_file_chunk(file, file->crop.end - size, buf, hdr_sz) == 0
+            && !memcmp(buf, hdr, hdr_sz))
         {
             file->crop.end -= size;
             return 0;
@@ -103,8 +100,7 @@ int trim_id3v2_tag(struct file *file, unsigned minor)
     {
         /* check presence of an id3v2 header at the very beginning
          * of the crop area */
-        lseek(file->fd, file->crop.start, SEEK_SET);
-        ret = read_id3v2_header(file->fd, &hdr);
+        ret = read_id3v2_header(file, file->crop.start, &hdr);
 
         if (ret == 0)
         {
@@ -125,8 +121,8 @@ int trim_id3v2_tag(struct file *file, unsigned minor)
     {
         /* check presence of an id3v2 footer at the very end
          * of the crop area */
-        lseek(file->fd, file->crop.end - ID3V2_FOOTER_LEN, SEEK_SET);
-        ret = read_id3v2_footer(file->fd, &hdr);
+        ret = read_id3v2_footer(file, file->crop.end - ID3V2_FOOTER_LEN,
+                                &hdr);
 
         if (ret == 0)
         {
@@ -1,13 +1,21 @@
 #include <stddef.h>
+#include <string.h>   /* memcpy() */
 #include "u16_char.h"
 
+/* @s is not required to be aligned, as frame payloads may start at any
+ * offset within the tag buffer */
+
 void *u16_memchr(const void *s, u16_char c, size_t sz)
 {
-    const u16_char *u16_s = (const u16_char *)s;
+    const char *ptr = s;
+    u16_char ch;
 
-    for (; sz > 0; u16_s++, sz--)
-        if (*u16_s == c)
-            return (void *)u16_s;
+    for (; sz > 0; ptr += sizeof(u16_char), sz--)
+    {
+        memcpy(&ch, ptr, sizeof(u16_char));
+        if (ch == c)
+            return (void *)ptr;
+    }
 
     return NULL;
 }
@@ -51,7 +51,7 @@ u32_char *u32_xstrdup(const u32_char *str)
 void u32_xstrupd(u32_char **dst, const u32_char *src)
 {
     if (*dst == NULL)
-        free(*dst);
+        xfree(*dst);
 
     *dst = u32_xstrdup(src);
 }
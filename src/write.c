@@ -1,6 +1,7 @@
 #include <config.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/uio.h>    /* pwritev() */
 #include <unistd.h>
 #include "output.h"
 #include "params.h" /* NOT_SET */
@@ -9,15 +10,296 @@
 #include "id3v1.h"
 #include "id3v2.h"
 #include "file.h"
+#include "xalloc.h"
 
-int write_tags(const char *filename, const struct id3v1_tag *tag1,
+/*
+ * ID3v2 tags are written straight from their frames as laid out by
+ * layout_id3v2_tag(): payloads which are in memory (including the file
+ * mapping of another file) are gathered with the generated headers into
+ * iovecs and written with pwritev(), without being copied. The rest are
+ * copied through a bounded chunk buffer: payloads which have not been
+ * loaded, payloads which are to be unsynchronised, and payloads of the
+ * file being written, as they may be overwritten by the tag itself.
+ */
+
+/* bytes of a payload copied at a time, unsynchronisation may double it */
+#define WRITE_CHUNK_SIZE (16 * BLOCK_SIZE)
+
+/* iovecs gathered before they are written by a single pwritev() */
+#define WRITE_IOV_COUNT 64
+
+struct tag_writer
+{
+    int          fd;
+    off_t        pos;       /* file position queued data is written at */
+    off_t        end;       /* file position right after queued data */
+    struct iovec iov[WRITE_IOV_COUNT];
+    int          count;
+    char        *chunk;     /* buffer of 2 * WRITE_CHUNK_SIZE bytes */
+};
+
+static const char zero_block[BLOCK_SIZE];
+
+static ssize_t write_iov(int fd, const struct iovec *iov, int count,
+                         off_t pos)
+{
+#ifdef HAVE_PWRITEV
+    return pwritev(fd, iov, count, pos);
+#else
+    return pwrite(fd, iov->iov_base, iov->iov_len, pos);
+#endif
+}
+
+static int flush_writer(struct tag_writer *w)
+{
+    struct iovec *iov = w->iov;
+    int count = w->count;
+
+    while (count > 0)
+    {
+        ssize_t ret = write_iov(w->fd, iov, count, w->pos);
+
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            print_errno("write");
+            return -errno;
+        }
+
+        w->pos += ret;
+
+        /* skip what has been written, the rest is written again */
+        for (; count > 0 && (size_t)ret >= iov->iov_len; iov++, count--)
+            ret -= iov->iov_len;
+
+        if (count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    w->count = 0;
+
+    return 0;
+}
+
+static int queue_data(struct tag_writer *w, const void *data, size_t size)
+{
+    if (w->count == WRITE_IOV_COUNT && flush_writer(w) != 0)
+        return -EFAULT;
+
+    w->iov[w->count].iov_base = (void *)data;
+    w->iov[w->count].iov_len = size;
+    w->count++;
+    w->end += size;
+
+    return 0;
+}
+
+/* returns the position of the @piece payload within @file, or -1 if it is
+ * not read from @file */
+static off_t get_piece_pos(const struct file *file,
+                           const struct id3v2_tag *tag,
+                           const struct id3v2_piece *piece)
+{
+    if (!is_same_file(tag->origin, file->id) || piece->size == 0)
+        return -1;
+    else if (!piece->data)
+        return piece->offset;
+    else if (tag->map && piece->data >= tag->map
+             && piece->data < tag->map + tag->mapsize)
+        return piece->data - tag->map;
+
+    return -1;
+}
+
+/***
+ * detach_pieces
+ *
+ * Copies to memory the payloads of @file which would otherwise be
+ * overwritten before they are written: those which move towards the end
+ * of the file, those which are to be unsynchronised, as they grow, and
+ * those which lie past @moved_from, as the blocks there are about to be
+ * moved. The rest move towards the start of the file or stay where they
+ * are, and as the tag is written from its start on, they are read before
+ * anything is written over them.
+ *
+ * Returns 0 on success, or -EFAULT if a payload cannot be read.
+ */
+
+static int detach_pieces(const struct file *file,
+                         const struct id3v2_tag *tag,
+                         struct id3v2_layout *layout, off_t moved_from)
+{
+    off_t  pos = 0;
+    size_t i;
+
+    for (i = 0; i < layout->count; i++)
+    {
+        struct id3v2_piece *piece = &layout->pieces[i];
+        off_t src_pos = get_piece_pos(file, tag, piece);
+
+        if (src_pos >= 0 && (piece->is_unsync || pos > src_pos
+                             || src_pos + (off_t)piece->size > moved_from))
+        {
+            char *copy = xmalloc(piece->size);
+
+            if (read_file_chunk(file, src_pos, copy, piece->size) != 0)
+            {
+                xfree(copy);
+                return -EFAULT;
+            }
+
+            piece->data = copy;
+            piece->is_owned = 1;
+        }
+
+        pos += piece->packed_size;
+    }
+
+    return 0;
+}
+
+static int write_piece(struct tag_writer *w, const struct file *file,
+                       const struct id3v2_tag *tag,
+                       const struct id3v2_piece *piece)
+{
+    off_t  src_pos = get_piece_pos(file, tag, piece);
+    size_t done;
+
+    if (piece->size == 0)
+        return 0;
+
+    if (src_pos < 0 && piece->data && !piece->is_unsync)
+        return queue_data(w, piece->data, piece->size);
+
+    if (src_pos == w->end)
+    {
+        /* the payload is already where it has to be */
+        if (flush_writer(w) != 0)
+            return -EFAULT;
+
+        w->pos = w->end = w->end + piece->size;
+        return 0;
+    }
+
+    if (!w->chunk)
+        w->chunk = xmalloc(2 * WRITE_CHUNK_SIZE);
+
+    for (done = 0; done < piece->size; done += WRITE_CHUNK_SIZE)
+    {
+        size_t  size = piece->size - done;
+        ssize_t chunk_size;
+
+        if (size > WRITE_CHUNK_SIZE)
+            size = WRITE_CHUNK_SIZE;
+
+        chunk_size = render_id3v2_piece(tag, piece, done, size,
+                                        w->chunk, 2 * WRITE_CHUNK_SIZE);
+
+        /* the chunk buffer is reused, so it is written right away */
+        if (chunk_size < 0
+            || queue_data(w, w->chunk, chunk_size) != 0
+            || flush_writer(w) != 0)
+            return -EFAULT;
+    }
+
+    return 0;
+}
+
+/***
+ * write_id3v2_layout
+ *
+ * Writes the tag @tag laid out as @layout (see layout_id3v2_tag()) to the
+ * start of @file, which may be the very file the tag has been read from,
+ * in which case its pieces have to be detached first (see detach_pieces()).
+ *
+ * Returns 0 on success, or -EFAULT on read or write error.
+ */
+
+static int write_id3v2_layout(const struct file *file,
+                              const struct id3v2_tag *tag,
+                              struct id3v2_layout *layout)
+{
+    struct tag_writer w = { .fd = file->fd };
+    size_t padding;
+    size_t i;
+    int ret = 0;
+
+    for (i = 0; ret == 0 && i < layout->count; i++)
+        ret = write_piece(&w, file, tag, &layout->pieces[i]);
+
+    for (padding = layout->size - w.end; ret == 0 && padding > 0;)
+    {
+        size_t size = (padding > sizeof(zero_block))
+                      ? sizeof(zero_block) : padding;
+
+        ret = queue_data(&w, zero_block, size);
+        padding -= size;
+    }
+
+    if (ret == 0)
+        ret = flush_writer(&w);
+
+    xfree(w.chunk);
+
+    return SUCC_OR_FAULT(ret);
+}
+
+/***
+ * get_padded_size
+ *
+ * Returns the size the tag laid out as @layout is to take in @file when it
+ * does not fit the space of the old one: the frames are followed by the
+ * headroom configured with --padding, and then by as much padding as it
+ * takes for the tag to grow by a multiple of the filesystem block size, so
+ * that the payload can be moved by whole blocks (see move_file_blocks()).
+ * The end of the tag itself is block aligned only if the payload is.
+ */
+
+static off_t get_padded_size(const struct id321_config *conf,
+                             const struct file *file,
+                             const struct id3v2_layout *layout)
+{
+    off_t  size = 0;
+    off_t  headroom = conf->padding;
+    off_t  delta;
+    size_t i;
+
+    for (i = 0; i < layout->count; i++)
+        size += layout->pieces[i].packed_size;
+
+    if (conf->options & ID321_OPT_PADDING_PERCENT)
+        headroom = size * conf->padding / 100;
+
+    if (headroom > conf->padding_max)
+        headroom = conf->padding_max;
+
+    size += headroom;
+
+    if (size < (off_t)layout->size)
+        size = layout->size;
+
+    delta = size - file->crop.start;
+
+    if (delta > 0 && delta % file->blksize != 0)
+        size += file->blksize - delta % file->blksize;
+
+    return size;
+}
+
+int write_tags(const struct id321_config *conf,
+               const char *filename, const struct id3v1_tag *tag1,
                const struct id3v2_tag *tag2)
 {
     struct file *file;
     char tag1_buf[ID3V1E_TAG_SIZE];
     size_t tag1_size = 0;
-    char *tag2_buf;
+    struct id3v2_layout layout = { NULL };
     ssize_t tag2_size = 0;
+    off_t delta = 0;
     int ret;
 
     file = open_file(filename, O_RDWR);
@@ -48,7 +330,7 @@ int write_tags(const char *filename, const struct id3v1_tag *tag1,
             return -EFAULT;
         }
 
-        if (tag2->frame_head.next == &tag2->frame_head)
+        if (tag2->frame_count == 0)
         {
             /* ID3v2.x standards: "A tag MUST contain at least one frame." */
             print(OS_WARN, "%s: no frames, ID3v2 tag omitted", filename);
@@ -56,7 +338,7 @@ int write_tags(const char *filename, const struct id3v1_tag *tag1,
         else
         {
             off_t no_tag2_size = file->crop.end - file->crop.start + tag1_size;
-            tag2_size = pack_id3v2_tag(tag2, &tag2_buf, no_tag2_size);
+            tag2_size = layout_id3v2_tag(conf, tag2, &layout, no_tag2_size);
 
             if (tag2_size < 0)
             {
@@ -69,6 +351,9 @@ int write_tags(const char *filename, const struct id3v1_tag *tag1,
                     case -EINVAL:
                         print(OS_ERROR, "%s: frame too big", filename);
                         break;
+                    case -EFAULT:
+                        print(OS_ERROR, "%s: unable to read frame", filename);
+                        break;
                 }
                 return -EFAULT;
             }
@@ -76,16 +361,99 @@ int write_tags(const char *filename, const struct id3v1_tag *tag1,
     }
 
     /* check if existing padding space is not enough or should be changed */
-    if (tag2 && file->crop.start != tag2_size)
-        ret = shift_file_payload(file, tag2_size - file->crop.start);
-
     if (tag2)
+        delta = tag2_size - file->crop.start;
+
+    /* if the payload is to be moved anyway, padding is reserved for the
+     * changes to come */
+    if (delta > 0 && tag2_size > 0
+        && !(conf->options & ID321_OPT_CHANGE_SIZE))
     {
-        lseek(file->fd, 0, SEEK_SET);
-        write(file->fd, tag2_buf, tag2_size);
+        off_t size = get_padded_size(conf, file, &layout);
+
+        if (size > tag2_size && pad_id3v2_layout(&layout, size) == 0)
+        {
+            tag2_size = size;
+            delta = tag2_size - file->crop.start;
+        }
+    }
+
+    if (tag2 && tag2_size > 0)
+    {
+        /* moving blocks moves the tail of the old tag along with the
+         * payload, and collapsing drops blocks in front of it */
+        off_t moved_from = file->crop.start;
+
+        if (delta != 0 && delta % file->blksize == 0)
+        {
+            moved_from -= file->crop.start % file->blksize;
+
+            if (delta < 0)
+                moved_from += delta;
+        }
+
+        if (detach_pieces(file, tag2, &layout, moved_from) != 0)
+        {
+            print(OS_ERROR, "%s: unable to read frame", filename);
+            free_id3v2_layout(&layout);
+            close_file(file);
+            return -EFAULT;
+        }
+    }
+
+    /* the payload is moved before the tag is written if the tag grows, and
+     * after that if it shrinks, so that neither overwrites the other; its
+     * blocks can be moved beforehand in either case */
+    if (delta != 0 && !(conf->options & ID321_OPT_REWRITE)
+        && move_file_blocks(file, delta) == 0)
+        delta = 0;
+    else if (delta != 0
+             && (ret = clone_file_payload(file, delta,
+                                          conf->options & ID321_OPT_REWRITE))
+                != -EOPNOTSUPP)
+    {
+        /* the file is rewritten into a sibling, which replaces it in the
+         * end, the payload is already in place */
+        if (ret != 0)
+        {
+            print(OS_ERROR, "%s: unable to move payload", filename);
+            free_id3v2_layout(&layout);
+            close_file(file);
+            return -EFAULT;
+        }
+
+        delta = 0;
+    }
+    else if (delta > 0 && shift_file_payload(file, delta) != 0)
+    {
+        print(OS_ERROR, "%s: unable to move payload", filename);
+        free_id3v2_layout(&layout);
+        close_file(file);
+        return -EFAULT;
+    }
+
+    if (tag2 && tag2_size > 0)
+    {
+        ret = write_id3v2_layout(file, tag2, &layout);
+        free_id3v2_layout(&layout);
+
+        if (ret != 0)
+        {
+            print(OS_ERROR, "%s: unable to write ID3v2 tag", filename);
+            close_file(file);
+            return -EFAULT;
+        }
+
         print(OS_INFO, "ID3v2.%u tag written", tag2->header.version);
     }
 
+    if (delta < 0 && shift_file_payload(file, delta) != 0)
+    {
+        print(OS_ERROR, "%s: unable to move payload", filename);
+        close_file(file);
+        return -EFAULT;
+    }
+
     if (tag1)
     {
         lseek(file->fd, file->crop.end, SEEK_SET);
@@ -99,7 +467,8 @@ int write_tags(const char *filename, const struct id3v1_tag *tag1,
         ftruncate(file->fd, file->crop.end);
     }
 
+    ret = commit_file(file);
     close_file(file);
 
-    return 0;
+    return SUCC_OR_FAULT(ret);
 }
@@ -1,9 +1,87 @@
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include "arena.h"
 #include "common.h"
+#include "xalloc.h"
+
+/* arena the memory of the calling thread is allocated from, if any */
+static __thread struct arena *alloc_arena;
+
+/* functions the heap memory is allocated with */
+static void *(*heap_malloc_hook)(size_t) = malloc;
+static void *(*heap_realloc_hook)(void *, size_t) = realloc;
+static void (*heap_free_hook)(void *) = free;
+
+/***
+ * set_heap_hooks
+ *
+ * Makes all the heap memory, including arena chunks, be allocated with
+ * @alloc_fn and @realloc_fn, and freed with @free_fn. The hooks may only
+ * be changed when no memory is allocated from the heap, i.e. before
+ * anything else is done.
+ */
+
+void set_heap_hooks(void *(*alloc_fn)(size_t),
+                    void *(*realloc_fn)(void *, size_t),
+                    void (*free_fn)(void *))
+{
+    heap_malloc_hook = alloc_fn;
+    heap_realloc_hook = realloc_fn;
+    heap_free_hook = free_fn;
+}
+
+/* the heap allocators return NULL on failure, having set errno */
+
+void *heap_alloc(size_t sz)
+{
+    void *buf = heap_malloc_hook(sz ? sz : 1);
+
+    if (!buf)
+        errno = ENOMEM;
+
+    return buf;
+}
+
+void *heap_realloc(void *ptr, size_t sz)
+{
+    void *buf = heap_realloc_hook(ptr, sz ? sz : 1);
+
+    if (!buf)
+        errno = ENOMEM;
+
+    return buf;
+}
+
+void heap_free(void *ptr)
+{
+    if (ptr)
+        heap_free_hook(ptr);
+}
+
+/***
+ * set_alloc_arena
+ *
+ * Makes xmalloc(), xcalloc(), xrealloc() allocate memory from @arena, and
+ * xfree() leave it to the arena, or restores the heap if @arena is NULL.
+ * The arena may only be changed when there is no memory allocated since
+ * the previous change left in use, i.e. between files processed. Each
+ * thread has its own arena.
+ */
+
+void set_alloc_arena(struct arena *arena)
+{
+    alloc_arena = arena;
+}
 
 void *xmalloc(size_t sz)
 {
-    void *buf = malloc(sz);
+    void *buf;
+
+    if (alloc_arena)
+        return arena_alloc(alloc_arena, sz);
+
+    buf = heap_alloc(sz);
 
     if (!buf)
         fatal("can't allocate %lu bytes of memory", (unsigned long)sz);
@@ -13,21 +91,44 @@ void *xmalloc(size_t sz)
 
 void *xcalloc(size_t nmemb, size_t sz)
 {
-    void *buf = calloc(nmemb, sz);
+    void *buf;
+
+    if (sz != 0 && nmemb > (size_t)-1 / sz)
+    {
+        errno = ENOMEM;
+        fatal("can't allocate %lu bytes of memory",
+              (unsigned long)(nmemb * sz));
+    }
+
+    buf = alloc_arena ? arena_alloc(alloc_arena, nmemb * sz)
+                      : heap_alloc(nmemb * sz);
 
     if (!buf)
         fatal("can't allocate %lu bytes of memory",
               (unsigned long)(nmemb * sz));
 
-    return buf;
+    return memset(buf, 0, nmemb * sz);
 }
 
 void *xrealloc(void *ptr, size_t sz)
 {
-    void *buf = realloc(ptr, sz);
+    void *buf;
+
+    if (alloc_arena)
+        return arena_realloc(alloc_arena, ptr, sz);
+
+    buf = heap_realloc(ptr, sz);
 
     if (!buf)
         fatal("can't allocate %lu bytes of memory", (unsigned long)sz);
 
     return buf;
 }
+
+void xfree(void *ptr)
+{
+    if (alloc_arena)
+        arena_free(alloc_arena, ptr);
+    else
+        heap_free(ptr);
+}
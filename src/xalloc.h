@@ -3,8 +3,20 @@
 
 #include <stddef.h>
 
+struct arena;
+
+void set_alloc_arena(struct arena *arena);
+
+void set_heap_hooks(void *(*alloc_fn)(size_t),
+                    void *(*realloc_fn)(void *, size_t),
+                    void (*free_fn)(void *));
+void *heap_alloc(size_t sz);
+void *heap_realloc(void *ptr, size_t sz);
+void heap_free(void *ptr);
+
 void *xmalloc(size_t sz);
 void *xcalloc(size_t nmemb, size_t sz);
 void *xrealloc(void *ptr, size_t sz);
+void xfree(void *ptr);
 
 #endif /* XALLOC_H */